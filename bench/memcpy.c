@@ -0,0 +1,209 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Benchmarks
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+Checks every memcpySSE kernel the CPU supports and the threaded multimemcpy
+against memcpy, then times each of them on BGRA frame sized copies. Several
+buffers are rotated through so the source isn't already in the cache, as is the
+case for a frame in shared memory.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "debug.h"
+#include "memcpySSE.h"
+#include "MultiMemcpy.h"
+
+#if !defined(__x86_64__)
+  #error "The memcpySSE kernels are only built for x86-64"
+#endif
+
+#define BUFFERS 4
+
+struct Kernel
+{
+  const char * name;
+  MemcpyFn     fn;
+  bool         supported;
+};
+
+struct FrameSize
+{
+  const char * name;
+  unsigned int width, height;
+};
+
+static const struct FrameSize sizes[] =
+{
+  { "1080p", 1920, 1080 },
+  { "1440p", 2560, 1440 },
+  { "4K"   , 3840, 2160 }
+};
+
+static uint64_t nanotime()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
+}
+
+// copy odd lengths between odd alignments and check nothing past the end was written
+static bool verify(const struct Kernel * k, uint8_t * src, uint8_t * dst, uint8_t * ref)
+{
+  static const size_t lengths[] =
+  {
+    0, 1, 15, 16, 17, 127, 128, 129, 255, 256, 257, 4095,
+    MEMCPY_NT_THRESHOLD - 1, MEMCPY_NT_THRESHOLD, MEMCPY_NT_THRESHOLD + 1,
+    3 * 1024 * 1024 + 7, 16 * 1024 * 1024 + 5
+  };
+
+  for(unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+    for(unsigned int so = 0; so < 64; so += 13)
+      for(unsigned int doff = 0; doff < 64; doff += 7)
+      {
+        const size_t len = lengths[l];
+        memset(dst, 0xAA, len + 128);
+        memset(ref, 0xAA, len + 128);
+        memcpy  (ref + doff, src + so, len);
+        k->fn   (dst + doff, src + so, len);
+        if (memcmp(dst, ref, len + 128) != 0)
+        {
+          DEBUG_ERROR("%s failed copying %lu bytes from offset %u to offset %u",
+            k->name, (unsigned long)len, so, doff);
+          return false;
+        }
+      }
+
+  return true;
+}
+
+static void * multiCopy(void * dst, const void * src, size_t length)
+{
+  multimemcpy(dst, src, length);
+  return dst;
+}
+
+static double bench(const struct Kernel * k, uint8_t ** src, uint8_t ** dst, const size_t len, const unsigned int loops)
+{
+  // warm up the page tables and the kernel's code path
+  for(int i = 0; i < BUFFERS; ++i)
+    k->fn(dst[i], src[i], len);
+
+  const uint64_t start = nanotime();
+  for(unsigned int i = 0; i < loops; ++i)
+    k->fn(dst[i % BUFFERS], src[(i + 1) % BUFFERS], len);
+
+  return (double)(nanotime() - start) / loops;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int loops   = 100;
+  unsigned int threads = 0;
+  if (argc > 1)
+    loops = atoi(argv[1]);
+  if (argc > 2)
+    threads = atoi(argv[2]);
+
+  if (loops == 0)
+  {
+    fprintf(stderr, "Usage: %s [LOOPS] [COPY THREADS]\n", argv[0]);
+    return -1;
+  }
+
+  if (!multimemcpy_init(threads))
+    return -1;
+
+  const struct Kernel kernels[] =
+  {
+    { "memcpy"   , (MemcpyFn)memcpy , true                  },
+    { "erms"     , memcpySSE_erms   , memcpySSE_hasERMS()   },
+    { "sse2"     , memcpySSE_sse2   , true                  },
+    { "avx2"     , memcpySSE_avx2   , memcpySSE_hasAVX2()   },
+    { "avx512"   , memcpySSE_avx512 , memcpySSE_hasAVX512() },
+    { "memcpySSE", memcpySSE        , true                  },
+    { "multi"    , multiCopy        , true                  }
+  };
+  const int kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+
+  const size_t maxLen = (size_t)3840 * 2160 * 4 + 128;
+  uint8_t * src[BUFFERS], * dst[BUFFERS];
+  for(int i = 0; i < BUFFERS; ++i)
+  {
+    if (posix_memalign((void **)&src[i], 0x1000, maxLen) != 0 ||
+        posix_memalign((void **)&dst[i], 0x1000, maxLen) != 0)
+    {
+      DEBUG_ERROR("Failed to allocate the buffers");
+      return -1;
+    }
+
+    for(size_t j = 0; j < maxLen; ++j)
+      src[i][j] = (uint8_t)(j * 31 + i);
+    memset(dst[i], 0, maxLen);
+  }
+
+  bool ok = true;
+  for(int i = 0; i < kernelCount; ++i)
+  {
+    if (!kernels[i].supported)
+    {
+      DEBUG_INFO("%-9s : not supported by this CPU", kernels[i].name);
+      continue;
+    }
+
+    if (!verify(&kernels[i], src[0], dst[0], dst[1]))
+      ok = false;
+  }
+
+  if (!ok)
+    return -1;
+
+  DEBUG_INFO("All supported kernels match memcpy");
+  for(unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+  {
+    const size_t len = (size_t)sizes[s].width * sizes[s].height * 4;
+    for(int i = 0; i < kernelCount; ++i)
+    {
+      if (!kernels[i].supported)
+        continue;
+
+      const double ns = bench(&kernels[i], src, dst, len, loops);
+      DEBUG_INFO("%-5s %-9s : %7.3f ms, %6.2f GB/s",
+        sizes[s].name,
+        kernels[i].name,
+        ns / 1000000.0,
+        (double)len / ns
+      );
+    }
+  }
+
+  for(int i = 0; i < BUFFERS; ++i)
+  {
+    free(src[i]);
+    free(dst[i]);
+  }
+
+  multimemcpy_free();
+  return 0;
+}
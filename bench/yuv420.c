@@ -0,0 +1,217 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Benchmarks
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+Checks each vector YUV420 to BGRA kernel the CPU supports is bit exact with the
+scalar reference for every Y, U and V combination and on odd sized frames, then
+times them all on 1080p, 1440p and 4K frames.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "decoders/yuv420-convert.h"
+
+struct FrameSize
+{
+  const char * name;
+  unsigned int width, height;
+};
+
+static const struct FrameSize sizes[] =
+{
+  { "1080p", 1920, 1080 },
+  { "1440p", 2560, 1440 },
+  { "4K"   , 3840, 2160 }
+};
+
+struct Frame
+{
+  uint8_t    * yuv;
+  uint8_t    * out;
+  uint8_t    * ref;
+  YUV420Planes planes;
+};
+
+static uint64_t nanotime()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
+}
+
+static bool frame_alloc(struct Frame * f, const unsigned int width, const unsigned int height)
+{
+  const size_t ySize = (size_t)width * height;
+  const size_t cSize = (size_t)(width / 2) * ((height + 1) / 2);
+
+  f->yuv = malloc(ySize + cSize * 2);
+  f->out = malloc(ySize * 4);
+  f->ref = malloc(ySize * 4);
+  if (!f->yuv || !f->out || !f->ref)
+  {
+    DEBUG_ERROR("Failed to allocate a %ux%u frame", width, height);
+    return false;
+  }
+
+  for(size_t i = 0; i < ySize + cSize * 2; ++i)
+    f->yuv[i] = rand();
+
+  f->planes.y      = f->yuv;
+  f->planes.u      = f->yuv + ySize;
+  f->planes.v      = f->yuv + ySize + cSize;
+  f->planes.dst    = f->out;
+  f->planes.width  = width;
+  f->planes.height = height;
+  return true;
+}
+
+static void frame_free(struct Frame * f)
+{
+  free(f->yuv);
+  free(f->out);
+  free(f->ref);
+}
+
+static bool frame_check(struct Frame * f, const YUV420Kernel kernel)
+{
+  const size_t size = (size_t)f->planes.width * f->planes.height * 4;
+  memset(f->out, 0, size);
+  memset(f->ref, 0, size);
+
+  yuv420_to_bgra_kernel(&f->planes, 0, f->planes.height, kernel);
+  f->planes.dst = f->ref;
+  yuv420_to_bgra_ref(&f->planes, 0, f->planes.height);
+  f->planes.dst = f->out;
+
+  return memcmp(f->out, f->ref, size) == 0;
+}
+
+// every U and V pair against every Y value in both rows
+static bool check_all(const YUV420Kernel kernel)
+{
+  struct Frame f;
+  if (!frame_alloc(&f, 256, 2))
+    return false;
+
+  uint8_t * y = (uint8_t *)f.planes.y;
+  for(unsigned int i = 0; i < 256; ++i)
+  {
+    y[i      ] = i;
+    y[i + 256] = 255 - i;
+  }
+
+  bool ok = true;
+  for(unsigned int u = 0; u < 256 && ok; ++u)
+    for(unsigned int v = 0; v < 256 && ok; ++v)
+    {
+      memset((uint8_t *)f.planes.u, u, 128);
+      memset((uint8_t *)f.planes.v, v, 128);
+      if (!frame_check(&f, kernel))
+      {
+        DEBUG_ERROR("%s mismatch with U %u and V %u", yuv420_kernel_str(kernel), u, v);
+        ok = false;
+      }
+    }
+
+  frame_free(&f);
+  return ok;
+}
+
+static bool check_size(const YUV420Kernel kernel, const unsigned int width, const unsigned int height)
+{
+  struct Frame f;
+  bool ok = frame_alloc(&f, width, height) && frame_check(&f, kernel);
+  if (!ok)
+    DEBUG_ERROR("%s mismatch on a %ux%u frame", yuv420_kernel_str(kernel), width, height);
+
+  frame_free(&f);
+  return ok;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int loops = 20;
+  if (argc > 1)
+    loops = atoi(argv[1]);
+
+  if (loops == 0)
+  {
+    fprintf(stderr, "Usage: %s [LOOPS]\n", argv[0]);
+    return -1;
+  }
+
+  DEBUG_INFO("Kernel          : %s", yuv420_kernel_name());
+
+  // check every kernel, not just the one this CPU would dispatch to
+  for(YUV420Kernel k = 0; k < YUV420_KERNEL_MAX; ++k)
+  {
+    if (!yuv420_kernel_supported(k))
+    {
+      DEBUG_WARN("%s is not supported by this CPU, not checked", yuv420_kernel_str(k));
+      continue;
+    }
+
+    if (!check_all(k) ||
+        !check_size(k, 2   , 2  ) ||
+        !check_size(k, 18  , 3  ) ||
+        !check_size(k, 50  , 7  ) ||
+        !check_size(k, 1366, 768) ||
+        !check_size(k, 1920, 1081))
+      return -1;
+
+    DEBUG_INFO("%s is bit exact with the scalar reference", yuv420_kernel_str(k));
+  }
+
+  for(unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+  {
+    struct Frame f;
+    if (!frame_alloc(&f, sizes[s].width, sizes[s].height))
+      return -1;
+
+    uint64_t start = nanotime();
+    for(unsigned int i = 0; i < loops; ++i)
+      yuv420_to_bgra_ref(&f.planes, 0, f.planes.height);
+    const double ref = (double)(nanotime() - start) / loops / 1000000.0;
+
+    DEBUG_INFO("%-5s scalar %7.3f ms", sizes[s].name, ref);
+
+    for(YUV420Kernel k = 0; k < YUV420_KERNEL_MAX; ++k)
+    {
+      if (!yuv420_kernel_supported(k))
+        continue;
+
+      start = nanotime();
+      for(unsigned int i = 0; i < loops; ++i)
+        yuv420_to_bgra_kernel(&f.planes, 0, f.planes.height, k);
+      const double simd = (double)(nanotime() - start) / loops / 1000000.0;
+
+      DEBUG_INFO("%-5s %-6s %7.3f ms (%.1fx)",
+        sizes[s].name, yuv420_kernel_str(k), simd, ref / simd);
+    }
+
+    frame_free(&f);
+  }
+
+  return 0;
+}
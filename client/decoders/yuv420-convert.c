@@ -0,0 +1,317 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "yuv420-convert.h"
+
+#include <stddef.h>
+#include <immintrin.h>
+
+/*
+The coefficients scaled by 64. With Y offset and rounding applied the luma term
+fits in 16 bits, as do the chroma terms, so the vector kernels work on eight or
+sixteen 16 bit lanes. Only blue can overflow, and only when the real value is
+well past 255, so a saturating add there still clamps to the same result.
+*/
+#define YG 75  // 1.164
+#define UB 129 // 2.018
+#define UG 25  // 0.391
+#define VG 52  // 0.813
+#define VR 102 // 1.596
+
+typedef unsigned int (*YUV420RowFn)(const uint8_t * y0, const uint8_t * y1,
+    const uint8_t * u, const uint8_t * v, uint8_t * d0, uint8_t * d1,
+    const unsigned int width);
+
+static inline uint8_t clamp6(const int x)
+{
+  const int v = x >> 6;
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline void pixel_ref(const uint8_t y, const int cb, const int cg, const int cr, uint8_t * d)
+{
+  const int yv = ((int)y - 16) * YG + 32;
+  d[0] = clamp6(yv + cb);
+  d[1] = clamp6(yv - cg);
+  d[2] = clamp6(yv + cr);
+  d[3] = 0xFF;
+}
+
+// converts pixels [x, width) of a pair of rows that share the chroma, y1 may be NULL
+static void rows_ref(const uint8_t * y0, const uint8_t * y1, const uint8_t * u,
+    const uint8_t * v, uint8_t * d0, uint8_t * d1, unsigned int x,
+    const unsigned int width)
+{
+  for(; x < width; ++x)
+  {
+    const int cu = (int)u[x / 2] - 128;
+    const int cv = (int)v[x / 2] - 128;
+    const int cb = UB * cu;
+    const int cg = UG * cu + VG * cv;
+    const int cr = VR * cv;
+
+    pixel_ref(y0[x], cb, cg, cr, d0 + x * 4);
+    if (y1)
+      pixel_ref(y1[x], cb, cg, cr, d1 + x * 4);
+  }
+}
+
+static inline void pixels8_sse2(const __m128i y, const __m128i cb, const __m128i cg,
+    const __m128i cr, uint8_t * d)
+{
+  const __m128i zero  = _mm_setzero_si128();
+  const __m128i max   = _mm_set1_epi16(255);
+  const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+  __m128i b = _mm_srai_epi16(_mm_adds_epi16(y, cb), 6);
+  __m128i g = _mm_srai_epi16(_mm_subs_epi16(y, cg), 6);
+  __m128i r = _mm_srai_epi16(_mm_adds_epi16(y, cr), 6);
+  b = _mm_max_epi16(_mm_min_epi16(b, max), zero);
+  g = _mm_max_epi16(_mm_min_epi16(g, max), zero);
+  r = _mm_max_epi16(_mm_min_epi16(r, max), zero);
+
+  // each lane as B | G << 8 and R | A << 8, interleaved they are BGRA
+  const __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+  const __m128i ra = _mm_or_si128(r, alpha);
+  _mm_storeu_si128((__m128i *)(d + 0x00), _mm_unpacklo_epi16(bg, ra));
+  _mm_storeu_si128((__m128i *)(d + 0x10), _mm_unpackhi_epi16(bg, ra));
+}
+
+static inline void row_sse2(const uint8_t * y, uint8_t * d,
+    const __m128i cb0, const __m128i cg0, const __m128i cr0,
+    const __m128i cb1, const __m128i cg1, const __m128i cr1)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i off  = _mm_set1_epi16(16);
+  const __m128i yg   = _mm_set1_epi16(YG);
+  const __m128i rnd  = _mm_set1_epi16(32);
+  const __m128i yy   = _mm_loadu_si128((const __m128i *)y);
+
+  const __m128i y0 = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(
+        _mm_unpacklo_epi8(yy, zero), off), yg), rnd);
+  const __m128i y1 = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(
+        _mm_unpackhi_epi8(yy, zero), off), yg), rnd);
+
+  pixels8_sse2(y0, cb0, cg0, cr0, d + 0x00);
+  pixels8_sse2(y1, cb1, cg1, cr1, d + 0x20);
+}
+
+// 16 pixels of both rows per iteration, returns how many pixels were done
+static unsigned int rows_sse2(const uint8_t * y0, const uint8_t * y1,
+    const uint8_t * u, const uint8_t * v, uint8_t * d0, uint8_t * d1,
+    const unsigned int width)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+
+  unsigned int x = 0;
+  for(; x + 16 <= width; x += 16)
+  {
+    const __m128i cu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + x / 2)), zero), bias);
+    const __m128i cv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + x / 2)), zero), bias);
+
+    const __m128i cb = _mm_mullo_epi16(cu, _mm_set1_epi16(UB));
+    const __m128i cg = _mm_add_epi16(
+        _mm_mullo_epi16(cu, _mm_set1_epi16(UG)),
+        _mm_mullo_epi16(cv, _mm_set1_epi16(VG)));
+    const __m128i cr = _mm_mullo_epi16(cv, _mm_set1_epi16(VR));
+
+    // each chroma sample covers two pixels
+    const __m128i cb0 = _mm_unpacklo_epi16(cb, cb), cb1 = _mm_unpackhi_epi16(cb, cb);
+    const __m128i cg0 = _mm_unpacklo_epi16(cg, cg), cg1 = _mm_unpackhi_epi16(cg, cg);
+    const __m128i cr0 = _mm_unpacklo_epi16(cr, cr), cr1 = _mm_unpackhi_epi16(cr, cr);
+
+    row_sse2(y0 + x, d0 + x * 4, cb0, cg0, cr0, cb1, cg1, cr1);
+    if (y1)
+      row_sse2(y1 + x, d1 + x * 4, cb0, cg0, cr0, cb1, cg1, cr1);
+  }
+
+  return x;
+}
+
+__attribute__((target("avx2")))
+static inline void pixels16_avx2(const __m256i y, const __m256i cb, const __m256i cg,
+    const __m256i cr, uint8_t * d)
+{
+  const __m256i zero  = _mm256_setzero_si256();
+  const __m256i max   = _mm256_set1_epi16(255);
+  const __m256i alpha = _mm256_set1_epi16((short)0xFF00);
+  __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(y, cb), 6);
+  __m256i g = _mm256_srai_epi16(_mm256_subs_epi16(y, cg), 6);
+  __m256i r = _mm256_srai_epi16(_mm256_adds_epi16(y, cr), 6);
+  b = _mm256_max_epi16(_mm256_min_epi16(b, max), zero);
+  g = _mm256_max_epi16(_mm256_min_epi16(g, max), zero);
+  r = _mm256_max_epi16(_mm256_min_epi16(r, max), zero);
+
+  const __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+  const __m256i ra = _mm256_or_si256(r, alpha);
+
+  // the unpacks work within each 128 bit lane, put the pixels back in order
+  const __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+  const __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+  _mm256_storeu_si256((__m256i *)(d + 0x00), _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256((__m256i *)(d + 0x20), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2")))
+static inline void row_avx2(const uint8_t * y, uint8_t * d,
+    const __m256i cb0, const __m256i cg0, const __m256i cr0,
+    const __m256i cb1, const __m256i cg1, const __m256i cr1)
+{
+  const __m256i off = _mm256_set1_epi16(16);
+  const __m256i yg  = _mm256_set1_epi16(YG);
+  const __m256i rnd = _mm256_set1_epi16(32);
+  const __m256i yy  = _mm256_loadu_si256((const __m256i *)y);
+
+  const __m256i y0 = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(yy)), off), yg), rnd);
+  const __m256i y1 = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(yy, 1)), off), yg), rnd);
+
+  pixels16_avx2(y0, cb0, cg0, cr0, d + 0x00);
+  pixels16_avx2(y1, cb1, cg1, cr1, d + 0x40);
+}
+
+// 32 pixels of both rows per iteration
+__attribute__((target("avx2")))
+static unsigned int rows_avx2(const uint8_t * y0, const uint8_t * y1,
+    const uint8_t * u, const uint8_t * v, uint8_t * d0, uint8_t * d1,
+    const unsigned int width)
+{
+  const __m256i bias = _mm256_set1_epi16(128);
+
+  unsigned int x = 0;
+  for(; x + 32 <= width; x += 32)
+  {
+    const __m256i cu = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + x / 2))), bias);
+    const __m256i cv = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + x / 2))), bias);
+
+    const __m256i cb = _mm256_mullo_epi16(cu, _mm256_set1_epi16(UB));
+    const __m256i cg = _mm256_add_epi16(
+        _mm256_mullo_epi16(cu, _mm256_set1_epi16(UG)),
+        _mm256_mullo_epi16(cv, _mm256_set1_epi16(VG)));
+    const __m256i cr = _mm256_mullo_epi16(cv, _mm256_set1_epi16(VR));
+
+    // duplicate each chroma sample for its two pixels, again fixing up the lanes
+    __m256i lo, hi;
+    lo = _mm256_unpacklo_epi16(cb, cb); hi = _mm256_unpackhi_epi16(cb, cb);
+    const __m256i cb0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+    const __m256i cb1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+    lo = _mm256_unpacklo_epi16(cg, cg); hi = _mm256_unpackhi_epi16(cg, cg);
+    const __m256i cg0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+    const __m256i cg1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+    lo = _mm256_unpacklo_epi16(cr, cr); hi = _mm256_unpackhi_epi16(cr, cr);
+    const __m256i cr0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+    const __m256i cr1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+
+    row_avx2(y0 + x, d0 + x * 4, cb0, cg0, cr0, cb1, cg1, cr1);
+    if (y1)
+      row_avx2(y1 + x, d1 + x * 4, cb0, cg0, cr0, cb1, cg1, cr1);
+  }
+
+  return x;
+}
+
+static const struct
+{
+  const char * name;
+  YUV420RowFn  fn;
+}
+kernels[YUV420_KERNEL_MAX] =
+{
+  [YUV420_KERNEL_SSE2] = { "SSE2", rows_sse2 },
+  [YUV420_KERNEL_AVX2] = { "AVX2", rows_avx2 }
+};
+
+bool yuv420_kernel_supported(const YUV420Kernel kernel)
+{
+  switch(kernel)
+  {
+    case YUV420_KERNEL_SSE2:
+      return true; // part of x86-64
+
+    case YUV420_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+
+    default:
+      return false;
+  }
+}
+
+const char * yuv420_kernel_str(const YUV420Kernel kernel)
+{
+  return kernel < YUV420_KERNEL_MAX ? kernels[kernel].name : "Unknown";
+}
+
+static YUV420Kernel yuv420_select()
+{
+  if (yuv420_kernel_supported(YUV420_KERNEL_AVX2))
+    return YUV420_KERNEL_AVX2;
+
+  return YUV420_KERNEL_SSE2;
+}
+
+static void convert(const YUV420Planes * p, unsigned int start, unsigned int end, YUV420RowFn fn)
+{
+  const unsigned int hw = p->width / 2;
+  if (end > p->height)
+    end = p->height;
+
+  for(unsigned int y = start; y < end; y += 2)
+  {
+    const uint8_t * y0 = p->y   + (size_t)y * p->width;
+    const uint8_t * y1 = y + 1 < end ? y0 + p->width : NULL;
+    const uint8_t * u  = p->u   + (size_t)(y / 2) * hw;
+    const uint8_t * v  = p->v   + (size_t)(y / 2) * hw;
+    uint8_t       * d0 = p->dst + (size_t)y * p->width * 4;
+    uint8_t       * d1 = d0 + p->width * 4;
+
+    const unsigned int done = fn ? fn(y0, y1, u, v, d0, d1, p->width) : 0;
+    rows_ref(y0, y1, u, v, d0, d1, done, p->width);
+  }
+}
+
+void yuv420_to_bgra_ref(const YUV420Planes * p, unsigned int start, unsigned int end)
+{
+  convert(p, start, end, NULL);
+}
+
+void yuv420_to_bgra(const YUV420Planes * p, unsigned int start, unsigned int end)
+{
+  // resolved on first use, racing callers all store the same value
+  static YUV420RowFn rowFn = NULL;
+  YUV420RowFn fn = __atomic_load_n(&rowFn, __ATOMIC_RELAXED);
+  if (!fn)
+  {
+    fn = kernels[yuv420_select()].fn;
+    __atomic_store_n(&rowFn, fn, __ATOMIC_RELAXED);
+  }
+
+  convert(p, start, end, fn);
+}
+
+void yuv420_to_bgra_kernel(const YUV420Planes * p, unsigned int start, unsigned int end,
+    const YUV420Kernel kernel)
+{
+  convert(p, start, end, kernels[kernel].fn);
+}
+
+const char * yuv420_kernel_name()
+{
+  return kernels[yuv420_select()].name;
+}
@@ -0,0 +1,62 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+BT.601 limited range YUV420 to BGRA in 6 bit fixed point. The SIMD kernels
+produce exactly the same output as the scalar reference, which is also used
+for the pixels at the end of a row that don't fill a whole vector.
+*/
+typedef struct YUV420Planes
+{
+  const uint8_t * y; // width  x height
+  const uint8_t * u; // width/2 x height/2
+  const uint8_t * v; // width/2 x height/2
+  uint8_t       * dst; // BGRA, width * 4 bytes per row
+  unsigned int    width, height;
+}
+YUV420Planes;
+
+// convert rows [start, end), start must be even
+void yuv420_to_bgra_ref(const YUV420Planes * p, unsigned int start, unsigned int end);
+void yuv420_to_bgra    (const YUV420Planes * p, unsigned int start, unsigned int end);
+
+// the kernel yuv420_to_bgra uses on this CPU
+const char * yuv420_kernel_name();
+
+// the SIMD kernels, so that each can be checked whichever one the CPU would use
+typedef enum YUV420Kernel
+{
+  YUV420_KERNEL_SSE2,
+  YUV420_KERNEL_AVX2,
+
+  YUV420_KERNEL_MAX
+}
+YUV420Kernel;
+
+bool         yuv420_kernel_supported(const YUV420Kernel kernel);
+const char * yuv420_kernel_str      (const YUV420Kernel kernel);
+
+// as yuv420_to_bgra with the given kernel, which must be supported
+void yuv420_to_bgra_kernel(const YUV420Planes * p, unsigned int start, unsigned int end,
+    const YUV420Kernel kernel);
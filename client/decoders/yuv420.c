@@ -18,6 +18,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
 #include "lg-decoder.h"
+#include "yuv420-convert.h"
 
 #include "debug.h"
 #include "memcpySSE.h"
@@ -28,18 +29,77 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <GL/gl.h>
 
+#define MAX_THREADS 4
+
 struct Pixel
 {
   uint8_t b, g, r, a;
 };
 
+struct Inst;
+
+// converts one band of rows for each frame
+struct Worker
+{
+  struct Inst  * inst;
+  SDL_Thread   * thread;
+  SDL_sem      * start;
+  unsigned int   first, last;
+};
+
 struct Inst
 {
   LG_RendererFormat  format;
   struct Pixel     * pixels;
   unsigned int       yBytes;
+
+  YUV420Planes       planes;
+  bool               running;
+  unsigned int       threads;
+  unsigned int       bandEnd; // the rows the decode thread converts itself
+  struct Worker      workers[MAX_THREADS - 1];
+  SDL_sem          * done;
+
+  // the GPU path uploads the planes and converts them in a shader
+  bool               hasGL;
+  const uint8_t    * frame;
+  GLuint             program;
+  GLuint             planeTex[3];
+};
+
+// one per frame texture, the shader renders into it through the FBO
+struct GLFrame
+{
+  GLuint fbo;
 };
 
+/* BT.601 limited range, the same coefficients as the CPU kernels so both paths
+ * give the same picture */
+static const char * lgd_yuv420_vs =
+  "#version 120\n"
+  "void main()\n"
+  "{\n"
+  "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+  "  gl_Position    = gl_Vertex;\n"
+  "}\n";
+
+static const char * lgd_yuv420_fs =
+  "#version 120\n"
+  "uniform sampler2D texY;\n"
+  "uniform sampler2D texU;\n"
+  "uniform sampler2D texV;\n"
+  "void main()\n"
+  "{\n"
+  "  float y = 1.164 * (texture2D(texY, gl_TexCoord[0].st).r - 0.0625);\n"
+  "  float u = texture2D(texU, gl_TexCoord[0].st).r - 0.5;\n"
+  "  float v = texture2D(texV, gl_TexCoord[0].st).r - 0.5;\n"
+  "  gl_FragColor = vec4(\n"
+  "    y + 1.596 * v,\n"
+  "    y - 0.391 * u - 0.813 * v,\n"
+  "    y + 2.018 * u,\n"
+  "    1.0);\n"
+  "}\n";
+
 static bool            lgd_yuv420_create          (void ** opaque);
 static void            lgd_yuv420_destroy         (void  * opaque);
 static bool            lgd_yuv420_initialize      (void  * opaque, const LG_RendererFormat format, SDL_Window * window);
@@ -50,6 +110,12 @@ static unsigned int    lgd_yuv420_get_frame_stride(void  * opaque);
 static bool            lgd_yuv420_decode          (void  * opaque, const uint8_t * src, size_t srcSize);
 static const uint8_t * lgd_yuv420_get_buffer      (void  * opaque);
 
+static bool            lgd_yuv420_gl_initialize   (void  * opaque, const LG_RendererFormat format, SDL_Window * window);
+static bool            lgd_yuv420_gl_decode       (void  * opaque, const uint8_t * src, size_t srcSize);
+static bool            lgd_yuv420_init_gl_texture (void  * opaque, GLenum target, GLuint texture, void ** ref);
+static void            lgd_yuv420_free_gl_texture (void  * opaque, void * ref);
+static bool            lgd_yuv420_update_gl_texture(void  * opaque, void * ref);
+
 static bool lgd_yuv420_create(void ** opaque)
 {
   // create our local storage
@@ -65,9 +131,26 @@ static bool lgd_yuv420_create(void ** opaque)
 
 static void lgd_yuv420_destroy(void * opaque)
 {
+  // the renderer doesn't deinitialize before it destroys
+  lgd_yuv420_deinitialize(opaque);
   free(opaque);
 }
 
+static int lgd_yuv420_worker(void * opaque)
+{
+  struct Worker * w = (struct Worker *)opaque;
+  for(;;)
+  {
+    SDL_SemWait(w->start);
+    if (!w->inst->running)
+      break;
+
+    yuv420_to_bgra(&w->inst->planes, w->first, w->last);
+    SDL_SemPost(w->inst->done);
+  }
+  return 0;
+}
+
 static bool lgd_yuv420_initialize(void * opaque, const LG_RendererFormat format, SDL_Window * window)
 {
   struct Inst * this = (struct Inst *)opaque;
@@ -75,13 +158,92 @@ static bool lgd_yuv420_initialize(void * opaque, const LG_RendererFormat format,
 
   this->yBytes  = format.width * format.height;
   this->pixels = malloc(sizeof(struct Pixel) * (format.width * format.height));
+  if (!this->pixels)
+  {
+    DEBUG_ERROR("Failed to allocate the frame buffer");
+    return false;
+  }
+
+  this->planes.dst    = (uint8_t *)this->pixels;
+  this->planes.width  = format.width;
+  this->planes.height = format.height;
+
+  /* the frame is split into bands of rows, the decode thread takes the first
+   * and a worker each of the rest, every band starts on an even row so no
+   * chroma row is shared between threads */
+  this->threads = SDL_GetCPUCount();
+  if (this->threads > MAX_THREADS)
+    this->threads = MAX_THREADS;
+  if (this->threads < 1)
+    this->threads = 1;
+
+  const unsigned int band = ((format.height / this->threads) + 1) & ~1;
+  this->bandEnd = this->threads > 1 ? band : format.height;
+  this->running = true;
+  this->done    = SDL_CreateSemaphore(0);
+  if (!this->done)
+  {
+    DEBUG_ERROR("Failed to create the semaphore");
+    this->threads = 1;
+    this->bandEnd = format.height;
+  }
+
+  for(unsigned int i = 1; i < this->threads; ++i)
+  {
+    struct Worker * w = &this->workers[i - 1];
+    w->inst  = this;
+    w->first = band * i;
+    w->last  = i == this->threads - 1 ? format.height : band * (i + 1);
+    w->start = SDL_CreateSemaphore(0);
+    if (!w->start || !(w->thread = SDL_CreateThread(lgd_yuv420_worker, "yuv420Thread", w)))
+    {
+      DEBUG_ERROR("Failed to create the conversion thread");
+      if (w->start)
+        SDL_DestroySemaphore(w->start);
+
+      // the last band that did start takes the remaining rows
+      if (i > 1)
+        this->workers[i - 2].last = format.height;
+      else
+        this->bandEnd = format.height;
+
+      this->threads = i;
+      break;
+    }
+  }
+
+  DEBUG_INFO("YUV420 using %s on %u threads", yuv420_kernel_name(), this->threads);
   return true;
 }
 
 static void lgd_yuv420_deinitialize(void * opaque)
 {
   struct Inst * this = (struct Inst *)opaque;
+
+  this->running = false;
+  for(unsigned int i = 1; i < this->threads; ++i)
+  {
+    struct Worker * w = &this->workers[i - 1];
+    SDL_SemPost(w->start);
+    SDL_WaitThread(w->thread, NULL);
+    SDL_DestroySemaphore(w->start);
+  }
+  this->threads = 0;
+
+  if (this->done)
+    SDL_DestroySemaphore(this->done);
+  this->done = NULL;
+
   free(this->pixels);
+  this->pixels = NULL;
+
+  if (this->hasGL)
+  {
+    glDeleteTextures(3, this->planeTex);
+    glDeleteProgram(this->program);
+    this->program = 0;
+    this->hasGL   = false;
+  }
 }
 
 static LG_OutFormat lgd_yuv420_get_out_format(void * opaque)
@@ -103,29 +265,56 @@ static unsigned int lgd_yuv420_get_frame_stride(void * opaque)
 
 static bool lgd_yuv420_decode(void * opaque, const uint8_t * src, size_t srcSize)
 {
-  //FIXME: implement this properly using GLSL
+  struct Inst * this = (struct Inst *)opaque;
+  const unsigned int hp = this->yBytes / 4;
+
+  if (srcSize < this->yBytes + hp * 2)
+  {
+    DEBUG_ERROR("The frame is too small for %ux%u YUV420", this->format.width, this->format.height);
+    return false;
+  }
+
+  this->planes.y = src;
+  this->planes.u = src + this->yBytes;
+  this->planes.v = src + this->yBytes + hp;
+
+  for(unsigned int i = 1; i < this->threads; ++i)
+    SDL_SemPost(this->workers[i - 1].start);
+
+  yuv420_to_bgra(&this->planes, 0, this->bandEnd);
+
+  for(unsigned int i = 1; i < this->threads; ++i)
+    SDL_SemWait(this->done);
+
+  return true;
+}
 
+static bool lgd_yuv420_gl_initialize(void * opaque, const LG_RendererFormat format, SDL_Window * window)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  memcpy(&this->format, &format, sizeof(LG_RendererFormat));
+
+  this->yBytes        = format.width * format.height;
+  this->planes.width  = format.width;
+  this->planes.height = format.height;
+  return true;
+}
+
+/* the planes are read straight from shared memory when the texture is updated,
+ * the renderer holds the frame until then and update_gl_texture forgets it */
+static bool lgd_yuv420_gl_decode(void * opaque, const uint8_t * src, size_t srcSize)
+{
   struct Inst * this = (struct Inst *)opaque;
-  const unsigned int hw = this->format.width / 2;
   const unsigned int hp = this->yBytes / 4;
 
-  for(size_t y = 0; y < this->format.height; ++y)
-    for(size_t x = 0; x < this->format.width; ++x)
-    {
-      const unsigned int yoff = y * this->format.width + x;
-      const unsigned int uoff = this->yBytes + ((y / 2) * hw + x / 2);
-      const unsigned int voff = uoff + hp;
-
-      float b = 1.164f * ((float)src[yoff] - 16.0f) + 2.018f * ((float)src[uoff] - 128.0f);
-      float g = 1.164f * ((float)src[yoff] - 16.0f) - 0.813f * ((float)src[voff] - 128.0f) - 0.391f * ((float)src[uoff] - 128.0f);
-      float r = 1.164f * ((float)src[yoff] - 16.0f) + 1.596f * ((float)src[voff] - 128.0f);
-
-      #define CLAMP(x) (x < 0 ? 0 : (x > 255 ? 255 : x))
-      this->pixels[yoff].b = CLAMP(b);
-      this->pixels[yoff].g = CLAMP(g);
-      this->pixels[yoff].r = CLAMP(r);
-    }
+  if (srcSize < this->yBytes + hp * 2)
+  {
+    DEBUG_ERROR("The frame is too small for %ux%u YUV420", this->format.width, this->format.height);
+    return false;
+  }
 
+  // a single pointer so the render thread never sees planes from two frames
+  this->frame = src;
   return true;
 }
 
@@ -135,18 +324,203 @@ static const uint8_t * lgd_yuv420_get_buffer(void * opaque)
   return (uint8_t *)this->pixels;
 }
 
-bool lgd_yuv420_init_gl_texture(void * opaque, GLenum target, GLuint texture, void ** ref)
+static GLuint lgd_yuv420_compile(GLenum type, const char * source)
 {
-  return false;
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+
+  GLint status;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status != GL_TRUE)
+  {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    DEBUG_ERROR("Failed to compile the YUV420 shader: %s", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+
+  return shader;
 }
 
-void lgd_yuv420_free_gl_texture(void * opaque, void * ref)
+static bool lgd_yuv420_gl_setup(struct Inst * this)
 {
+  GLuint vs = lgd_yuv420_compile(GL_VERTEX_SHADER  , lgd_yuv420_vs);
+  GLuint fs = lgd_yuv420_compile(GL_FRAGMENT_SHADER, lgd_yuv420_fs);
+  if (!vs || !fs)
+  {
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    return false;
+  }
+
+  this->program = glCreateProgram();
+  glAttachShader(this->program, vs);
+  glAttachShader(this->program, fs);
+  glLinkProgram(this->program);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+
+  GLint status;
+  glGetProgramiv(this->program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE)
+  {
+    char log[1024];
+    glGetProgramInfoLog(this->program, sizeof(log), NULL, log);
+    DEBUG_ERROR("Failed to link the YUV420 program: %s", log);
+    glDeleteProgram(this->program);
+    this->program = 0;
+    return false;
+  }
+
+  glUseProgram(this->program);
+  glUniform1i(glGetUniformLocation(this->program, "texY"), 0);
+  glUniform1i(glGetUniformLocation(this->program, "texU"), 1);
+  glUniform1i(glGetUniformLocation(this->program, "texV"), 2);
+  glUseProgram(0);
+
+  glGenTextures(3, this->planeTex);
+  for(int i = 0; i < 3; ++i)
+  {
+    const unsigned int div = i == 0 ? 1 : 2;
+    glBindTexture(GL_TEXTURE_2D, this->planeTex[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8,
+      this->format.width / div, this->format.height / div, 0,
+      GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S    , GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T    , GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (glGetError() != GL_NO_ERROR)
+  {
+    DEBUG_ERROR("Failed to create the YUV420 plane textures");
+    glDeleteTextures(3, this->planeTex);
+    glDeleteProgram(this->program);
+    this->program = 0;
+    return false;
+  }
+
+  this->hasGL = true;
+  DEBUG_INFO("YUV420 converting on the GPU");
+  return true;
 }
 
-bool lgd_yuv420_update_gl_texture(void * opaque, void * ref)
+static bool lgd_yuv420_init_gl_texture(void * opaque, GLenum target, GLuint texture, void ** ref)
 {
-  return false;
+  struct Inst * this = (struct Inst *)opaque;
+  if (!this->hasGL && !lgd_yuv420_gl_setup(this))
+    return false;
+
+  struct GLFrame * frame = (struct GLFrame *)malloc(sizeof(struct GLFrame));
+  if (!frame)
+  {
+    DEBUG_ERROR("Failed to allocate the frame");
+    return false;
+  }
+
+  glBindTexture(target, texture);
+  glTexParameteri(target, GL_TEXTURE_WRAP_S    , GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T    , GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glBindTexture(target, 0);
+
+  glGenFramebuffers(1, &frame->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, frame->fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, texture, 0);
+  const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    DEBUG_ERROR("The YUV420 framebuffer is incomplete: 0x%x", status);
+    glDeleteFramebuffers(1, &frame->fbo);
+    free(frame);
+    return false;
+  }
+
+  *ref = frame;
+  return true;
+}
+
+static void lgd_yuv420_free_gl_texture(void * opaque, void * ref)
+{
+  struct GLFrame * frame = (struct GLFrame *)ref;
+  glDeleteFramebuffers(1, &frame->fbo);
+  free(frame);
+}
+
+static bool lgd_yuv420_update_gl_texture(void * opaque, void * ref)
+{
+  struct Inst    * this  = (struct Inst *)opaque;
+  struct GLFrame * frame = (struct GLFrame *)ref;
+
+  const uint8_t * src = this->frame;
+  if (!src)
+    return true;
+
+  const unsigned int hp = this->yBytes / 4;
+  const uint8_t * planes[3] = { src, src + this->yBytes, src + this->yBytes + hp };
+
+  // the planes are tightly packed so upload them as is, a third of the BGRA size
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT , 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  for(int i = 0; i < 3; ++i)
+  {
+    const unsigned int div = i == 0 ? 1 : 2;
+    glBindTexture(GL_TEXTURE_2D, this->planeTex[i]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+      this->format.width / div, this->format.height / div,
+      GL_RED, GL_UNSIGNED_BYTE, planes[i]);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // the planes have been copied, the renderer is about to give the frame back
+  this->frame = NULL;
+
+  glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_CURRENT_BIT);
+  glDisable(GL_BLEND);
+  glBindFramebuffer(GL_FRAMEBUFFER, frame->fbo);
+  glViewport(0, 0, this->format.width, this->format.height);
+  glUseProgram(this->program);
+
+  for(int i = 0; i < 3; ++i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, this->planeTex[i]);
+  }
+
+  // the vertex shader ignores the matrices so this covers the whole target
+  glBegin(GL_TRIANGLE_STRIP);
+    glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, -1.0f);
+    glTexCoord2f(1.0f, 0.0f); glVertex2f( 1.0f, -1.0f);
+    glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f,  1.0f);
+    glTexCoord2f(1.0f, 1.0f); glVertex2f( 1.0f,  1.0f);
+  glEnd();
+
+  for(int i = 2; i >= 0; --i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glPopAttrib();
+
+  const GLenum error = glGetError();
+  if (error != GL_NO_ERROR)
+  {
+    DEBUG_ERROR("Failed to convert the YUV420 frame: 0x%x", error);
+    return false;
+  }
+
+  return true;
 }
 
 const LG_Decoder LGD_YUV420 =
@@ -154,6 +528,25 @@ const LG_Decoder LGD_YUV420 =
   .name              = "YUV420",
   .create            = lgd_yuv420_create,
   .destroy           = lgd_yuv420_destroy,
+  .initialize        = lgd_yuv420_gl_initialize,
+  .deinitialize      = lgd_yuv420_deinitialize,
+  .get_out_format    = lgd_yuv420_get_out_format,
+  .get_frame_pitch   = lgd_yuv420_get_frame_pitch,
+  .get_frame_stride  = lgd_yuv420_get_frame_stride,
+  .decode            = lgd_yuv420_gl_decode,
+  .get_buffer        = lgd_yuv420_get_buffer,
+
+  .has_gl            = true,
+  .init_gl_texture   = lgd_yuv420_init_gl_texture,
+  .free_gl_texture   = lgd_yuv420_free_gl_texture,
+  .update_gl_texture = lgd_yuv420_update_gl_texture
+};
+
+const LG_Decoder LGD_YUV420_CPU =
+{
+  .name              = "YUV420 (CPU)",
+  .create            = lgd_yuv420_create,
+  .destroy           = lgd_yuv420_destroy,
   .initialize        = lgd_yuv420_initialize,
   .deinitialize      = lgd_yuv420_deinitialize,
   .get_out_format    = lgd_yuv420_get_out_format,
@@ -162,7 +555,7 @@ const LG_Decoder LGD_YUV420 =
   .decode            = lgd_yuv420_decode,
   .get_buffer        = lgd_yuv420_get_buffer,
 
-  .has_gl            = false, //FIXME: Implement this
+  .has_gl            = false,
   .init_gl_texture   = lgd_yuv420_init_gl_texture,
   .free_gl_texture   = lgd_yuv420_free_gl_texture,
   .update_gl_texture = lgd_yuv420_update_gl_texture
@@ -0,0 +1,180 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "latency.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <string.h>
+#include <time.h>
+
+#define SUB_BITS     6
+#define SUB_COUNT    (1 << SUB_BITS)
+#define MAX_BITS     40 // ~18 minutes in nanoseconds
+#define BUCKET_COUNT (((MAX_BITS - SUB_BITS) << SUB_BITS) + SUB_COUNT)
+
+struct LatencyHist
+{
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[BUCKET_COUNT];
+};
+
+struct Latency
+{
+  LG_Lock lock;
+
+  // the newest frame given to the renderer that hasn't been shown yet
+  bool     pending;
+  uint64_t readyTime;
+  uint64_t captureTime;
+
+  struct LatencyHist hist[LATENCY_STAGE_COUNT];
+};
+
+static struct Latency latency;
+
+static const char * latency_names[LATENCY_STAGE_COUNT] =
+{
+  "Capture",
+  "Pickup",
+  "Upload",
+  "Swap",
+  "Total"
+};
+
+/* values below 2 * SUB_COUNT have a bucket each, above that each power of two
+ * is split into SUB_COUNT buckets so the relative error stays constant */
+static unsigned int latency_bucket(uint64_t ns)
+{
+  if (ns >= (1ULL << MAX_BITS))
+    ns = (1ULL << MAX_BITS) - 1;
+
+  if (ns < 2 * SUB_COUNT)
+    return ns;
+
+  const unsigned int shift = (63 - __builtin_clzll(ns)) - SUB_BITS;
+  return (shift << SUB_BITS) + (ns >> shift);
+}
+
+// the highest value that lands in the bucket
+static uint64_t latency_bucket_value(const unsigned int bucket)
+{
+  if (bucket < 2 * SUB_COUNT)
+    return bucket;
+
+  const unsigned int shift = (bucket >> SUB_BITS) - 1;
+  const uint64_t     sub   = (bucket & (SUB_COUNT - 1)) + SUB_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+static uint64_t latency_percentile(const struct LatencyHist * h, const double p)
+{
+  const uint64_t target = (uint64_t)(p * (double)h->count + 0.5);
+  uint64_t total = 0;
+  for(unsigned int i = 0; i < BUCKET_COUNT; ++i)
+  {
+    total += h->buckets[i];
+    if (total >= target && total > 0)
+    {
+      const uint64_t value = latency_bucket_value(i);
+      return value < h->max ? value : h->max;
+    }
+  }
+  return h->max;
+}
+
+void latency_init()
+{
+  memset(&latency, 0, sizeof(struct Latency));
+  LG_LOCK_INIT(latency.lock);
+}
+
+void latency_free()
+{
+  LG_LOCK_FREE(latency.lock);
+}
+
+uint64_t latency_now()
+{
+  // the host uses CLOCK_MONOTONIC when it shares our clock, as does nanotime
+  return nanotime();
+}
+
+void latency_record(const LatencyStage stage, const uint64_t ns)
+{
+  struct LatencyHist * h = &latency.hist[stage];
+  ++h->buckets[latency_bucket(ns)];
+  ++h->count;
+  if (ns > h->max)
+    h->max = ns;
+}
+
+void latency_frame_uploaded(const uint64_t claimTime, const uint64_t captureTime)
+{
+  const uint64_t now = latency_now();
+  latency_record(LATENCY_UPLOAD, now - claimTime);
+
+  LG_LOCK(latency.lock);
+  latency.pending     = true;
+  latency.readyTime   = now;
+  latency.captureTime = captureTime;
+  LG_UNLOCK(latency.lock);
+}
+
+void latency_frame_swapped()
+{
+  LG_LOCK(latency.lock);
+
+  // uploads happen during the render so anything pending was drawn by this swap
+  if (!latency.pending)
+  {
+    LG_UNLOCK(latency.lock);
+    return;
+  }
+
+  const uint64_t readyTime   = latency.readyTime;
+  const uint64_t captureTime = latency.captureTime;
+  latency.pending = false;
+  LG_UNLOCK(latency.lock);
+
+  const uint64_t now = latency_now();
+  latency_record(LATENCY_SWAP, now - readyTime);
+  if (captureTime && captureTime <= now)
+    latency_record(LATENCY_TOTAL, now - captureTime);
+}
+
+void latency_report()
+{
+  for(int i = 0; i < LATENCY_STAGE_COUNT; ++i)
+  {
+    const struct LatencyHist * h = &latency.hist[i];
+    if (!h->count)
+      continue;
+
+    DEBUG_INFO("%-7s latency: p50 %8.1fus, p99 %8.1fus, p999 %8.1fus, max %8.1fus over %lu frames",
+      latency_names[i],
+      (float)latency_percentile(h, 0.5  ) / 1000.0f,
+      (float)latency_percentile(h, 0.99 ) / 1000.0f,
+      (float)latency_percentile(h, 0.999) / 1000.0f,
+      (float)h->max / 1000.0f,
+      (unsigned long)h->count
+    );
+  }
+}
@@ -0,0 +1,57 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Per frame latency histograms for each stage of the frame's trip from the host
+to the screen. The histograms are log-linear with 64 sub-buckets per power of
+two, so percentiles are reported to within ~1.5% of the real value.
+*/
+typedef enum LatencyStage
+{
+  LATENCY_CAPTURE, // host capture to host publish
+  LATENCY_PICKUP , // host publish to frameThread claiming the frame
+  LATENCY_UPLOAD , // frameThread claiming the frame to the renderer having uploaded it
+  LATENCY_SWAP   , // the renderer having uploaded the frame to the swap that shows it
+  LATENCY_TOTAL  , // host capture to the swap that shows it
+  LATENCY_STAGE_COUNT
+}
+LatencyStage;
+
+void latency_init();
+void latency_free();
+
+// the time in nanoseconds on the clock the host times are compared to
+uint64_t latency_now();
+
+void latency_record(const LatencyStage stage, const uint64_t ns);
+
+/* called by the renderer once it has uploaded a frame the frameThread claimed
+ * at claimTime, captureTime is zero unless the host time is on our clock */
+void latency_frame_uploaded(const uint64_t claimTime, const uint64_t captureTime);
+
+// called by the renderThread after a swap
+void latency_frame_swapped();
+
+// log p50/p99/p999 of each stage
+void latency_report();
@@ -22,11 +22,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 extern const LG_Decoder LGD_NULL;
 extern const LG_Decoder LGD_YUV420;
+extern const LG_Decoder LGD_YUV420_CPU;
 
 const LG_Decoder * LG_Decoders[] =
 {
   &LGD_NULL,
   &LGD_YUV420,
+  &LGD_YUV420_CPU,
   NULL // end of array sentinal
 };
 
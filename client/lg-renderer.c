@@ -18,6 +18,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
 #include "lg-renderer.h"
+#include "latency.h"
 
 #include <GL/glx.h>
 #include <string.h>
@@ -50,6 +51,77 @@ bool LG_RendererValueToBool(const char * value)
     (strcasecmp(value, "enable" ) == 0);
 }
 
+void LG_RendererDamageReset(LG_RendererDamage * damage, const bool full)
+{
+  damage->full  = full;
+  damage->count = 0;
+}
+
+void LG_RendererDamageMerge(LG_RendererDamage * damage, const LG_RendererDamage * src)
+{
+  if (damage->full)
+    return;
+
+  // too many regions to track, just update everything
+  if (src->full || damage->count + src->count > KVMFR_MAX_DAMAGE)
+  {
+    LG_RendererDamageReset(damage, true);
+    return;
+  }
+
+  memcpy(&damage->rects[damage->count], src->rects, src->count * sizeof(KVMFRRect));
+  damage->count += src->count;
+}
+
+void LG_RendererFrameRelease(LG_RendererFrame * frame)
+{
+  if (!frame->release)
+    return;
+
+  frame->release(frame->slot);
+  frame->release = NULL;
+}
+
+void LG_RendererFrameUploaded(const LG_RendererFrame * frame)
+{
+  latency_frame_uploaded(frame->claimTime, frame->captureTime);
+}
+
+void LG_RendererFramePublish(TripleBuffer * tb, LG_RendererDamage * pending,
+    const LG_RendererFormat * format, const LG_RendererFrame * frame)
+{
+  LG_RendererFrameUpdate * update = triplebuffer_write_ptr(tb);
+  memcpy(&update->format, format, sizeof(LG_RendererFormat));
+  update->frame = *frame;
+
+  /* the render thread only sees the newest frame so each carries the damage of
+   * all the frames since the last one it is known to have taken */
+  if (pending)
+  {
+    LG_RendererDamageMerge(pending, &format->damage);
+    memcpy(&update->format.damage, pending, sizeof(LG_RendererDamage));
+  }
+
+  if (triplebuffer_publish(tb))
+  {
+    // the frame this one replaced was never taken, the host can have it back
+    update = triplebuffer_write_ptr(tb);
+    LG_RendererFrameRelease(&update->frame);
+  }
+  else if (pending)
+    memcpy(pending, &format->damage, sizeof(LG_RendererDamage));
+}
+
+void LG_RendererFrameDrain(TripleBuffer * tb)
+{
+  // the frame that was never taken and the last one that was
+  LG_RendererFrameUpdate * update = triplebuffer_current(tb);
+  if (update)
+    LG_RendererFrameRelease(&update->frame);
+  if ((update = triplebuffer_take(tb)))
+    LG_RendererFrameRelease(&update->frame);
+}
+
 int LG_RendererQueryMultisamplingSupport(void)
 {
   Display * dpy = XOpenDisplay(NULL);
@@ -25,6 +25,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <SDL2/SDL_ttf.h>
 
 #include "KVMFR.h"
+#include "triplebuffer.h"
 
 #define IS_LG_RENDERER_VALID(x) \
   ((x)->get_name       && \
@@ -37,6 +38,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
    (x)->on_alert       && \
    (x)->render_startup && \
    (x)->render         && \
+   (x)->animating      && \
    (x)->update_fps)
 
 #define LGR_OPTION_COUNT(x) (sizeof(x) / sizeof(LG_RendererOpt))
@@ -69,6 +71,14 @@ typedef struct LG_RendererParams
 }
 LG_RendererParams;
 
+typedef struct LG_RendererDamage
+{
+  bool         full;    // the entire frame changed, rects are not used
+  unsigned int count;   // number of valid rects
+  KVMFRRect    rects[KVMFR_MAX_DAMAGE];
+}
+LG_RendererDamage;
+
 typedef struct LG_RendererFormat
 {
   FrameType    type;    // frame type
@@ -77,9 +87,37 @@ typedef struct LG_RendererFormat
   unsigned int stride;  // scanline width (zero if compresed)
   unsigned int pitch;   // scanline bytes (or compressed size)
   unsigned int bpp;     // bits per pixel (zero if compressed)
+
+  LG_RendererDamage damage; // regions changed since the previous frame
 }
 LG_RendererFormat;
 
+/*
+The frame is held in shared memory for the renderer until it calls
+LG_RendererFrameRelease, which it must do once for every frame it is given as
+soon as it will no longer read data, including frames it replaces unread.
+*/
+typedef struct LG_RendererFrame
+{
+  const uint8_t * data; // the frame in shared memory
+  size_t          size; // bytes of data, the pitch is only the row size of packed formats
+
+  void         (* release)(const int slot);
+  int             slot;
+
+  uint64_t claimTime;   // when the frameThread claimed it, on latency_now's clock
+  uint64_t captureTime; // the host capture time, zero unless it is on our clock
+}
+LG_RendererFrame;
+
+// what the frameThread hands the render thread through a TripleBuffer
+typedef struct LG_RendererFrameUpdate
+{
+  LG_RendererFormat format;
+  LG_RendererFrame  frame;
+}
+LG_RendererFrameUpdate;
+
 typedef struct LG_RendererRect
 {
   bool         valid;
@@ -114,9 +152,10 @@ typedef void         (* LG_RendererDeInitialize)(void * opaque);
 typedef void         (* LG_RendererOnResize    )(void * opaque, const int width, const int height, const LG_RendererRect destRect);
 typedef bool         (* LG_RendererOnMouseShape)(void * opaque, const LG_RendererCursor cursor, const int width, const int height, const int pitch, const uint8_t * data);
 typedef bool         (* LG_RendererOnMouseEvent)(void * opaque, const bool visible , const int x, const int y);
-typedef bool         (* LG_RendererOnFrameEvent)(void * opaque, const LG_RendererFormat format, const uint8_t * data);
+typedef bool         (* LG_RendererOnFrameEvent)(void * opaque, const LG_RendererFormat format, const LG_RendererFrame frame);
 typedef void         (* LG_RendererOnAlert     )(void * opaque, const LG_RendererAlert alert, const char * message, bool ** closeFlag);
 typedef bool         (* LG_RendererRender      )(void * opaque, SDL_Window *window);
+typedef bool         (* LG_RendererAnimating   )(void * opaque);
 typedef void         (* LG_RendererUpdateFPS   )(void * opaque, const float avgUPS, const float avgFPS);
 
 typedef struct LG_Renderer
@@ -134,6 +173,7 @@ typedef struct LG_Renderer
   LG_RendererOnAlert      on_alert;
   LG_RendererRender       render_startup;
   LG_RendererRender       render;
+  LG_RendererAnimating    animating;  // true while something on screen changes without an event
   LG_RendererUpdateFPS    update_fps;
 }
 LG_Renderer;
@@ -142,5 +182,24 @@ LG_Renderer;
 bool LG_RendererValidatorBool(const char * value);
 bool LG_RendererValueToBool  (const char * value);
 
+// damage helpers, accumulates the damage of frames that have not been uploaded yet
+void LG_RendererDamageReset(LG_RendererDamage * damage, const bool full);
+void LG_RendererDamageMerge(LG_RendererDamage * damage, const LG_RendererDamage * src);
+
+// give the frame back to the host, does nothing if it was already released
+void LG_RendererFrameRelease(LG_RendererFrame * frame);
+
+// called by the renderer once the frame's upload has finished, for the latency stats
+void LG_RendererFrameUploaded(const LG_RendererFrame * frame);
+
+/* publish a frame to a TripleBuffer of LG_RendererFrameUpdate, releasing the one
+ * it replaces if that was never taken. pending accumulates the damage the render
+ * thread may not have seen yet, it may be NULL if the renderer ignores damage */
+void LG_RendererFramePublish(TripleBuffer * tb, LG_RendererDamage * pending,
+    const LG_RendererFormat * format, const LG_RendererFrame * frame);
+
+// release the frames still in a TripleBuffer of LG_RendererFrameUpdate before it is freed
+void LG_RendererFrameDrain(TripleBuffer * tb);
+
 // Enumerates over all glX visuals to find if multisampling is supported
 int LG_RendererQueryMultisamplingSupport(void);
\ No newline at end of file
@@ -22,11 +22,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 extern const LG_Renderer LGR_EGL;
 extern const LG_Renderer LGR_OpenGL;
+extern const LG_Renderer LGR_Bench;
 
 const LG_Renderer * LG_Renderers[] =
 {
   &LGR_EGL,
   &LGR_OpenGL,
+  &LGR_Bench,
   NULL // end of array sentinal
 };
 
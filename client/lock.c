@@ -0,0 +1,166 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "lock.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// about a microsecond on current CPUs, longer than most of our locks are held
+#define SPIN_COUNT 100
+
+// power of two buckets of nanoseconds, the last one takes everything above
+#define HOLD_BUCKETS 32
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define LOCK_PAUSE() __builtin_ia32_pause()
+#else
+  #define LOCK_PAUSE() __asm__ __volatile__("" ::: "memory")
+#endif
+
+struct LG_LockStats
+{
+  const char * name;
+
+  // only ever changed by the holder of the lock
+  uint64_t acquired;
+  uint64_t contended;
+  uint64_t slept;
+  uint64_t acquiredAt;
+  uint64_t holdTotal;
+  uint64_t holdMax;
+  uint64_t hold[HOLD_BUCKETS];
+};
+
+bool lg_lock_stats = false;
+
+void lg_lock_init(LG_Lock * lock, const char * name)
+{
+  lock->state = 0;
+  lock->stats = NULL;
+
+  if (!lg_lock_stats)
+    return;
+
+  lock->stats = calloc(1, sizeof(LG_LockStats));
+  if (!lock->stats)
+    DEBUG_WARN("Failed to allocate the statistics for %s", name);
+  else
+    lock->stats->name = name;
+}
+
+// the upper bound of the hold time below the given fraction of acquisitions
+static uint64_t lg_lock_percentile(const LG_LockStats * s, const double fraction)
+{
+  const uint64_t target = s->acquired * fraction;
+  uint64_t count = 0;
+  for(int i = 0; i < HOLD_BUCKETS; ++i)
+  {
+    count += s->hold[i];
+    if (count > target)
+      return 2ULL << i;
+  }
+  return s->holdMax;
+}
+
+void lg_lock_free(LG_Lock * lock)
+{
+  LG_LockStats * s = lock->stats;
+  if (!s)
+    return;
+
+  lock->stats = NULL;
+  if (s->acquired)
+    DEBUG_INFO("Lock %-20s: %lu taken, %lu contended (%.2f%%), %lu slept, "
+      "held avg %lu ns, p99 < %lu ns, max %lu ns",
+      s->name,
+      (unsigned long)s->acquired,
+      (unsigned long)s->contended,
+      100.0 * s->contended / s->acquired,
+      (unsigned long)s->slept,
+      (unsigned long)(s->holdTotal / s->acquired),
+      (unsigned long)lg_lock_percentile(s, 0.99),
+      (unsigned long)s->holdMax);
+
+  free(s);
+}
+
+void lg_lock_contended(LG_Lock * lock)
+{
+  bool slept = false;
+
+  // the holder is most likely about to release it, so spin a little first
+  for(int i = 0; i < SPIN_COUNT; ++i)
+  {
+    LOCK_PAUSE();
+    int expected = 0;
+    if (lock->state == 0 && __atomic_compare_exchange_n(&lock->state, &expected, 1, false,
+          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      goto acquired;
+  }
+
+  // flag that there are sleepers so the unlock wakes us, then sleep until it does
+  while(__atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE) != 0)
+  {
+    slept = true;
+    syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+  }
+
+acquired:
+  if (!lock->stats)
+    return;
+
+  ++lock->stats->contended;
+  if (slept)
+    ++lock->stats->slept;
+  lg_lock_acquired(lock);
+}
+
+void lg_lock_acquired(LG_Lock * lock)
+{
+  ++lock->stats->acquired;
+  lock->stats->acquiredAt = nanotime();
+}
+
+void lg_lock_releasing(LG_Lock * lock)
+{
+  LG_LockStats * s = lock->stats;
+  const uint64_t held = nanotime() - s->acquiredAt;
+
+  int bucket = held ? 63 - __builtin_clzll(held) : 0;
+  if (bucket >= HOLD_BUCKETS)
+    bucket = HOLD_BUCKETS - 1;
+
+  ++s->hold[bucket];
+  s->holdTotal += held;
+  if (held > s->holdMax)
+    s->holdMax = held;
+}
+
+void lg_lock_wake(LG_Lock * lock)
+{
+  __atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
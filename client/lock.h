@@ -0,0 +1,76 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+The lock used by LG_LOCK when built with ATOMIC_LOCKING. An uncontended lock
+and unlock are a single atomic each. A contended lock spins for a short while,
+as the holders of our locks rarely keep them for long, and then sleeps on a
+futex so a waiter never burns a core or makes a syscall per retry.
+
+The state is 0 when unlocked, 1 when locked and 2 when locked with sleepers
+that the unlock has to wake.
+
+When statistics are enabled every lock initialised afterwards counts how often
+it was taken, contended and slept on, and keeps a histogram of the time it was
+held, reported when the lock is freed.
+*/
+
+typedef struct LG_LockStats LG_LockStats;
+
+typedef struct LG_Lock
+{
+  volatile int   state;
+  LG_LockStats * stats;
+}
+LG_Lock;
+
+extern bool lg_lock_stats;
+
+void lg_lock_init(LG_Lock * lock, const char * name);
+void lg_lock_free(LG_Lock * lock);
+
+// the out of line paths, only used under contention or with statistics
+void lg_lock_contended(LG_Lock * lock);
+void lg_lock_acquired (LG_Lock * lock);
+void lg_lock_releasing(LG_Lock * lock);
+void lg_lock_wake     (LG_Lock * lock);
+
+static inline void lg_lock(LG_Lock * lock)
+{
+  int expected = 0;
+  if (!__atomic_compare_exchange_n(&lock->state, &expected, 1, false,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    lg_lock_contended(lock);
+  else if (lock->stats)
+    lg_lock_acquired(lock);
+}
+
+static inline void lg_unlock(LG_Lock * lock)
+{
+  if (lock->stats)
+    lg_lock_releasing(lock);
+
+  if (__atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE) != 1)
+    lg_lock_wake(lock);
+}
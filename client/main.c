@@ -26,6 +26,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <pwd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -38,11 +42,32 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "debug.h"
 #include "utils.h"
 #include "KVMFR.h"
+#include "notify.h"
+#include "latency.h"
+#include "pacing.h"
+#include "record.h"
+#include "topology.h"
+#include "MultiMemcpy.h"
 #include "spice/spice.h"
 #include "kb.h"
 
 #include "lg-renderers.h"
 
+typedef struct ShmRegion
+{
+  uint64_t offset;
+  uint64_t size;
+}
+ShmRegion;
+
+typedef enum DirStatus
+{
+  DIR_STATUS_OK,
+  DIR_STATUS_BUSY,
+  DIR_STATUS_INVALID
+}
+DirStatus;
+
 struct AppState
 {
   bool                 running;
@@ -62,17 +87,32 @@ struct AppState
   const LG_Renderer  * lgr ;
   void               * lgrData;
   bool                 lgrResize;
+  SDL_sem            * renderSem;   // posted when the scene becomes dirty
+  volatile bool        renderDirty; // something changed since the last render
 
   SDL_Window         * window;
   int                  shmFD;
   struct KVMFRHeader * shm;
   unsigned int         shmSize;
+  size_t               shmMapSize; // shmSize rounded up to the page size
+  uint32_t             dirSerial;
+  ShmRegion            cursorRegion;
+  ShmRegion            frameRegion[KVMFR_MAX_FRAMES];
+
+  KVMFRStream          * stream;
+  volatile KVMFRReader * reader;
+  uint32_t               readerID;
+
+  // how many of the frameThread and renderer are reading each slot
+  LG_Lock                frameLock;
+  unsigned int           frameRefs[KVMFR_MAX_FRAMES];
 
   uint64_t          frameTime;
   uint64_t          lastFrameTime;
   uint64_t          renderTime;
   uint64_t          frameCount;
   uint64_t          renderCount;
+  bool              latencyReport;
 };
 
 typedef struct RenderOpts
@@ -96,7 +136,16 @@ struct AppParams
   unsigned int w, h;
   char       * shmFile;
   unsigned int shmSize;
+  bool         shmHugePages;
+  bool         shmPrefault;
+  bool         shmLock;
+  int          shmNode;
+  char       * doorbell;
+  unsigned int stream;
   unsigned int fpsLimit;
+  unsigned int keepAlive;
+  bool         presentOnArrival;
+  bool         vsyncAlign;
   bool         showFPS;
   bool         useSpice;
   char       * spiceHost;
@@ -111,6 +160,10 @@ struct AppParams
 
   bool         forceRenderer;
   unsigned int forceRendererIndex;
+  bool         bench;     // headless, frames go to the bench renderer
+  unsigned int benchTime; // seconds to run the bench for, 0 for until interrupted
+  char       * recordFile;
+  bool         lockStats;
   RendererOpts rendererOpts[LG_RENDERER_COUNT];
 };
 
@@ -130,7 +183,16 @@ struct AppParams params =
   .h                = 768,
   .shmFile          = "/dev/shm/looking-glass",
   .shmSize          = 0,
+  .shmHugePages     = false,
+  .shmPrefault      = false,
+  .shmLock          = false,
+  .shmNode          = -1,
+  .doorbell         = NULL,
+  .stream           = 0,
   .fpsLimit         = 200,
+  .keepAlive        = 1000,
+  .presentOnArrival = false,
+  .vsyncAlign       = false,
   .showFPS          = false,
   .useSpice         = true,
   .spiceHost        = "127.0.0.1",
@@ -142,9 +204,20 @@ struct AppParams params =
   .grabKeyboard     = true,
   .captureKey       = SDL_SCANCODE_SCROLLLOCK,
   .disableAlerts    = false,
-  .forceRenderer    = false
+  .forceRenderer    = false,
+  .bench            = false,
+  .benchTime        = 0,
+  .recordFile       = NULL,
+  .lockStats        = false
 };
 
+// flag that the scene has changed so the renderThread draws it
+static void invalidateRender()
+{
+  if (!__atomic_exchange_n(&state.renderDirty, true, __ATOMIC_ACQ_REL) && state.renderSem)
+    SDL_SemPost(state.renderSem);
+}
+
 static void updatePositionInfo()
 {
   if (state.haveSrcSize)
@@ -182,18 +255,63 @@ static void updatePositionInfo()
   }
 
   state.lgrResize = true;
+  invalidateRender();
 }
 
 int renderThread(void * unused)
 {
+  topology_apply(TOPOLOGY_RENDER);
   if (!state.lgr->render_startup(state.lgrData, state.window))
     return 1;
 
   struct timespec time;
   clock_gettime(CLOCK_MONOTONIC, &time);
 
+  // nothing has been drawn yet
+  state.renderDirty = true;
+
+  const uint32_t frameTimeMS = state.frameTime >= 2000000 ? state.frameTime / 1000000 : 1;
+
   while(state.running)
   {
+    if (params.presentOnArrival)
+    {
+      /* block until something changes and draw it straight away, animations
+       * and the keep-alive just bound how long the wait can be */
+      if (!__atomic_load_n(&state.renderDirty, __ATOMIC_ACQUIRE))
+      {
+        uint32_t timeout = params.keepAlive;
+        if (!timeout || state.lgr->animating(state.lgrData))
+          timeout = frameTimeMS;
+
+        SDL_SemWaitTimeout(state.renderSem, timeout);
+        if (!state.running)
+          break;
+      }
+
+      if (params.vsyncAlign)
+        pacing_wait();
+    }
+    /* when nothing has changed and the renderer isn't animating, sleep until
+     * something does or the keep-alive is due instead of drawing the same
+     * scene again */
+    else if (params.keepAlive && !state.lgr->animating(state.lgrData))
+    {
+      if (!__atomic_load_n(&state.renderDirty, __ATOMIC_ACQUIRE))
+      {
+        SDL_SemWaitTimeout(state.renderSem, params.keepAlive);
+        if (!state.running)
+          break;
+
+        // don't try to catch up on the time spent asleep
+        clock_gettime(CLOCK_MONOTONIC, &time);
+      }
+    }
+
+    // anything that changes from here on is drawn by the next render
+    __atomic_store_n(&state.renderDirty, false, __ATOMIC_RELEASE);
+    while(SDL_SemTryWait(state.renderSem) == 0) {}
+
     if (state.lgrResize)
     {
       if (state.lgr)
@@ -204,6 +322,16 @@ int renderThread(void * unused)
     if (!state.lgr->render(state.lgrData, state.window))
       break;
 
+    if (params.presentOnArrival && params.vsyncAlign)
+      pacing_presented();
+
+    latency_frame_swapped();
+    if (state.latencyReport)
+    {
+      state.latencyReport = false;
+      latency_report();
+    }
+
     if (params.showFPS)
     {
       const uint64_t t    = nanotime();
@@ -216,6 +344,7 @@ int renderThread(void * unused)
         const float avgUPS = 1000.0f / (((float)state.renderTime / state.frameCount ) / 1e6f);
         const float avgFPS = 1000.0f / (((float)state.renderTime / state.renderCount) / 1e6f);
         state.lgr->update_fps(state.lgrData, avgUPS, avgFPS);
+        invalidateRender();
 
         state.renderTime  = 0;
         state.frameCount  = 0;
@@ -223,6 +352,9 @@ int renderThread(void * unused)
       }
     }
 
+    if (params.presentOnArrival)
+      continue;
+
     uint64_t nsec = time.tv_nsec + state.frameTime;
     if (nsec > 1e9)
     {
@@ -238,43 +370,225 @@ int renderThread(void * unused)
   return 0;
 }
 
+// true if [pos, pos + size) is inside the region
+static inline bool regionContains(const ShmRegion * r, const uint64_t pos, const uint64_t size)
+{
+  return
+    r->size > 0       &&
+    pos  >= r->offset &&
+    size <= r->size   &&
+    pos - r->offset <= r->size - size;
+}
+
+static void prefaultRegion(const ShmRegion * r)
+{
+  const long      page = sysconf(_SC_PAGESIZE);
+  const uint8_t * base = (const uint8_t *)state.shm + r->offset;
+
+  madvise((void *)((uintptr_t)base & ~(uintptr_t)(page - 1)), r->size, MADV_WILLNEED);
+  for(uint64_t i = 0; i < r->size; i += page)
+    (void)*(volatile const uint8_t *)(base + i);
+}
+
+// take and validate a copy of the shared memory layout the host published
+static DirStatus loadDirectory(const bool prefault)
+{
+  volatile KVMFRDirectory * live = &state.shm->directory;
+  KVMFRDirectory dir;
+
+  const uint32_t serial = live->serial;
+  __sync_synchronize();
+  memcpy(&dir, (const void *)live, sizeof(KVMFRDirectory));
+  __sync_synchronize();
+
+  if ((serial & 1) || live->serial != serial || dir.count == 0)
+    return DIR_STATUS_BUSY;
+
+  if (dir.version != KVMFR_DIRECTORY_VERSION)
+  {
+    DEBUG_ERROR("Unsupported shared memory directory version %u", dir.version);
+    return DIR_STATUS_INVALID;
+  }
+
+  if (dir.count > KVMFR_MAX_REGIONS || dir.shmSize > state.shmSize)
+  {
+    DEBUG_ERROR("The host laid out %lu bytes of shared memory but only %u are mapped",
+      (unsigned long)dir.shmSize, state.shmSize);
+    return DIR_STATUS_INVALID;
+  }
+
+  ShmRegion cursor = { 0 };
+  ShmRegion frames[KVMFR_MAX_FRAMES];
+  memset(frames, 0, sizeof(frames));
+
+  for(unsigned int i = 0; i < dir.count; ++i)
+  {
+    const KVMFRRegion * r = &dir.regions[i];
+    if (r->align == 0 || (r->align & (r->align - 1)) || r->offset % r->align ||
+        r->offset < sizeof(KVMFRHeader) || r->offset >= state.shmSize ||
+        r->size == 0 || r->size > state.shmSize - r->offset)
+    {
+      DEBUG_ERROR("Shared memory region %u is invalid", i);
+      return DIR_STATUS_INVALID;
+    }
+
+    for(unsigned int j = 0; j < i; ++j)
+    {
+      const KVMFRRegion * o = &dir.regions[j];
+      if (r->offset < o->offset + o->size && o->offset < r->offset + r->size)
+      {
+        DEBUG_ERROR("Shared memory regions %u and %u overlap", j, i);
+        return DIR_STATUS_INVALID;
+      }
+    }
+
+    // only the regions of the stream we are showing are kept
+    const ShmRegion region = { r->offset, r->size };
+    switch(r->type)
+    {
+      case KVMFR_REGION_CURSOR:
+        if (r->index >= KVMFR_MAX_STREAMS || (r->index == params.stream && cursor.size))
+        {
+          DEBUG_ERROR("Invalid cursor region index %u", r->index);
+          return DIR_STATUS_INVALID;
+        }
+
+        if (r->index == params.stream)
+          cursor = region;
+        break;
+
+      case KVMFR_REGION_FRAME:
+      {
+        const unsigned int slot = r->index % KVMFR_MAX_FRAMES;
+        const bool         ours = r->index / KVMFR_MAX_FRAMES == params.stream;
+        if (r->index >= KVMFR_MAX_STREAMS * KVMFR_MAX_FRAMES || (ours && frames[slot].size))
+        {
+          DEBUG_ERROR("Invalid frame region index %u", r->index);
+          return DIR_STATUS_INVALID;
+        }
+
+        if (ours)
+          frames[slot] = region;
+        break;
+      }
+
+      default:
+        // regions we don't know about are for newer clients
+        break;
+    }
+  }
+
+  if (!cursor.size)
+  {
+    DEBUG_ERROR("The host didn't provide a cursor region");
+    return DIR_STATUS_INVALID;
+  }
+
+  if (prefault)
+  {
+    prefaultRegion(&cursor);
+    for(int i = 0; i < KVMFR_MAX_FRAMES; ++i)
+      if (frames[i].size)
+        prefaultRegion(&frames[i]);
+  }
+
+  state.cursorRegion = cursor;
+  memcpy(state.frameRegion, frames, sizeof(frames));
+  state.dirSerial = serial;
+  return DIR_STATUS_OK;
+}
+
+// take a free reader slot so the host doesn't reuse frames we are reading
+static bool registerReader()
+{
+  uint32_t id = (uint32_t)getpid() ^ (uint32_t)nanotime();
+  if (!id)
+    id = 1;
+
+  for(int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &state.shm->readers[i];
+    if (!__sync_bool_compare_and_swap(&reader->id, 0, id))
+      continue;
+
+    // frames the renderer is still reading from a previous registration stay held
+    uint32_t holding = 0;
+    LG_LOCK(state.frameLock);
+    for(int slot = 0; slot < KVMFR_MAX_FRAMES; ++slot)
+      if (state.frameRefs[slot])
+        holding |= 1U << KVMFR_SLOT_INDEX(params.stream, slot);
+
+    reader->holding   = holding;
+    reader->consumed  = 0;
+    memset((void *)reader->cursorAck, 0, sizeof(reader->cursorAck));
+    reader->streams   = 1U << params.stream;
+    state.readerID    = id;
+    state.reader      = reader;
+    LG_UNLOCK(state.frameLock);
+
+    DEBUG_INFO("Registered as reader %d", i);
+    return true;
+  }
+
+  DEBUG_ERROR("All %d reader slots are in use", KVMFR_MAX_READERS);
+  return false;
+}
+
+static void unregisterReader()
+{
+  if (!state.reader)
+    return;
+
+  state.reader->holding = 0;
+  state.reader->streams = 0;
+  __sync_bool_compare_and_swap(&state.reader->id, state.readerID, 0);
+  state.reader = NULL;
+}
+
 int cursorThread(void * unused)
 {
   KVMFRCursor         header;
   LG_RendererCursor   cursorType     = LG_CURSOR_COLOR;
   uint32_t            version        = 0;
+  uint32_t            posSeq         = 0;
+  uint32_t            serial         = 0;
 
   memset(&header, 0, sizeof(KVMFRCursor));
+  topology_apply(TOPOLOGY_CURSOR);
 
   while(state.running)
   {
-    // poll until we have cursor data
-    if(!(state.shm->cursor.flags & KVMFR_CURSOR_FLAG_UPDATE) &&
-        !(state.shm->cursor.flags & KVMFR_CURSOR_FLAG_POS))
+    // wait until we have cursor data
+    const uint32_t notifyValue = notify_get(KVMFR_NOTIFY_CURSOR(params.stream));
+
+    // the position is a single word so it can be read without a handshake
+    const uint64_t pos    = __atomic_load_n(&state.stream->cursor.pos, __ATOMIC_ACQUIRE);
+    const bool     moved  = KVMFR_CURSOR_POS_SEQ(pos) != 0 &&
+                            KVMFR_CURSOR_POS_SEQ(pos) != posSeq;
+    const uint32_t cursorSerial = __atomic_load_n(&state.stream->cursor.serial, __ATOMIC_ACQUIRE);
+    const bool     update = cursorSerial != serial;
+
+    if (!moved && !update)
     {
       if (!state.running)
         return 0;
 
-      usleep(1);
+      notify_wait(KVMFR_NOTIFY_CURSOR(params.stream), notifyValue, 100);
       continue;
     }
 
-    // if the cursor was moved
-    bool moved = false;
-    if (state.shm->cursor.flags & KVMFR_CURSOR_FLAG_POS)
+    if (moved)
     {
-      state.cursor.x      = state.shm->cursor.x;
-      state.cursor.y      = state.shm->cursor.y;
+      posSeq              = KVMFR_CURSOR_POS_SEQ(pos);
+      state.cursor.x      = KVMFR_CURSOR_POS_X(pos);
+      state.cursor.y      = KVMFR_CURSOR_POS_Y(pos);
       state.haveCursorPos = true;
-      moved               = true;
+      record_cursor_pos(state.cursor.x, state.cursor.y);
     }
 
     // if this was only a move event
-    if (!(state.shm->cursor.flags & KVMFR_CURSOR_FLAG_UPDATE))
+    if (!update)
     {
-      // turn off the pos flag, trigger the event and continue
-      __sync_and_and_fetch(&state.shm->cursor.flags, ~KVMFR_CURSOR_FLAG_POS);
-
       state.lgr->on_mouse_event
       (
         state.lgrData,
@@ -282,13 +596,15 @@ int cursorThread(void * unused)
         state.cursor.x,
         state.cursor.y
       );
+      invalidateRender();
       continue;
     }
 
     // we must take a copy of the header to prevent the contained arguments
     // from being abused to overflow buffers.
-    memcpy(&header, &state.shm->cursor, sizeof(struct KVMFRCursor));
+    memcpy(&header, &state.stream->cursor, sizeof(struct KVMFRCursor));
 
+    const uint8_t * shape = NULL;
     if (header.flags & KVMFR_CURSOR_FLAG_SHAPE &&
         header.version != version)
     {
@@ -310,14 +626,15 @@ int cursorThread(void * unused)
         break;
 
       // check the data position is sane
-      const uint64_t dataSize = header.height * header.pitch;
-      if (header.dataPos + dataSize > state.shmSize)
+      const uint64_t dataSize = (uint64_t)header.height * header.pitch;
+      if (!regionContains(&state.cursorRegion, header.dataPos, dataSize))
       {
         DEBUG_ERROR("The guest sent an invalid mouse dataPos");
         break;
       }
 
       const uint8_t * data = (const uint8_t *)state.shm + header.dataPos;
+      shape = data;
       if (!state.lgr->on_mouse_shape(
         state.lgrData,
         cursorType,
@@ -330,10 +647,14 @@ int cursorThread(void * unused)
         DEBUG_ERROR("Failed to update mouse shape");
         break;
       }
+      invalidateRender();
     }
 
+    record_cursor(header.flags, header.type, header.width, header.height, header.pitch, shape);
+
     // now we have taken the mouse data, we can flag to the host we are ready
-    state.shm->cursor.flags = 0;
+    serial = cursorSerial;
+    state.reader->cursorAck[params.stream] = serial;
 
     bool showCursor = header.flags & KVMFR_CURSOR_FLAG_VISIBLE;
     if (showCursor != state.cursorVisible || moved)
@@ -346,39 +667,138 @@ int cursorThread(void * unused)
         state.cursor.x,
         state.cursor.y
       );
+      invalidateRender();
     }
   }
 
   return 0;
 }
 
+/* a slot is held from the host while anything is reading it, the frameThread
+ * claims it and hands the claim to the renderer which releases it once the
+ * frame has been uploaded */
+static void holdFrame(const int slot)
+{
+  LG_LOCK(state.frameLock);
+  if (state.frameRefs[slot]++ == 0)
+    __sync_or_and_fetch(&state.reader->holding, 1U << KVMFR_SLOT_INDEX(params.stream, slot));
+  LG_UNLOCK(state.frameLock);
+}
+
+static void releaseFrame(const int slot)
+{
+  if (slot < 0)
+    return;
+
+  LG_LOCK(state.frameLock);
+  if (--state.frameRefs[slot] == 0)
+    __sync_and_and_fetch(&state.reader->holding, ~(1U << KVMFR_SLOT_INDEX(params.stream, slot)));
+  LG_UNLOCK(state.frameLock);
+}
+
+// find and claim the newest frame in the ring that is newer then lastSeq
+static int claimFrame(const uint32_t lastSeq)
+{
+  unsigned int count = state.stream->frameCount;
+  if (count > KVMFR_MAX_FRAMES)
+    count = KVMFR_MAX_FRAMES;
+
+  for(;;)
+  {
+    int      slot = -1;
+    uint32_t best = lastSeq;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+      const uint32_t seq = ((volatile KVMFRFrame *)&state.stream->frames[i])->seq;
+      if (seq && (int32_t)(seq - best) > 0)
+      {
+        slot = i;
+        best = seq;
+      }
+    }
+
+    if (slot < 0)
+      return -1;
+
+    // flag that we are reading the slot, then make sure the host didn't take it
+    volatile KVMFRFrame * fi = &state.stream->frames[slot];
+    holdFrame(slot);
+    if (fi->seq == best)
+      return slot;
+
+    releaseFrame(slot);
+  }
+}
+
 int frameThread(void * unused)
 {
-  bool       error = false;
+  bool       error   = false;
+  int        last    = -1;
+  int        slot    = -1;
+  uint32_t   lastSeq = 0;
+  uint32_t   prevSeq = 0;
   KVMFRFrame header;
 
   memset(&header, 0, sizeof(struct KVMFRFrame));
-  SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+  if (!topology_apply(TOPOLOGY_FRAME))
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
 
   while(state.running)
   {
-    // poll until we have a new frame
-    while(!(state.shm->frame.flags & KVMFR_FRAME_FLAG_UPDATE))
+    // the host has changed the shared memory layout
+    if (((volatile KVMFRDirectory *)&state.shm->directory)->serial != state.dirSerial)
     {
-      if (!state.running)
+      const DirStatus status = loadDirectory(params.shmPrefault);
+      if (status == DIR_STATUS_INVALID)
         break;
 
-      usleep(1);
-      continue;
+      if (status == DIR_STATUS_BUSY)
+      {
+        usleep(1000);
+        continue;
+      }
+    }
+
+    // the host timed us out, so it may already be reusing the slots we held
+    if (state.reader->id != state.readerID)
+    {
+      DEBUG_WARN("The host released our reader slot, registering again");
+      if (!registerReader())
+        break;
+
+      last    = -1;
+      lastSeq = 0;
+    }
+
+    /* if the last frame's slot went backwards the host has reset the ring, a
+     * zero seq only means the host is writing the slot so it isn't a reset */
+    if (last >= 0)
+    {
+      const uint32_t seq = ((volatile KVMFRFrame *)&state.stream->frames[last])->seq;
+      if (seq && (int32_t)(seq - lastSeq) < 0)
+        lastSeq = 0;
+    }
+
+    // wait until we have a new frame
+    for(;;)
+    {
+      const uint32_t notifyValue = notify_get(KVMFR_NOTIFY_FRAME(params.stream));
+      if ((slot = claimFrame(lastSeq)) >= 0 || !state.running)
+        break;
+
+      // let the host know we are still alive while there is nothing to do
+      ++state.reader->heartbeat;
+      notify_wait(KVMFR_NOTIFY_FRAME(params.stream), notifyValue, 100);
     }
 
+    if (slot < 0)
+      break;
+
     // we must take a copy of the header to prevent the contained
     // arguments from being abused to overflow buffers.
-    memcpy(&header, &state.shm->frame, sizeof(struct KVMFRFrame));
-
-    // tell the host to continue as the host buffers up to one frame
-    // we can be sure the data for this frame wont be touched
-    __sync_and_and_fetch(&state.shm->frame.flags, ~KVMFR_FRAME_FLAG_UPDATE);
+    memcpy(&header, &state.stream->frames[slot], sizeof(struct KVMFRFrame));
+    lastSeq = header.seq;
+    const uint64_t claimTime = latency_now();
 
     // sainty check of the frame format
     if (
@@ -391,6 +811,8 @@ int frameThread(void * unused)
       header.pitch   < header.width
     ){
       DEBUG_WARN("Bad header");
+      releaseFrame(slot);
+      slot = -1;
       usleep(1000);
       continue;
     }
@@ -403,6 +825,27 @@ int frameThread(void * unused)
     lgrFormat.stride = header.stride;
     lgrFormat.pitch  = header.pitch;
 
+    // the damage is only useful if the renderer was given the previous frame
+    const uint32_t nextSeq = prevSeq + 1 ? prevSeq + 1 : 1;
+    LG_RendererDamageReset(&lgrFormat.damage,
+      header.seq != nextSeq ||
+      header.damageCount == 0 ||
+      header.damageCount > KVMFR_MAX_DAMAGE
+    );
+
+    for(unsigned int i = 0; !lgrFormat.damage.full && i < header.damageCount; ++i)
+    {
+      const KVMFRRect * r = &header.damage[i];
+      if (r->x >= header.width  || r->width  > header.width  - r->x ||
+          r->y >= header.height || r->height > header.height - r->y)
+      {
+        DEBUG_WARN("The guest sent an invalid damage rect");
+        LG_RendererDamageReset(&lgrFormat.damage, true);
+        break;
+      }
+      lgrFormat.damage.rects[lgrFormat.damage.count++] = *r;
+    }
+
     size_t dataSize;
     switch(header.type)
     {
@@ -428,8 +871,8 @@ int frameThread(void * unused)
     if (error)
       break;
 
-    // check the header's dataPos is sane
-    if (header.dataPos + dataSize > state.shmSize)
+    // check the frame is inside the slot it was published in
+    if (!regionContains(&state.frameRegion[slot], header.dataPos, dataSize))
     {
       DEBUG_ERROR("The guest sent an invalid dataPos");
       break;
@@ -440,17 +883,45 @@ int frameThread(void * unused)
       state.srcSize.x = header.width;
       state.srcSize.y = header.height;
       state.haveSrcSize = true;
-      if (params.autoResize)
+      if (params.autoResize && state.window)
         SDL_SetWindowSize(state.window, header.width, header.height);
       updatePositionInfo();
     }
 
+    // the host times can only be compared to ours if it shares our clock
+    const bool sharedClock = state.shm->notifyCaps & KVMFR_NOTIFY_CAP_TIME;
+    if (header.captureTime && header.publishTime >= header.captureTime)
+      latency_record(LATENCY_CAPTURE, header.publishTime - header.captureTime);
+    if (sharedClock && header.publishTime && claimTime >= header.publishTime)
+      latency_record(LATENCY_PICKUP, claimTime - header.publishTime);
+
+    // recorded first as the renderer can give the slot back as soon as it has it
     const uint8_t * data = (const uint8_t *)state.shm + header.dataPos;
-    if (!state.lgr->on_frame_event(state.lgrData, lgrFormat, data))
+    record_frame(&lgrFormat, data, dataSize);
+
+    // the renderer now owns the claim and releases it once it is done with the data
+    const LG_RendererFrame frame =
+    {
+      .data        = data,
+      .size        = dataSize,
+      .release     = releaseFrame,
+      .slot        = slot,
+      .claimTime   = claimTime,
+      .captureTime = sharedClock ? header.captureTime : 0
+    };
+
+    last = slot;
+    slot = -1;
+    if (!state.lgr->on_frame_event(state.lgrData, lgrFormat, frame))
     {
       DEBUG_ERROR("renderer on frame event returned failure");
       break;
     }
+    invalidateRender();
+    prevSeq = header.seq;
+
+    state.reader->consumed = header.seq;
+    ++state.reader->heartbeat;
 
     ++state.frameCount;
     if (!state.started)
@@ -460,12 +931,15 @@ int frameThread(void * unused)
     }
   }
 
+  releaseFrame(slot);
+
   state.running = false;
   return 0;
 }
 
 int spiceThread(void * arg)
 {
+  topology_apply(TOPOLOGY_SPICE);
   while(state.running)
     if (!spice_process())
     {
@@ -519,6 +993,10 @@ int eventFilter(void * userdata, SDL_Event * event)
           updatePositionInfo();
           realignGuest = true;
           break;
+
+        case SDL_WINDOWEVENT_EXPOSED:
+          invalidateRender();
+          break;
       }
       return 0;
     }
@@ -605,12 +1083,15 @@ int eventFilter(void * userdata, SDL_Event * event)
         DEBUG_INFO("Server Mode: %s", serverMode ? "on" : "off");
 
         if (state.lgr && !params.disableAlerts)
+        {
           state.lgr->on_alert(
             state.lgrData,
             serverMode ? LG_ALERT_SUCCESS  : LG_ALERT_WARNING,
             serverMode ? "Capture Enabled" : "Capture Disabled",
             NULL
           );
+          invalidateRender();
+        }
 
         if (!serverMode)
           realignGuest = true;
@@ -709,9 +1190,18 @@ void intHandler(int signal)
     case SIGINT:
       state.running = false;
       break;
+
+    case SIGUSR1:
+      state.latencyReport = true;
+      break;
   }
 }
 
+/*
+The frames are copied straight out of the mapping, so the options here trade a
+slower start for fewer page faults and TLB misses in the copy path. The NUMA
+policy has to be set before anything faults the pages in for it to apply.
+*/
 static void * map_memory()
 {
   struct stat st;
@@ -729,7 +1219,13 @@ static void * map_memory()
     return NULL;
   }
 
-  void * map = mmap(0, state.shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, state.shmFD, 0);
+  // a file on hugetlbfs is always backed by huge pages of the block size
+  struct statfs fs;
+  const bool hugetlbfs = fstatfs(state.shmFD, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC;
+  const size_t page = hugetlbfs ? (size_t)fs.f_bsize : (size_t)sysconf(_SC_PAGESIZE);
+  state.shmMapSize  = (state.shmSize + page - 1) & ~(page - 1);
+
+  void * map = mmap(0, state.shmMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, state.shmFD, 0);
   if (map == MAP_FAILED)
   {
     DEBUG_ERROR("Failed to map the shared memory file: %s", params.shmFile);
@@ -738,6 +1234,65 @@ static void * map_memory()
     return NULL;
   }
 
+  char huge[32] = "no";
+  if (hugetlbfs)
+    snprintf(huge, sizeof(huge), "yes (hugetlbfs, %lu KB)", (unsigned long)(page / 1024));
+  else if (params.shmHugePages)
+  {
+    // tmpfs only honours this if shmem_enabled is set to advise or above
+    if (madvise(map, state.shmMapSize, MADV_HUGEPAGE) == 0)
+      strcpy(huge, "advised");
+    else
+      snprintf(huge, sizeof(huge), "failed (%s)", strerror(errno));
+  }
+
+  char node[32] = "any";
+  if (params.shmNode >= 0)
+  {
+    unsigned long mask[4] = { 0 };
+    if (params.shmNode >= (int)(sizeof(mask) * 8))
+      strcpy(node, "invalid");
+    else
+    {
+      mask[params.shmNode / (sizeof(long) * 8)] = 1UL << (params.shmNode % (sizeof(long) * 8));
+      // pages already on another node are only moved if we are their only user
+      if (syscall(SYS_mbind, map, state.shmMapSize, MPOL_BIND, mask,
+            sizeof(mask) * 8, MPOL_MF_MOVE) == 0)
+        snprintf(node, sizeof(node), "%d", params.shmNode);
+      else
+        snprintf(node, sizeof(node), "failed (%s)", strerror(errno));
+    }
+  }
+
+  char prefault[32] = "no";
+  if (params.shmPrefault)
+  {
+    const uint64_t start = nanotime();
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(map, state.shmMapSize, MADV_POPULATE_WRITE) != 0)
+#endif
+    {
+      madvise(map, state.shmMapSize, MADV_WILLNEED);
+      for(size_t i = 0; i < state.shmMapSize; i += page)
+        (void)*(volatile const uint8_t *)((const uint8_t *)map + i);
+    }
+    snprintf(prefault, sizeof(prefault), "yes (%lu ms)", (unsigned long)((nanotime() - start) / 1000000));
+  }
+
+  char locked[32] = "no";
+  if (params.shmLock)
+  {
+    if (mlock(map, state.shmMapSize) == 0)
+      strcpy(locked, "yes");
+    else
+      snprintf(locked, sizeof(locked), "failed (%s)", strerror(errno));
+  }
+
+  DEBUG_INFO("Shared Memory   : %s (%u MB)", params.shmFile, state.shmSize / 1024 / 1024);
+  DEBUG_INFO("Huge Pages      : %s", huge);
+  DEBUG_INFO("NUMA Node       : %s", node);
+  DEBUG_INFO("Prefaulted      : %s", prefault);
+  DEBUG_INFO("Locked          : %s", locked);
   return map;
 }
 
@@ -772,12 +1327,105 @@ static bool try_renderer(const int index, const LG_RendererParams lgrParams, Uin
   return true;
 }
 
+static bool createWindow(const Uint32 sdlFlags, SDL_Cursor ** cursor)
+{
+  state.window = SDL_CreateWindow(
+    "Looking Glass (Client)",
+    params.center ? SDL_WINDOWPOS_CENTERED : params.x,
+    params.center ? SDL_WINDOWPOS_CENTERED : params.y,
+    params.w,
+    params.h,
+    (
+      SDL_WINDOW_SHOWN |
+      (params.fullscreen  ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0) |
+      (params.allowResize ? SDL_WINDOW_RESIZABLE  : 0) |
+      (params.borderless  ? SDL_WINDOW_BORDERLESS : 0) |
+      sdlFlags
+    )
+  );
+
+  if (state.window == NULL) {
+    DEBUG_ERROR("Could not create an SDL window: %s\n", SDL_GetError());
+    return false;
+  }
+
+  if (params.fullscreen)
+    SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
+
+  if (params.allowScreensaver)
+    SDL_SetHint(SDL_HINT_VIDEO_ALLOW_SCREENSAVER, "1");
+
+  if (!params.center)
+    SDL_SetWindowPosition(state.window, params.x, params.y);
+
+  // ensure the initial window size is stored in the state
+  SDL_GetWindowSize(state.window, &state.windowW, &state.windowH);
+
+  // set the compositor hint to bypass for low latency
+  SDL_SysWMinfo wminfo;
+  SDL_VERSION(&wminfo.version);
+  if (SDL_GetWindowWMInfo(state.window, &wminfo))
+  {
+    if (wminfo.subsystem == SDL_SYSWM_X11)
+    {
+      Atom NETWM_BYPASS_COMPOSITOR = XInternAtom(
+        wminfo.info.x11.display,
+        "NETWM_BYPASS_COMPOSITOR",
+        False);
+
+      unsigned long value = 1;
+      XChangeProperty(
+        wminfo.info.x11.display,
+        wminfo.info.x11.window,
+        NETWM_BYPASS_COMPOSITOR,
+        XA_CARDINAL,
+        32,
+        PropModeReplace,
+        (unsigned char *)&value,
+        1
+      );
+    }
+  } else {
+    DEBUG_ERROR("Could not get SDL window information %s", SDL_GetError());
+    return false;
+  }
+
+  if (!state.window)
+  {
+    DEBUG_ERROR("failed to create window");
+    return false;
+  }
+
+  if (params.hideMouse)
+  {
+    // work around SDL_ShowCursor being non functional
+    int32_t cursorData[2] = {0, 0};
+    *cursor = SDL_CreateCursor((uint8_t*)cursorData, (uint8_t*)cursorData, 8, 8, 4, 4);
+    SDL_SetCursor(*cursor);
+    SDL_ShowCursor(SDL_DISABLE);
+  }
+
+  return true;
+}
+
 int run()
 {
   DEBUG_INFO("Looking Glass (" BUILD_VERSION ")");
   DEBUG_INFO("Locking Method: " LG_LOCK_MODE);
 
+  // before any thread takes a timestamp
+  timing_init();
+
+#ifdef ATOMIC_LOCKING
+  // must be set before any locks are initialized
+  lg_lock_stats = params.lockStats;
+#else
+  if (params.lockStats)
+    DEBUG_WARN("Lock statistics are only available with ATOMIC_LOCKING");
+#endif
+
   memset(&state, 0, sizeof(state));
+  LG_LOCK_INIT(state.frameLock);
   state.running   = true;
   state.scaleX    = 1.0f;
   state.scaleY    = 1.0f;
@@ -807,7 +1455,22 @@ int run()
     DEBUG_WARN("================================================================================");
   }
 
-  if (SDL_Init(SDL_INIT_VIDEO) < 0)
+  // the bench runs without a window so it doesn't need a display
+  if (params.forceRenderer && LG_Renderers[params.forceRendererIndex] == &LGR_Bench)
+  {
+    params.bench    = true;
+    params.useSpice = false;
+    DEBUG_INFO("Running the headless bench");
+  }
+
+  // before SDL or anything else starts a thread so they all inherit it
+  if (!topology_init())
+    return -1;
+
+  // from here on logging is written out by its own thread
+  debug_init();
+
+  if (SDL_Init(params.bench ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) < 0)
   {
     DEBUG_ERROR("SDL_Init Failed");
     return -1;
@@ -817,6 +1480,9 @@ int run()
   // SIGINT and the user sending a close event, such as ALT+F4
   signal(SIGINT, intHandler);
 
+  // SIGUSR1 logs the frame latency histograms
+  signal(SIGUSR1, intHandler);
+
   LG_RendererParams lgrParams;
   lgrParams.showFPS = params.showFPS;
   Uint32 sdlFlags;
@@ -837,6 +1503,10 @@ int run()
     // probe for a a suitable renderer
     for(unsigned int i = 0; i < LG_RENDERER_COUNT; ++i)
     {
+      // the bench draws nothing so it is never picked unless asked for
+      if (LG_Renderers[i] == &LGR_Bench)
+        continue;
+
       sdlFlags = 0;
       if (try_renderer(i, lgrParams, &sdlFlags))
       {
@@ -853,82 +1523,23 @@ int run()
     return -1;
   }
 
-  state.window = SDL_CreateWindow(
-    "Looking Glass (Client)",
-    params.center ? SDL_WINDOWPOS_CENTERED : params.x,
-    params.center ? SDL_WINDOWPOS_CENTERED : params.y,
-    params.w,
-    params.h,
-    (
-      SDL_WINDOW_SHOWN |
-      (params.fullscreen  ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0) |
-      (params.allowResize ? SDL_WINDOW_RESIZABLE  : 0) |
-      (params.borderless  ? SDL_WINDOW_BORDERLESS : 0) |
-      sdlFlags
-    )
-  );
-
-  if (state.window == NULL) {
-    DEBUG_ERROR("Could not create an SDL window: %s\n", SDL_GetError());
-    return 1;
-  }
-
-  if (params.fullscreen)
-    SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
-
-  if (params.allowScreensaver)
-    SDL_SetHint(SDL_HINT_VIDEO_ALLOW_SCREENSAVER, "1");
-
-  if (!params.center)
-    SDL_SetWindowPosition(state.window, params.x, params.y);
-
-  // ensure the initial window size is stored in the state
-  SDL_GetWindowSize(state.window, &state.windowW, &state.windowH);
-
-  // set the compositor hint to bypass for low latency
-  SDL_SysWMinfo wminfo;
-  SDL_VERSION(&wminfo.version);
-  if (SDL_GetWindowWMInfo(state.window, &wminfo))
-  {
-    if (wminfo.subsystem == SDL_SYSWM_X11)
-    {
-      Atom NETWM_BYPASS_COMPOSITOR = XInternAtom(
-        wminfo.info.x11.display,
-        "NETWM_BYPASS_COMPOSITOR",
-        False);
-
-      unsigned long value = 1;
-      XChangeProperty(
-        wminfo.info.x11.display,
-        wminfo.info.x11.window,
-        NETWM_BYPASS_COMPOSITOR,
-        XA_CARDINAL,
-        32,
-        PropModeReplace,
-        (unsigned char *)&value,
-        1
-      );
-    }
-  } else {
-    DEBUG_ERROR("Could not get SDL window information %s", SDL_GetError());
-    return -1;
-  }
-
-  if (!state.window)
-  {
-    DEBUG_ERROR("failed to create window");
+  SDL_Cursor *cursor = NULL;
+  if (!params.bench && !createWindow(sdlFlags, &cursor))
     return -1;
-  }
 
-  SDL_Cursor *cursor = NULL;
-  if (params.hideMouse)
+  // the vblank period is taken from the display the window opened on
+  if (params.presentOnArrival && params.vsyncAlign)
   {
-    // work around SDL_ShowCursor being non functional
-    int32_t cursorData[2] = {0, 0};
-    cursor = SDL_CreateCursor((uint8_t*)cursorData, (uint8_t*)cursorData, 8, 8, 4, 4);
-    SDL_SetCursor(cursor);
-    SDL_ShowCursor(SDL_DISABLE);
+    SDL_DisplayMode mode;
+    int refresh = 60;
+    if (SDL_GetWindowDisplayMode(state.window, &mode) == 0 && mode.refresh_rate > 0)
+      refresh = mode.refresh_rate;
+    else
+      DEBUG_WARN("Unknown display refresh rate, assuming 60Hz");
+    pacing_init(1000000000ULL / refresh);
   }
+  else if (params.vsyncAlign)
+    DEBUG_WARN("vsyncAlign has no effect without presentOnArrival");
 
   SDL_Thread *t_spice  = NULL;
   SDL_Thread *t_main   = NULL;
@@ -944,6 +1555,26 @@ int run()
       break;
     }
 
+    // this must be done before the restart so the host knows how to notify us
+    if (!notify_init(state.shm, params.doorbell))
+    {
+      DEBUG_ERROR("Failed to initialize notifications");
+      break;
+    }
+    latency_init();
+
+    if (params.recordFile && !record_init(params.recordFile))
+      break;
+
+    if (!multimemcpy_init(0))
+      DEBUG_WARN("Frame copies will be done on the render thread");
+
+    if (!(state.renderSem = SDL_CreateSemaphore(0)))
+    {
+      DEBUG_ERROR("Failed to create the render semaphore");
+      break;
+    }
+
     // start the renderThread so we don't just display junk
     if (!(t_render = SDL_CreateThread(renderThread, "renderThread", NULL)))
     {
@@ -1006,6 +1637,22 @@ int run()
       break;
     }
 
+    if (params.stream >= state.shm->streamCount)
+    {
+      DEBUG_ERROR("Display %u was requested but the host only has %u", params.stream, state.shm->streamCount);
+      break;
+    }
+    state.stream = &state.shm->streams[params.stream];
+
+    // validate the shared memory regions, faulting them in if asked to
+    if (loadDirectory(params.shmPrefault) != DIR_STATUS_OK)
+    {
+      DEBUG_ERROR("The shared memory directory is invalid");
+      break;
+    }
+
+    if (!registerReader())
+      break;
 
     if (!(t_main = SDL_CreateThread(cursorThread, "cursorThread", NULL)))
     {
@@ -1019,22 +1666,32 @@ int run()
       break;
     }
 
+    const uint64_t benchEnd = microtime() + (uint64_t)params.benchTime * 1000000;
     bool *closeAlert = NULL;
     while(state.running)
     {
       SDL_WaitEventTimeout(NULL, 1000);
 
+      if (params.benchTime && microtime() >= benchEnd)
+      {
+        DEBUG_INFO("Bench complete");
+        break;
+      }
+
       if (closeAlert == NULL)
       {
         if (state.shm->flags & KVMFR_HEADER_FLAG_PAUSED)
         {
           if (state.lgr && !params.disableAlerts)
+          {
             state.lgr->on_alert(
               state.lgrData,
               LG_ALERT_WARNING,
               "Stream Paused",
               &closeAlert
             );
+            invalidateRender();
+          }
         }
       }
       else
@@ -1043,6 +1700,7 @@ int run()
         {
           *closeAlert = true;
           closeAlert  = NULL;
+          invalidateRender();
         }
       }
     }
@@ -1053,7 +1711,10 @@ int run()
   state.running = false;
 
   if (t_render)
+  {
+    invalidateRender();
     SDL_WaitThread(t_render, NULL);
+  }
 
   if (t_frame)
     SDL_WaitThread(t_frame, NULL);
@@ -1091,10 +1752,23 @@ int run()
 
   if (state.shm)
   {
-    munmap(state.shm, state.shmSize);
+    unregisterReader();
+    notify_report();
+    notify_free();
+    latency_report();
+    latency_free();
+    pacing_free();
+    record_free();
+    multimemcpy_free();
+    munmap(state.shm, state.shmMapSize);
     close(state.shmFD);
   }
 
+  if (state.renderSem)
+    SDL_DestroySemaphore(state.renderSem);
+
+  LG_LOCK_FREE(state.frameLock);
+
   SDL_Quit();
   return 0;
 }
@@ -1115,6 +1789,12 @@ void doHelp(char * app)
     "  -C PATH   Specify an additional configuration file to load\n"
     "  -f PATH   Specify the path to the shared memory file [current: %s]\n"
     "  -L SIZE   Specify the size in MB of the shared memory file (0 = detect) [current: %d]\n"
+    "  -D PATH   Use the ivshmem-server socket at PATH for doorbell notifications [current: %s]\n"
+    "  -i INDEX  Show the guest display INDEX [current: %u]\n"
+    "  -H        Ask for the shared memory to be backed by transparent huge pages\n"
+    "  -z        Fault in the whole shared memory at startup\n"
+    "  -U        Lock the shared memory into RAM\n"
+    "  -N NODE   Bind the shared memory to NUMA node NODE, -1 for any [current: %d]\n"
     "\n"
     "  -s        Disable spice client\n"
     "  -c HOST   Specify the spice host or UNIX socket [current: %s]\n"
@@ -1123,8 +1803,17 @@ void doHelp(char * app)
     "  -M        Don't hide the host cursor\n"
     "\n"
     "  -K        Set the FPS limit [current: %d]\n"
+    "  -A MS     Redraw an idle scene every MS milliseconds, 0 to always redraw [current: %u]\n"
     "  -k        Enable FPS display\n"
+    "  -P        Present frames as soon as they arrive instead of at the FPS limit\n"
+    "  -V        With -P, hold each present back to just before the next vblank\n"
     "  -g NAME   Force the use of a specific renderer\n"
+    "  -B SECS   Run headless with the bench renderer for SECS seconds, 0 until interrupted\n"
+    "  -R PATH   Record the frames and cursor updates to PATH for replay by the producer\n"
+    "  -t NAME=CPUS[:POLICY[:PRIO]]\n"
+    "            Run the frame, render, cursor or spice thread on CPUS (ie: 2,4-5)\n"
+    "            with the other, batch, fifo or rr scheduling policy\n"
+    "  -e CPUS   Keep every thread off CPUS, ie: the cores running the guest's vCPUs\n"
     "  -o OPTION Specify a renderer option (ie: opengl:vsync=0)\n"
     "            Alternatively specify \"list\" to list all renderers and their options\n"
     "\n"
@@ -1144,15 +1833,21 @@ void doHelp(char * app)
     "            See https://wiki.libsdl.org/SDLScancodeLookup for valid values\n"
     "  -q        Disable alert messages [current: %s]\n"
     "\n"
+    "  -T        Report lock contention statistics on exit\n"
+    "\n"
     "  -l        License information\n"
     "\n",
     app,
     app,
     params.shmFile,
     params.shmSize,
+    params.doorbell ? params.doorbell : "disabled",
+    params.stream,
+    params.shmNode,
     params.spiceHost,
     params.spicePort,
     params.fpsLimit,
+    params.keepAlive,
     params.center ? "center" : x,
     params.center ? "center" : y,
     params.w,
@@ -1213,9 +1908,52 @@ static bool load_config(const char * configFile)
       params.shmFile = strdup(stmp);
     }
 
+    if (config_setting_lookup_string(global, "doorbell", &stmp))
+    {
+      free(params.doorbell);
+      params.doorbell = strdup(stmp);
+    }
+
+    for(int i = 0; i < TOPOLOGY_THREAD_COUNT; ++i)
+      if (config_setting_lookup_string(global, topology_keys[i], &stmp) &&
+          !topology_set_thread(i, stmp))
+      {
+        config_destroy(&cfg);
+        return false;
+      }
+
+    if (config_setting_lookup_string(global, "excludeCPUs", &stmp) &&
+        !topology_set_exclude(stmp))
+    {
+      config_destroy(&cfg);
+      return false;
+    }
+
+    if (config_setting_lookup_string(global, "record", &stmp))
+    {
+      free(params.recordFile);
+      params.recordFile = strdup(stmp);
+    }
+
+    if (config_setting_lookup_int(global, "display", &itmp))
+    {
+      if (itmp < 0 || itmp >= KVMFR_MAX_STREAMS)
+      {
+        DEBUG_ERROR("Invalid display index, must be less then %d", KVMFR_MAX_STREAMS);
+        config_destroy(&cfg);
+        return false;
+      }
+      params.stream = itmp;
+    }
+
     if (config_setting_lookup_int(global, "shmSize", &itmp))
       params.shmSize = itmp * 1024 * 1024;
 
+    if (config_setting_lookup_bool(global, "shmHugePages", &itmp)) params.shmHugePages = (itmp != 0);
+    if (config_setting_lookup_bool(global, "shmPrefault" , &itmp)) params.shmPrefault  = (itmp != 0);
+    if (config_setting_lookup_bool(global, "shmLock"     , &itmp)) params.shmLock      = (itmp != 0);
+    config_setting_lookup_int(global, "shmNode", &params.shmNode);
+
     if (config_setting_lookup_string(global, "forceRenderer", &stmp))
     {
       bool ok = false;
@@ -1247,6 +1985,9 @@ static bool load_config(const char * configFile)
     if (config_setting_lookup_bool(global, "ignoreQuit"      , &itmp)) params.ignoreQuit       = (itmp != 0);
     if (config_setting_lookup_bool(global, "allowScreensaver", &itmp)) params.allowScreensaver = (itmp != 0);
     if (config_setting_lookup_bool(global, "disableAlerts"   , &itmp)) params.disableAlerts    = (itmp != 0);
+    if (config_setting_lookup_bool(global, "presentOnArrival", &itmp)) params.presentOnArrival = (itmp != 0);
+    if (config_setting_lookup_bool(global, "vsyncAlign"      , &itmp)) params.vsyncAlign       = (itmp != 0);
+    if (config_setting_lookup_bool(global, "lockStats"       , &itmp)) params.lockStats        = (itmp != 0);
 
     if (config_setting_lookup_int(global, "x", &params.x)) params.center = false;
     if (config_setting_lookup_int(global, "y", &params.y)) params.center = false;
@@ -1284,6 +2025,17 @@ static bool load_config(const char * configFile)
       params.fpsLimit = (unsigned int)itmp;
     }
 
+    if (config_setting_lookup_int(global, "keepAlive", &itmp))
+    {
+      if (itmp < 0)
+      {
+        DEBUG_ERROR("Invalid keep alive, must be 0 or greater");
+        config_destroy(&cfg);
+        return false;
+      }
+      params.keepAlive = (unsigned int)itmp;
+    }
+
     if (config_setting_lookup_int(global, "captureKey", &itmp))
     {
       if (itmp <= SDL_SCANCODE_UNKNOWN || itmp > SDL_SCANCODE_APP2)
@@ -1387,7 +2139,7 @@ int main(int argc, char * argv[])
 
   for(;;)
   {
-    switch(getopt(argc, argv, "hC:f:L:sc:p:jMvK:kg:o:anrdFx:y:w:b:QSGm:lq"))
+    switch(getopt(argc, argv, "hC:f:L:D:i:HzUN:sc:p:jMvK:A:kPVg:B:R:t:e:o:anrdFx:y:w:b:QSGm:lqT"))
     {
       case '?':
       case 'h':
@@ -1413,6 +2165,37 @@ int main(int argc, char * argv[])
         params.shmSize = atoi(optarg) * 1024 * 1024;
         continue;
 
+      case 'D':
+        free(params.doorbell);
+        params.doorbell = strdup(optarg);
+        continue;
+
+      case 'i':
+        params.stream = atoi(optarg);
+        if (params.stream >= KVMFR_MAX_STREAMS)
+        {
+          fprintf(stderr, "Invalid display index, must be less then %d\n", KVMFR_MAX_STREAMS);
+          doHelp(argv[0]);
+          return false;
+        }
+        continue;
+
+      case 'H':
+        params.shmHugePages = true;
+        continue;
+
+      case 'z':
+        params.shmPrefault = true;
+        continue;
+
+      case 'U':
+        params.shmLock = true;
+        continue;
+
+      case 'N':
+        params.shmNode = atoi(optarg);
+        continue;
+
       case 's':
         params.useSpice = false;
         continue;
@@ -1438,10 +2221,22 @@ int main(int argc, char * argv[])
         params.fpsLimit = atoi(optarg);
         continue;
 
+      case 'A':
+        params.keepAlive = atoi(optarg);
+        continue;
+
       case 'k':
         params.showFPS = true;
         continue;
 
+      case 'P':
+        params.presentOnArrival = true;
+        continue;
+
+      case 'V':
+        params.vsyncAlign = true;
+        continue;
+
       case 'g':
       {
         bool ok = false;
@@ -1465,6 +2260,31 @@ int main(int argc, char * argv[])
         continue;
       }
 
+      case 'B':
+        params.benchTime = atoi(optarg);
+        for(unsigned int i = 0; i < LG_RENDERER_COUNT; ++i)
+          if (LG_Renderers[i] == &LGR_Bench)
+          {
+            params.forceRenderer      = true;
+            params.forceRendererIndex = i;
+          }
+        continue;
+
+      case 't':
+        if (!topology_parse(optarg))
+          return -1;
+        continue;
+
+      case 'e':
+        if (!topology_set_exclude(optarg))
+          return -1;
+        continue;
+
+      case 'R':
+        free(params.recordFile);
+        params.recordFile = strdup(optarg);
+        continue;
+
       case 'o':
       {
         if (strcasecmp(optarg, "list") == 0)
@@ -1624,6 +2444,10 @@ int main(int argc, char * argv[])
         params.disableAlerts = true;
         continue;
 
+      case 'T':
+        params.lockStats = true;
+        continue;
+
       case 'l':
         doLicense();
         return 0;
@@ -1644,9 +2468,12 @@ int main(int argc, char * argv[])
   }
 
   const int ret = run();
+  debug_free();
 
   free(params.shmFile);
+  free(params.doorbell);
   free(params.spiceHost);
+  free(params.recordFile);
   for(unsigned int i = 0; i < LG_RENDERER_COUNT; ++i)
   {
     RendererOpts * opts = &params.rendererOpts[i];
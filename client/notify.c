@@ -0,0 +1,362 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "notify.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define IVSHMEM_PROTOCOL_VERSION 0
+
+struct NotifyStats
+{
+  uint64_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+};
+
+struct Notify
+{
+  struct KVMFRHeader * shm;
+
+  int      socket;
+  int64_t  peerID;
+  int      vectors;
+  int      eventfd[KVMFR_NOTIFY_COUNT];
+
+  struct NotifyStats stats[KVMFR_NOTIFY_COUNT];
+};
+
+static struct Notify notify =
+{
+  .socket  = -1,
+  .peerID  = -1,
+  .eventfd = { [0 ... KVMFR_NOTIFY_COUNT - 1] = -1 }
+};
+
+static const char * notify_names[2] =
+{
+  "Frame",
+  "Cursor"
+};
+
+// reads a single message from the ivshmem-server, fd is -1 if none was sent
+static bool notify_read_msg(int64_t * value, int * fd)
+{
+  union
+  {
+    struct cmsghdr cmsg;
+    char           buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct iovec  iov = { .iov_base = value, .iov_len = sizeof(*value) };
+  struct msghdr msg =
+  {
+    .msg_iov        = &iov,
+    .msg_iovlen     = 1,
+    .msg_control    = control.buffer,
+    .msg_controllen = sizeof(control.buffer)
+  };
+
+  *fd = -1;
+  if (recvmsg(notify.socket, &msg, 0) != sizeof(*value))
+  {
+    DEBUG_ERROR("Failed to read from the ivshmem-server");
+    return false;
+  }
+
+  *value = (int64_t)le64toh(*value);
+  for(struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type  != SCM_RIGHTS ||
+        cmsg->cmsg_len   != CMSG_LEN(sizeof(int)))
+      continue;
+
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  return true;
+}
+
+// process a message, keeping the eventfds that belong to us
+static bool notify_process_msg(int timeout)
+{
+  struct pollfd pfd = { .fd = notify.socket, .events = POLLIN };
+  if (poll(&pfd, 1, timeout) <= 0)
+    return false;
+
+  int64_t value;
+  int     fd;
+  if (!notify_read_msg(&value, &fd))
+    return false;
+
+  if (fd < 0)
+    return true;
+
+  /* the server sends the eventfds of each peer in vector order, ours are the
+   * ones we get interrupted on, the others are only needed to ring peers */
+  if (value == notify.peerID)
+  {
+    if (notify.vectors < KVMFR_NOTIFY_COUNT)
+    {
+      notify.eventfd[notify.vectors++] = fd;
+      return true;
+    }
+    ++notify.vectors;
+  }
+
+  close(fd);
+  return true;
+}
+
+static bool notify_connect(const char * path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    DEBUG_ERROR("The ivshmem-server socket path is too long");
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  notify.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (notify.socket < 0)
+  {
+    DEBUG_ERROR("Failed to create the socket");
+    return false;
+  }
+
+  if (connect(notify.socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    DEBUG_ERROR("Failed to connect to the ivshmem-server: %s", path);
+    return false;
+  }
+
+  int64_t value;
+  int     fd;
+
+  if (!notify_read_msg(&value, &fd))
+    return false;
+
+  if (fd >= 0)
+    close(fd);
+
+  if (value != IVSHMEM_PROTOCOL_VERSION)
+  {
+    DEBUG_ERROR("Unsupported ivshmem-server protocol version %ld", (long)value);
+    return false;
+  }
+
+  // our peer ID
+  if (!notify_read_msg(&notify.peerID, &fd))
+    return false;
+
+  if (fd >= 0)
+    close(fd);
+
+  if (notify.peerID < 0 || notify.peerID > UINT16_MAX)
+  {
+    DEBUG_ERROR("Invalid peer ID %ld", (long)notify.peerID);
+    return false;
+  }
+
+  // the shared memory, we already have this mapped via the shm file
+  if (!notify_read_msg(&value, &fd))
+    return false;
+
+  if (fd >= 0)
+    close(fd);
+
+  // our own eventfds are sent last, keep reading until the server goes quiet
+  while(notify_process_msg(notify.vectors > 0 ? 100 : 1000)) {}
+
+  if (notify.vectors == 0)
+  {
+    DEBUG_ERROR("The ivshmem-server didn't provide any interrupt vectors");
+    return false;
+  }
+
+  if (notify.vectors < KVMFR_NOTIFY_COUNT)
+    DEBUG_WARN("Only %d interrupt vectors available, some events will be polled", notify.vectors);
+
+  return true;
+}
+
+bool notify_init(struct KVMFRHeader * shm, const char * doorbell)
+{
+  notify.shm = shm;
+  for(int i = 0; i < KVMFR_NOTIFY_COUNT; ++i)
+  {
+    memset(&notify.stats[i], 0, sizeof(struct NotifyStats));
+    notify.stats[i].min = UINT64_MAX;
+  }
+
+  if (!doorbell)
+  {
+    __sync_and_and_fetch(&shm->clientCaps, ~KVMFR_CLIENT_CAP_DOORBELL);
+    return true;
+  }
+
+  if (!notify_connect(doorbell))
+  {
+    notify_free();
+    return false;
+  }
+
+  shm->clientPeer = (uint16_t)notify.peerID;
+  __sync_or_and_fetch(&shm->clientCaps, KVMFR_CLIENT_CAP_DOORBELL);
+
+  DEBUG_INFO("Doorbell peer ID    : %ld", (long)notify.peerID);
+  DEBUG_INFO("Doorbell vectors    : %d" , notify.vectors);
+  return true;
+}
+
+void notify_free()
+{
+  if (notify.shm)
+    __sync_and_and_fetch(&notify.shm->clientCaps, ~KVMFR_CLIENT_CAP_DOORBELL);
+
+  for(int i = 0; i < KVMFR_NOTIFY_COUNT; ++i)
+    if (notify.eventfd[i] >= 0)
+    {
+      close(notify.eventfd[i]);
+      notify.eventfd[i] = -1;
+    }
+
+  if (notify.socket >= 0)
+  {
+    close(notify.socket);
+    notify.socket = -1;
+  }
+
+  notify.vectors = 0;
+  notify.peerID  = -1;
+  notify.shm     = NULL;
+}
+
+uint32_t notify_get(const unsigned int index)
+{
+  return ((volatile KVMFRNotify *)notify.shm->notify)[index].count;
+}
+
+static void notify_sample(const unsigned int index)
+{
+  if (!(notify.shm->notifyCaps & KVMFR_NOTIFY_CAP_TIME))
+    return;
+
+  const uint64_t now  = nanotime();
+  const uint64_t sent = ((volatile KVMFRNotify *)notify.shm->notify)[index].time;
+  if (now < sent)
+    return;
+
+  struct NotifyStats * s = &notify.stats[index];
+  const uint64_t latency = now - sent;
+  ++s->count;
+  s->total += latency;
+  if (latency < s->min) s->min = latency;
+  if (latency > s->max) s->max = latency;
+}
+
+bool notify_wait(const unsigned int index, const uint32_t value, const unsigned int timeout)
+{
+  volatile uint32_t * counter = &((volatile KVMFRNotify *)notify.shm->notify)[index].count;
+  if (*counter != value)
+    return true;
+
+  if (notify.eventfd[index] >= 0)
+  {
+    /* the frame waiter also services the server socket so the peer join and
+     * leave messages don't pile up along with their file descriptors */
+    struct pollfd fds[2] =
+    {
+      { .fd = notify.eventfd[index], .events = POLLIN },
+      { .fd = notify.socket        , .events = POLLIN }
+    };
+    const nfds_t nfds = index == KVMFR_NOTIFY_FRAME(index / 2) ? 2 : 1;
+
+    if (poll(fds, nfds, timeout) > 0)
+    {
+      uint64_t count;
+      if ((fds[0].revents & POLLIN) && read(fds[0].fd, &count, sizeof(count)) < 0)
+        DEBUG_WARN("Failed to read the eventfd");
+
+      if (nfds > 1 && (fds[1].revents & POLLIN))
+        notify_process_msg(0);
+    }
+  }
+  else if (notify.shm->notifyCaps & KVMFR_NOTIFY_CAP_FUTEX)
+  {
+    struct timespec ts =
+    {
+      .tv_sec  = timeout / 1000,
+      .tv_nsec = (timeout % 1000) * 1000000
+    };
+    syscall(SYS_futex, counter, FUTEX_WAIT, value, &ts, NULL, 0);
+  }
+  else
+  {
+    // nothing can wake us, fall back to polling the counter
+    const uint64_t end = microtime() + (uint64_t)timeout * 1000;
+    while(*counter == value && microtime() < end)
+      usleep(1);
+  }
+
+  if (*counter == value)
+    return false;
+
+  notify_sample(index);
+  return true;
+}
+
+void notify_report()
+{
+  for(int i = 0; i < KVMFR_NOTIFY_COUNT; ++i)
+  {
+    const struct NotifyStats * s = &notify.stats[i];
+    if (!s->count)
+      continue;
+
+    const char * mode = "poll";
+    if (notify.eventfd[i] >= 0)
+      mode = "doorbell";
+    else if (notify.shm->notifyCaps & KVMFR_NOTIFY_CAP_FUTEX)
+      mode = "futex";
+
+    DEBUG_INFO("%-6s %d wakeup latency (%s): min %.1fus, avg %.1fus, max %.1fus over %lu events",
+      notify_names[i & 1],
+      i / 2,
+      mode,
+      (float)s->min / 1000.0f,
+      (float)s->total / (float)s->count / 1000.0f,
+      (float)s->max / 1000.0f,
+      (unsigned long)s->count
+    );
+  }
+}
@@ -0,0 +1,44 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "KVMFR.h"
+
+/*
+Waits for KVMFR events using, in order of preference, the ivshmem doorbell, a
+futex on the notify counter if the host runs on this machine, or by polling
+the notify counter.
+
+doorbell is the path to the ivshmem-server UNIX socket, or NULL if not used.
+*/
+bool notify_init(struct KVMFRHeader * shm, const char * doorbell);
+void notify_free();
+
+// read the event counter, pass this value to notify_wait after checking for work
+uint32_t notify_get(const unsigned int index);
+
+// wait up to timeout ms for the counter to change from value, true if it did
+bool notify_wait(const unsigned int index, const uint32_t value, const unsigned int timeout);
+
+// log the wakeup latency statistics
+void notify_report();
@@ -0,0 +1,112 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "pacing.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#define PACING_START_COST 2000000 // the render cost to assume at first
+#define PACING_MIN_COST    500000
+#define PACING_STEP        250000 // added to the cost for each missed vblank
+
+struct Pacing
+{
+  uint64_t period;
+  uint64_t vblank; // when the last swap returned
+  bool     haveVblank;
+  uint64_t target; // the vblank the current render is aiming for, 0 for none
+  uint64_t cost;   // how long before the vblank the render has to start
+
+  unsigned int presents, misses;
+};
+
+static struct Pacing pacing;
+
+// nanotime is on CLOCK_MONOTONIC so the sleep can be absolute
+static uint64_t pacing_now()
+{
+  return nanotime();
+}
+
+void pacing_init(const uint64_t period)
+{
+  memset(&pacing, 0, sizeof(pacing));
+  pacing.period = period;
+  pacing.cost   = PACING_START_COST < period ? PACING_START_COST : period / 2;
+  DEBUG_INFO("Vblank period   : %.2f ms", period / 1e6);
+}
+
+void pacing_free()
+{
+  if (!pacing.presents)
+    return;
+
+  DEBUG_INFO("Vblank pacing   : %u of %u aligned presents missed, render cost %.2f ms",
+    pacing.misses, pacing.presents, pacing.cost / 1e6);
+}
+
+void pacing_wait()
+{
+  pacing.target = 0;
+  if (!pacing.haveVblank || !pacing.period)
+    return;
+
+  const uint64_t now  = pacing_now();
+  const uint64_t next = pacing.vblank +
+    ((now - pacing.vblank) / pacing.period + 1) * pacing.period;
+
+  // too late to make it, render now so the frame is shown a vblank later
+  if (next - now < pacing.cost)
+    return;
+
+  pacing.target = next;
+  const uint64_t start = next - pacing.cost;
+  const struct timespec ts =
+  {
+    .tv_sec  = start / 1000000000,
+    .tv_nsec = start % 1000000000
+  };
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+void pacing_presented()
+{
+  const uint64_t end = pacing_now();
+  if (pacing.target)
+  {
+    ++pacing.presents;
+    if (end > pacing.target + pacing.period / 4)
+    {
+      ++pacing.misses;
+      pacing.cost += PACING_STEP;
+      if (pacing.cost > pacing.period)
+        pacing.cost = pacing.period;
+    }
+    else if (pacing.cost > PACING_MIN_COST)
+      pacing.cost -= pacing.cost / 32;
+  }
+
+  pacing.vblank     = end;
+  pacing.haveVblank = true;
+}
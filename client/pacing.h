@@ -0,0 +1,41 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+Aligns presents to the display's vblank using only swap timing feedback. With
+vsync the swap returns at a vblank, so the end of each present gives the phase
+and the refresh rate gives the period. The render is held back until it can
+only just make the next vblank, so the newest frame is the one shown and the
+swap doesn't sit blocked holding an older one. The render cost starts out
+pessimistic, shrinks while vblanks are made and grows when one is missed.
+*/
+
+// period is the refresh interval in nanoseconds
+void pacing_init(const uint64_t period);
+void pacing_free();
+
+// sleep until the render has to start to make the next vblank
+void pacing_wait();
+
+// called once the render and its swap have returned
+void pacing_presented();
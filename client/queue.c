@@ -0,0 +1,156 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include "queue.h"
+#include "debug.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_ALIGN 64
+
+struct QueueCell
+{
+  volatile uint32_t seq;
+  void            * data;
+};
+
+struct Queue
+{
+  struct QueueCell * cells;
+  uint32_t           mask;
+
+  // the producers' and the consumer's positions are on their own cache lines
+  volatile uint32_t  tail __attribute__((aligned(QUEUE_ALIGN)));
+  volatile uint32_t  head __attribute__((aligned(QUEUE_ALIGN)));
+};
+
+bool queue_new(Queue ** q, const unsigned int capacity)
+{
+  unsigned int size = 2;
+  while(size < capacity)
+    size <<= 1;
+
+  Queue * this;
+  if (posix_memalign((void **)&this, QUEUE_ALIGN, sizeof(Queue)) != 0)
+  {
+    DEBUG_ERROR("Failed to allocate the queue");
+    return false;
+  }
+  memset(this, 0, sizeof(Queue));
+
+  if (posix_memalign((void **)&this->cells, QUEUE_ALIGN, sizeof(struct QueueCell) * size) != 0)
+  {
+    DEBUG_ERROR("Failed to allocate the queue cells");
+    free(this);
+    return false;
+  }
+
+  // a cell is free for the push at position seq, and holds the item for the pop at seq - 1
+  for(unsigned int i = 0; i < size; ++i)
+  {
+    this->cells[i].seq  = i;
+    this->cells[i].data = NULL;
+  }
+  this->mask = size - 1;
+
+  *q = this;
+  return true;
+}
+
+void queue_free(Queue ** q)
+{
+  if (!*q)
+    return;
+
+  free((*q)->cells);
+  free(*q);
+  *q = NULL;
+}
+
+bool queue_push(Queue * q, void * data)
+{
+  uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  struct QueueCell * cell;
+  for(;;)
+  {
+    cell = &q->cells[pos & q->mask];
+    const int32_t diff = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0)
+    {
+      // claim the position, on failure pos is reloaded with the current tail
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (diff < 0)
+      return false; // the consumer hasn't freed this cell from the last lap
+    else
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  }
+
+  cell->data = data;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static struct QueueCell * queue_head(Queue * q)
+{
+  const uint32_t pos = q->head;
+  struct QueueCell * cell = &q->cells[pos & q->mask];
+  if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    return NULL;
+  return cell;
+}
+
+bool queue_pop(Queue * q, void ** data)
+{
+  struct QueueCell * cell = queue_head(q);
+  if (!cell)
+    return false;
+
+  if (data)
+    *data = cell->data;
+
+  // hand the cell to the producers of the next lap
+  const uint32_t pos = q->head;
+  __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&q->head, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool queue_peek(Queue * q, void ** data)
+{
+  struct QueueCell * cell = queue_head(q);
+  if (!cell)
+    return false;
+
+  *data = cell->data;
+  return true;
+}
+
+unsigned int queue_count(Queue * q)
+{
+  // read the head first so the count can't go negative
+  const uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+  const uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
@@ -0,0 +1,48 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+/*
+Lock-free bounded FIFO of pointers for any number of producer threads and a
+single consumer thread. Every cell is allocated up front so pushing and popping
+never touch the allocator. Each cell carries a sequence number that says if it
+is free for the producer of that lap or filled for the consumer, so producers
+only contend on claiming a position and never on each other's cells.
+
+A push that finds the queue full fails rather than waiting. An item claimed by a
+producer that hasn't finished writing it holds back the items behind it.
+*/
+typedef struct Queue Queue;
+
+// capacity is rounded up to a power of two
+bool queue_new (Queue ** q, const unsigned int capacity);
+void queue_free(Queue ** q);
+
+// any thread: returns false if the queue is full
+bool queue_push(Queue * q, void * data);
+
+// consumer: take or look at the oldest item, false if there is none
+bool queue_pop (Queue * q, void ** data);
+bool queue_peek(Queue * q, void ** data);
+
+// the number of items pushed, or being pushed, and not yet popped
+unsigned int queue_count(Queue * q);
@@ -0,0 +1,337 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "record.h"
+#include "KVMFRRecord.h"
+#include "queue.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+// enough to absorb a burst of full frames while the disk catches up
+#define FRAME_ENTRIES  8
+#define CURSOR_ENTRIES 32
+
+struct RecordEntry
+{
+  Queue  * pool;  // the free queue the entry goes back to once written
+  uint8_t * buffer;
+  size_t   size;
+  size_t   alloc;
+};
+
+/*
+Every entry is allocated up front and is passed around through lock-free queues.
+A producer pops a free entry from a pool, fills it in and pushes it to the
+writer, which writes it out and pushes it back to its pool. A Queue only has one
+consumer, so the frames and the cursor updates, which are recorded by different
+threads, each have their own pool.
+*/
+struct Record
+{
+  volatile bool enabled;
+  bool         failed;
+  FILE       * file;
+  SDL_Thread * thread;
+  SDL_sem    * sem;
+  volatile bool running;
+  uint64_t     startTime;
+
+  struct RecordEntry entries[FRAME_ENTRIES + CURSOR_ENTRIES];
+  Queue            * framePool;
+  Queue            * cursorPool;
+  Queue            * pending;
+
+  // set when a frame was dropped so the next one has to be a full frame
+  bool needFull;
+
+  uint64_t records;
+  uint64_t frames;
+  uint64_t fullFrames;
+  uint64_t dropped;
+  uint64_t bytes;
+};
+
+static struct Record record;
+
+static int record_thread(void * unused)
+{
+  for(;;)
+  {
+    struct RecordEntry * e;
+    if (!queue_pop(record.pending, (void **)&e))
+    {
+      // the queue is drained before the thread exits
+      if (!record.running && !queue_count(record.pending))
+        break;
+
+      SDL_SemWaitTimeout(record.sem, 100);
+      continue;
+    }
+
+    if (!record.failed)
+    {
+      if (fwrite(e->buffer, 1, e->size, record.file) == e->size)
+        record.bytes += e->size;
+      else
+      {
+        DEBUG_ERROR("Failed to write to the recording, recording stopped");
+        record.failed  = true;
+        record.enabled = false;
+      }
+    }
+
+    queue_push(e->pool, e);
+  }
+
+  return 0;
+}
+
+// take a free entry with room for size bytes of payload and fill in the record header
+static struct RecordEntry * record_reserve(Queue * pool, const KVMFRRecordType type, const size_t size)
+{
+  if (!record.enabled)
+    return NULL;
+
+  struct RecordEntry * e;
+  if (!queue_pop(pool, (void **)&e))
+  {
+    __atomic_add_fetch(&record.dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  const size_t total = sizeof(KVMFRRecord) + size;
+  if (total > e->alloc)
+  {
+    uint8_t * buffer = realloc(e->buffer, total);
+    if (!buffer)
+    {
+      DEBUG_ERROR("Failed to allocate %lu bytes for the recording", (unsigned long)total);
+      queue_push(pool, e);
+      return NULL;
+    }
+    e->buffer = buffer;
+    e->alloc  = total;
+  }
+
+  KVMFRRecord * r = (KVMFRRecord *)e->buffer;
+  r->type = type;
+  r->size = size;
+  e->size = total;
+  return e;
+}
+
+static void record_commit(struct RecordEntry * e)
+{
+  // stamped as it is queued so the writer sees the records in time order
+  ((KVMFRRecord *)e->buffer)->time = nanotime() - record.startTime;
+  __atomic_add_fetch(&record.records, 1, __ATOMIC_RELAXED);
+  queue_push(record.pending, e);
+  SDL_SemPost(record.sem);
+}
+
+static void record_free_queues()
+{
+  queue_free(&record.framePool );
+  queue_free(&record.cursorPool);
+  queue_free(&record.pending   );
+}
+
+bool record_init(const char * path)
+{
+  memset(&record, 0, sizeof(record));
+  record.file = fopen(path, "wb");
+  if (!record.file)
+  {
+    DEBUG_ERROR("Failed to open the recording file: %s", path);
+    return false;
+  }
+
+  KVMFRRecordHeader header;
+  memcpy(header.magic, KVMFR_RECORD_MAGIC, sizeof(KVMFR_RECORD_MAGIC));
+  header.version      = KVMFR_RECORD_VERSION;
+  header.kvmfrVersion = KVMFR_HEADER_VERSION;
+  if (fwrite(&header, sizeof(header), 1, record.file) != 1)
+  {
+    DEBUG_ERROR("Failed to write the recording header");
+    fclose(record.file);
+    return false;
+  }
+
+  // the writer's queue can hold every entry so pushing to it never fails
+  if (!queue_new(&record.framePool , FRAME_ENTRIES ) ||
+      !queue_new(&record.cursorPool, CURSOR_ENTRIES) ||
+      !queue_new(&record.pending   , FRAME_ENTRIES + CURSOR_ENTRIES))
+  {
+    record_free_queues();
+    fclose(record.file);
+    return false;
+  }
+
+  for(int i = 0; i < FRAME_ENTRIES + CURSOR_ENTRIES; ++i)
+  {
+    struct RecordEntry * e = &record.entries[i];
+    e->pool = i < FRAME_ENTRIES ? record.framePool : record.cursorPool;
+    queue_push(e->pool, e);
+  }
+
+  record.sem = SDL_CreateSemaphore(0);
+  if (!record.sem)
+  {
+    DEBUG_ERROR("Failed to create the semaphore");
+    record_free_queues();
+    fclose(record.file);
+    return false;
+  }
+
+  record.running = true;
+  if (!(record.thread = SDL_CreateThread(record_thread, "recordThread", NULL)))
+  {
+    DEBUG_ERROR("Failed to create the record thread");
+    SDL_DestroySemaphore(record.sem);
+    record_free_queues();
+    fclose(record.file);
+    return false;
+  }
+
+  record.startTime = nanotime();
+  record.needFull  = true;
+  record.enabled   = true;
+  DEBUG_INFO("Recording to %s", path);
+  return true;
+}
+
+void record_free()
+{
+  if (!record.thread)
+    return;
+
+  record.enabled = false;
+  record.running = false;
+  SDL_SemPost(record.sem);
+  SDL_WaitThread(record.thread, NULL);
+  SDL_DestroySemaphore(record.sem);
+  record_free_queues();
+  fclose(record.file);
+
+  for(int i = 0; i < FRAME_ENTRIES + CURSOR_ENTRIES; ++i)
+    free(record.entries[i].buffer);
+
+  DEBUG_INFO("Records written : %lu", (unsigned long)record.records);
+  DEBUG_INFO("Frames          : %lu (%lu full)", (unsigned long)record.frames, (unsigned long)record.fullFrames);
+  DEBUG_INFO("Records dropped : %lu", (unsigned long)record.dropped);
+  DEBUG_INFO("Bytes written   : %lu", (unsigned long)record.bytes);
+  memset(&record, 0, sizeof(record));
+}
+
+void record_frame(const LG_RendererFormat * format, const uint8_t * data, const size_t dataSize)
+{
+  if (!record.enabled)
+    return;
+
+  // damage can only be stored per row for packed pixel formats
+  const bool full = record.needFull || format->damage.full || format->bpp != 32;
+  const unsigned int damageCount = full ? 0 : format->damage.count;
+
+  size_t payload = dataSize;
+  if (!full)
+  {
+    payload = 0;
+    for(unsigned int i = 0; i < damageCount; ++i)
+      payload += (size_t)format->damage.rects[i].width * format->damage.rects[i].height * 4;
+  }
+
+  struct RecordEntry * e = record_reserve(record.framePool, KVMFR_RECORD_FRAME,
+    sizeof(KVMFRRecordFrame) + damageCount * sizeof(KVMFRRect) + payload);
+  if (!e)
+  {
+    record.needFull = true;
+    return;
+  }
+
+  KVMFRRecordFrame * f = (KVMFRRecordFrame *)(e->buffer + sizeof(KVMFRRecord));
+  f->type        = format->type;
+  f->width       = format->width;
+  f->height      = format->height;
+  f->stride      = format->stride;
+  f->pitch       = format->pitch;
+  f->damageCount = damageCount;
+
+  uint8_t * dst = (uint8_t *)(f + 1);
+  if (full)
+    memcpy(dst, data, dataSize);
+  else
+  {
+    memcpy(dst, format->damage.rects, damageCount * sizeof(KVMFRRect));
+    dst += damageCount * sizeof(KVMFRRect);
+
+    for(unsigned int i = 0; i < damageCount; ++i)
+    {
+      const KVMFRRect * r   = &format->damage.rects[i];
+      const size_t      row = (size_t)r->width * 4;
+      const uint8_t   * src = data + (size_t)r->y * format->pitch + (size_t)r->x * 4;
+      for(unsigned int y = 0; y < r->height; ++y, src += format->pitch, dst += row)
+        memcpy(dst, src, row);
+    }
+  }
+
+  ++record.frames;
+  if (full)
+    ++record.fullFrames;
+
+  record.needFull = false;
+  record_commit(e);
+}
+
+void record_cursor(const uint8_t flags, const CursorType type, const unsigned int width,
+  const unsigned int height, const unsigned int pitch, const uint8_t * data)
+{
+  const size_t dataSize = data ? (size_t)height * pitch : 0;
+  struct RecordEntry * e = record_reserve(record.cursorPool, KVMFR_RECORD_CURSOR, sizeof(KVMFRRecordCursor) + dataSize);
+  if (!e)
+    return;
+
+  KVMFRRecordCursor * c = (KVMFRRecordCursor *)(e->buffer + sizeof(KVMFRRecord));
+  c->flags    = flags;
+  c->type     = type;
+  c->width    = width;
+  c->height   = height;
+  c->pitch    = pitch;
+  c->dataSize = dataSize;
+  if (data)
+    memcpy(c + 1, data, dataSize);
+
+  record_commit(e);
+}
+
+void record_cursor_pos(const int x, const int y)
+{
+  struct RecordEntry * e = record_reserve(record.cursorPool, KVMFR_RECORD_CURSOR_POS, sizeof(KVMFRRecordCursorPos));
+  if (!e)
+    return;
+
+  KVMFRRecordCursorPos * p = (KVMFRRecordCursorPos *)(e->buffer + sizeof(KVMFRRecord));
+  p->x = x;
+  p->y = y;
+  record_commit(e);
+}
@@ -0,0 +1,48 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "KVMFR.h"
+#include "lg-renderer.h"
+
+/*
+Records the frames and cursor updates the client consumes into a file that the
+producer can replay, see KVMFRRecord.h for the format. The callers only copy
+the data into a queue, a background thread does the writing. If the writer
+falls behind records are dropped rather than stalling the caller.
+
+All of the record functions do nothing unless record_init succeeded. Frames must
+all be recorded from one thread, and the cursor updates from one other thread.
+*/
+
+bool record_init(const char * path);
+void record_free();
+
+void record_frame(const LG_RendererFormat * format, const uint8_t * data, const size_t dataSize);
+
+// data is NULL if the shape has not changed since the last call
+void record_cursor(const uint8_t flags, const CursorType type, const unsigned int width,
+  const unsigned int height, const unsigned int pitch, const uint8_t * data);
+
+void record_cursor_pos(const int x, const int y);
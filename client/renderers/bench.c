@@ -0,0 +1,384 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+A renderer without a window or a GPU for exercising the frame pipeline. Frames
+go through the same triple buffer as the real renderers, are decoded with the
+CPU decoders and copied to a staging buffer in place of the texture upload.
+The throughput, drops and time spent in each stage are logged at exit.
+*/
+
+#include "lg-renderer.h"
+#include "lg-decoder.h"
+#include "debug.h"
+#include "utils.h"
+#include "triplebuffer.h"
+#include "MultiMemcpy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern const LG_Decoder LGD_NULL;
+extern const LG_Decoder LGD_YUV420_CPU;
+
+struct Options
+{
+  bool decode;
+  bool upload;
+};
+
+static struct Options defaultOptions =
+{
+  .decode = true,
+  .upload = true
+};
+
+struct Stage
+{
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+};
+
+struct Inst
+{
+  struct Options     opt;
+
+  TripleBuffer     * frameBuffer;
+  uint64_t           frameEvents;
+  uint64_t           firstFrame, lastFrame;
+
+  bool               configured;
+  LG_RendererFormat  format;
+  const LG_Decoder * decoder;
+  void             * decoderData;
+  uint8_t          * staging;
+  size_t             stagingSize;
+  uint64_t           bytes;
+
+  struct Stage       decode;
+  struct Stage       upload;
+  struct Stage       render;
+};
+
+static void stage_record(struct Stage * stage, const uint64_t ns)
+{
+  ++stage->count;
+  stage->total += ns;
+  if (ns > stage->max)
+    stage->max = ns;
+}
+
+static void stage_report(const char * name, const struct Stage * stage)
+{
+  if (!stage->count)
+    return;
+
+  DEBUG_INFO("%-15s : avg %7.3f ms, max %7.3f ms over %lu frames", name,
+    (double)stage->total / stage->count / 1e6, stage->max / 1e6, stage->count);
+}
+
+static void bench_deconfigure(struct Inst * this)
+{
+  if (this->decoderData)
+  {
+    this->decoder->destroy(this->decoderData);
+    this->decoderData = NULL;
+  }
+  this->configured = false;
+}
+
+static bool bench_configure(struct Inst * this, const LG_RendererFormat * format)
+{
+  bench_deconfigure(this);
+  memcpy(&this->format, format, sizeof(LG_RendererFormat));
+
+  switch(format->type)
+  {
+    case FRAME_TYPE_BGRA:
+    case FRAME_TYPE_RGBA:
+    case FRAME_TYPE_RGBA10:
+      this->decoder = &LGD_NULL;
+      break;
+
+    case FRAME_TYPE_YUV420:
+      this->decoder = &LGD_YUV420_CPU;
+      break;
+
+    default:
+      DEBUG_ERROR("Unknown/unsupported compression type");
+      return false;
+  }
+
+  if (!this->decoder->create(&this->decoderData))
+  {
+    DEBUG_ERROR("Failed to create the decoder");
+    return false;
+  }
+
+  if (!this->decoder->initialize(this->decoderData, *format, NULL))
+  {
+    DEBUG_ERROR("Failed to initialize decoder");
+    return false;
+  }
+
+  const size_t size = (size_t)format->height * this->decoder->get_frame_pitch(this->decoderData);
+  if (size > this->stagingSize)
+  {
+    free(this->staging);
+    this->stagingSize = 0;
+    if (posix_memalign((void **)&this->staging, 64, size) != 0)
+    {
+      this->staging = NULL;
+      DEBUG_ERROR("Failed to allocate the staging buffer");
+      return false;
+    }
+    this->stagingSize = size;
+  }
+
+  DEBUG_INFO("Bench format    : %ux%u type %d, decoder %s",
+    format->width, format->height, format->type, this->decoder->name);
+  this->configured = true;
+  return true;
+}
+
+const char * bench_get_name()
+{
+  return "Bench";
+}
+
+bool bench_create(void ** opaque, const LG_RendererParams params)
+{
+  *opaque = malloc(sizeof(struct Inst));
+  if (!*opaque)
+  {
+    DEBUG_INFO("Failed to allocate %lu bytes", sizeof(struct Inst));
+    return false;
+  }
+  memset(*opaque, 0, sizeof(struct Inst));
+
+  struct Inst * this = (struct Inst *)*opaque;
+  memcpy(&this->opt, &defaultOptions, sizeof(struct Options));
+
+  if (!triplebuffer_new(&this->frameBuffer, sizeof(LG_RendererFrameUpdate)))
+    return false;
+
+  return true;
+}
+
+bool bench_initialize(void * opaque, Uint32 * sdlFlags)
+{
+  *sdlFlags = 0;
+  return true;
+}
+
+void bench_deinitialize(void * opaque)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  if (!this)
+    return;
+
+  bench_deconfigure(this);
+
+  if (this->frameBuffer)
+  {
+    LG_RendererFrameDrain(this->frameBuffer);
+
+    const uint64_t dropped  = triplebuffer_dropped(this->frameBuffer);
+    const double   duration = (this->lastFrame - this->firstFrame) / 1e9;
+
+    DEBUG_INFO("Bench frames    : %lu received, %lu rendered, %lu dropped",
+      this->frameEvents, this->render.count, dropped);
+
+    if (this->frameEvents > 1 && duration > 0.0)
+      DEBUG_INFO("Bench throughput: %.1f fps received, %.1f fps rendered, %.1f MB/s",
+        (this->frameEvents - 1) / duration,
+        this->render.count / duration,
+        this->bytes / duration / 1048576.0);
+
+    stage_report("Bench decode"   , &this->decode);
+    stage_report("Bench upload"   , &this->upload);
+    stage_report("Bench render"   , &this->render);
+
+    triplebuffer_free(&this->frameBuffer);
+  }
+
+  free(this->staging);
+  free(this);
+}
+
+void bench_on_resize(void * opaque, const int width, const int height, const LG_RendererRect destRect)
+{
+}
+
+bool bench_on_mouse_shape(void * opaque, const LG_RendererCursor cursor, const int width, const int height, const int pitch, const uint8_t * data)
+{
+  return true;
+}
+
+bool bench_on_mouse_event(void * opaque, const bool visible, const int x, const int y)
+{
+  return true;
+}
+
+bool bench_on_frame_event(void * opaque, const LG_RendererFormat format, const LG_RendererFrame frame)
+{
+  struct Inst * this = (struct Inst *)opaque;
+
+  // the bench copies whole frames so it has no use for the damage
+  LG_RendererFramePublish(this->frameBuffer, NULL, &format, &frame);
+
+  this->lastFrame = nanotime();
+  if (!this->frameEvents++)
+    this->firstFrame = this->lastFrame;
+
+  return true;
+}
+
+void bench_on_alert(void * opaque, const LG_RendererAlert alert, const char * message, bool ** closeFlag)
+{
+  DEBUG_INFO("Alert: %s", message);
+}
+
+bool bench_render_startup(void * opaque, SDL_Window * window)
+{
+  return true;
+}
+
+bool bench_animating(void * opaque)
+{
+  return false;
+}
+
+// decode and copy the frame the way the real renderers would
+static bool bench_frame(struct Inst * this, const LG_RendererFrameUpdate * update)
+{
+  const uint64_t start = nanotime();
+  if (!this->configured ||
+    this->format.type   != update->format.type   ||
+    this->format.width  != update->format.width  ||
+    this->format.height != update->format.height ||
+    this->format.stride != update->format.stride)
+  {
+    if (!bench_configure(this, &update->format))
+      return false;
+  }
+
+  const uint8_t * data = update->frame.data;
+  if (this->opt.decode)
+  {
+    const uint64_t t = nanotime();
+    if (!this->decoder->decode(this->decoderData, data, update->frame.size))
+    {
+      DEBUG_ERROR("decode returned failure");
+      return false;
+    }
+    data = this->decoder->get_buffer(this->decoderData);
+    stage_record(&this->decode, nanotime() - t);
+  }
+
+  // stands in for the copy into the pixel buffer the real renderers do
+  if (this->opt.upload && data)
+  {
+    // an undecoded YUV420 frame is its three planes, not height rows of pitch
+    const size_t size = this->opt.decode ?
+      (size_t)update->format.height * this->decoder->get_frame_pitch(this->decoderData) :
+      update->frame.size;
+
+    const uint64_t t = nanotime();
+    multimemcpy(this->staging, data, size < this->stagingSize ? size : this->stagingSize);
+    stage_record(&this->upload, nanotime() - t);
+    this->bytes += size;
+  }
+
+  stage_record(&this->render, nanotime() - start);
+  LG_RendererFrameUploaded(&update->frame);
+  return true;
+}
+
+bool bench_render(void * opaque, SDL_Window * window)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  LG_RendererFrameUpdate * update = triplebuffer_take(this->frameBuffer);
+  if (!update)
+    return true;
+
+  const bool ok = bench_frame(this, update);
+
+  // the frame has been read so the host can have its slot back
+  LG_RendererFrameRelease(&update->frame);
+  return ok;
+}
+
+void bench_update_fps(void * opaque, const float avgUPS, const float avgFPS)
+{
+}
+
+static void handle_opt_decode(void * opaque, const char *value)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  if (!this)
+    return;
+
+  this->opt.decode = LG_RendererValueToBool(value);
+}
+
+static void handle_opt_upload(void * opaque, const char *value)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  if (!this)
+    return;
+
+  this->opt.upload = LG_RendererValueToBool(value);
+}
+
+static LG_RendererOpt bench_options[] =
+{
+  {
+    .name      = "decode",
+    .desc      = "Run the frames through the CPU decoder [default: enabled]",
+    .validator = LG_RendererValidatorBool,
+    .handler   = handle_opt_decode
+  },
+  {
+    .name      = "upload",
+    .desc      = "Copy each frame to a staging buffer in place of the upload [default: enabled]",
+    .validator = LG_RendererValidatorBool,
+    .handler   = handle_opt_upload
+  }
+};
+
+const LG_Renderer LGR_Bench =
+{
+  .get_name       = bench_get_name,
+  .options        = bench_options,
+  .option_count   = LGR_OPTION_COUNT(bench_options),
+  .create         = bench_create,
+  .initialize     = bench_initialize,
+  .deinitialize   = bench_deinitialize,
+  .on_resize      = bench_on_resize,
+  .on_mouse_shape = bench_on_mouse_shape,
+  .on_mouse_event = bench_on_mouse_event,
+  .on_frame_event = bench_on_frame_event,
+  .on_alert       = bench_on_alert,
+  .render_startup = bench_render_startup,
+  .render         = bench_render,
+  .animating      = bench_animating,
+  .update_fps     = bench_update_fps
+};
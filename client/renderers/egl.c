@@ -67,7 +67,6 @@ struct Inst
   EGL_Alert       * alert;   // the alert display
 
   LG_RendererFormat    format;
-  bool                 sourceChanged;
   uint64_t             waitFadeTime;
   bool                 waitDone;
 
@@ -228,21 +227,18 @@ bool egl_on_mouse_event(void * opaque, const bool visible , const int x, const i
   return true;
 }
 
-bool egl_on_frame_event(void * opaque, const LG_RendererFormat format, const uint8_t * data)
+bool egl_on_frame_event(void * opaque, const LG_RendererFormat format, const LG_RendererFrame frame)
 {
   struct Inst * this = (struct Inst *)opaque;
-  this->sourceChanged = (
-    this->sourceChanged ||
+  if (
     this->format.type   != format.type   ||
     this->format.width  != format.width  ||
     this->format.height != format.height ||
     this->format.pitch  != format.pitch
-  );
-
-  if (this->sourceChanged)
+  )
     memcpy(&this->format, &format, sizeof(LG_RendererFormat));
 
-  if (!egl_desktop_prepare_update(this->desktop, this->sourceChanged, format, data))
+  if (!egl_desktop_prepare_update(this->desktop, format, frame))
   {
     DEBUG_INFO("Failed to prepare to update the desktop");
     return false;
@@ -414,6 +410,14 @@ bool egl_render_startup(void * opaque, SDL_Window * window)
   return true;
 }
 
+bool egl_animating(void * opaque)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  return
+    (this->waitFadeTime && !this->waitDone) ||
+    this->showAlert;
+}
+
 bool egl_render(void * opaque, SDL_Window * window)
 {
   struct Inst * this = (struct Inst *)opaque;
@@ -463,12 +467,11 @@ bool egl_render(void * opaque, SDL_Window * window)
   eglSwapBuffers(this->display, this->surface);
 
   // defer texture uploads until after the flip to avoid stalling
-  if (!egl_desktop_perform_update(this->desktop, this->sourceChanged))
+  if (!egl_desktop_perform_update(this->desktop))
   {
     DEBUG_ERROR("Failed to perform the desktop update");
     return false;
   }
-  this->sourceChanged = false;
 
   return true;
 }
@@ -516,5 +519,6 @@ struct LG_Renderer LGR_EGL =
   .on_alert       = egl_on_alert,
   .render_startup = egl_render_startup,
   .render         = egl_render,
+  .animating      = egl_animating,
   .update_fps     = egl_update_fps
 };
\ No newline at end of file
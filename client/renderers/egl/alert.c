@@ -180,6 +180,7 @@ void egl_alert_free(EGL_Alert ** alert)
   egl_shader_free (&(*alert)->shader  );
   egl_shader_free (&(*alert)->shaderBG);
   egl_model_free  (&(*alert)->model   );
+  LG_LOCK_FREE((*alert)->lock);
 
   free(*alert);
   *alert = NULL;
@@ -20,6 +20,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "desktop.h"
 #include "debug.h"
 #include "utils.h"
+#include "triplebuffer.h"
 
 #include "texture.h"
 #include "shader.h"
@@ -43,10 +44,12 @@ struct EGL_Desktop
 
   // internals
   enum EGL_PixelFormat pixFmt;
-  unsigned int         width, height;
-  unsigned int         pitch;
-  const uint8_t      * data;
-  bool                 update;
+  LG_RendererFormat    format;
+  bool                 hasFormat;
+
+  // frames from the frameThread, only the newest is uploaded
+  TripleBuffer       * updates;
+  LG_RendererDamage    damage; // damage the render thread may not have seen yet
 };
 
 static const char vertex_shader[] = "\
@@ -127,6 +130,10 @@ bool egl_desktop_init(EGL_Desktop ** desktop)
   }
 
   memset(*desktop, 0, sizeof(EGL_Desktop));
+  LG_RendererDamageReset(&(*desktop)->damage, true);
+
+  if (!triplebuffer_new(&(*desktop)->updates, sizeof(LG_RendererFrameUpdate)))
+    return false;
 
   if (!egl_texture_init(&(*desktop)->texture))
   {
@@ -184,83 +191,110 @@ void egl_desktop_free(EGL_Desktop ** desktop)
   egl_shader_free (&(*desktop)->shader_yuv    );
   egl_model_free  (&(*desktop)->model         );
 
+  if ((*desktop)->updates)
+  {
+    LG_RendererFrameDrain((*desktop)->updates);
+    DEBUG_INFO("Frames dropped  : %lu", triplebuffer_dropped((*desktop)->updates));
+    triplebuffer_free(&(*desktop)->updates);
+  }
+
   free(*desktop);
   *desktop = NULL;
 }
 
-bool egl_desktop_prepare_update(EGL_Desktop * desktop, const bool sourceChanged, const LG_RendererFormat format, const uint8_t * data)
+bool egl_desktop_prepare_update(EGL_Desktop * desktop, const LG_RendererFormat format, const LG_RendererFrame frame)
 {
-  if (sourceChanged)
+  LG_RendererFramePublish(desktop->updates, &desktop->damage, &format, &frame);
+  return true;
+}
+
+static bool egl_desktop_set_format(EGL_Desktop * desktop, const LG_RendererFormat * format)
+{
+  switch(format->type)
   {
-    switch(format.type)
-    {
-      case FRAME_TYPE_BGRA:
-        desktop->pixFmt = EGL_PF_BGRA;
-        desktop->shader = desktop->shader_generic;
-        break;
-
-      case FRAME_TYPE_RGBA:
-        desktop->pixFmt = EGL_PF_RGBA;
-        desktop->shader = desktop->shader_generic;
-        break;
-
-      case FRAME_TYPE_RGBA10:
-        desktop->pixFmt = EGL_PF_RGBA10;
-        desktop->shader = desktop->shader_generic;
-        break;
-
-      case FRAME_TYPE_YUV420:
-        desktop->pixFmt = EGL_PF_YUV420;
-        desktop->shader = desktop->shader_yuv;
-        break;
-
-      default:
-        DEBUG_ERROR("Unsupported frame format");
-        return false;
-    }
-
-    desktop->width  = format.width;
-    desktop->height = format.height;
-    desktop->pitch  = format.pitch;
+    case FRAME_TYPE_BGRA:
+      desktop->pixFmt = EGL_PF_BGRA;
+      desktop->shader = desktop->shader_generic;
+      break;
+
+    case FRAME_TYPE_RGBA:
+      desktop->pixFmt = EGL_PF_RGBA;
+      desktop->shader = desktop->shader_generic;
+      break;
+
+    case FRAME_TYPE_RGBA10:
+      desktop->pixFmt = EGL_PF_RGBA10;
+      desktop->shader = desktop->shader_generic;
+      break;
+
+    case FRAME_TYPE_YUV420:
+      desktop->pixFmt = EGL_PF_YUV420;
+      desktop->shader = desktop->shader_yuv;
+      break;
+
+    default:
+      DEBUG_ERROR("Unsupported frame format");
+      return false;
   }
 
-  desktop->data   = data;
-  desktop->update = true;
+  desktop->uDesktopPos = egl_shader_get_uniform_location(desktop->shader, "position");
 
+  if (!egl_texture_setup(
+    desktop->texture,
+    desktop->pixFmt,
+    format->width,
+    format->height,
+    format->pitch,
+    true // streaming texture
+  ))
+  {
+    DEBUG_ERROR("Failed to setup the desktop texture");
+    return false;
+  }
+
+  memcpy(&desktop->format, format, sizeof(LG_RendererFormat));
+  desktop->hasFormat = true;
   return true;
 }
 
-bool egl_desktop_perform_update(EGL_Desktop * desktop, const bool sourceChanged)
+bool egl_desktop_perform_update(EGL_Desktop * desktop)
 {
-  if (sourceChanged)
+  LG_RendererFrameUpdate * update = triplebuffer_take(desktop->updates);
+  if (!update)
+    return true;
+
+  const bool sourceChanged = (
+    !desktop->hasFormat ||
+    desktop->format.type   != update->format.type   ||
+    desktop->format.width  != update->format.width  ||
+    desktop->format.height != update->format.height ||
+    desktop->format.pitch  != update->format.pitch
+  );
+
+  if (sourceChanged && !egl_desktop_set_format(desktop, &update->format))
   {
-    if (desktop->shader)
-      desktop->uDesktopPos = egl_shader_get_uniform_location(desktop->shader, "position");
-
-    if (!egl_texture_setup(
-      desktop->texture,
-      desktop->pixFmt,
-      desktop->width,
-      desktop->height,
-      desktop->pitch,
-      true // streaming texture
-    ))
-    {
-      DEBUG_ERROR("Failed to setup the desktop texture");
-      return false;
-    }
+    LG_RendererFrameRelease(&update->frame);
+    return false;
   }
 
-  if (!desktop->update)
-    return true;
+  const LG_RendererDamage * damage = &update->format.damage;
+  const bool updated = egl_texture_update_rects(
+    desktop->texture,
+    update->frame.data,
+    sourceChanged || damage->full ? NULL : damage->rects,
+    damage->count
+  );
+
+  // the data has been copied into the pixel buffer so the host can have its slot back
+  LG_RendererFrameRelease(&update->frame);
 
-  if (!egl_texture_update(desktop->texture, desktop->data))
+  if (!updated)
   {
     DEBUG_ERROR("Failed to update the desktop texture");
     return false;
   }
 
-  desktop->update = false;
+  LG_RendererFrameUploaded(&update->frame);
   return true;
 }
 
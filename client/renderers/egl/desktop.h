@@ -28,6 +28,8 @@ typedef struct EGL_Desktop EGL_Desktop;
 bool egl_desktop_init(EGL_Desktop ** desktop);
 void egl_desktop_free(EGL_Desktop ** desktop);
 
-bool egl_desktop_prepare_update(EGL_Desktop * desktop, const bool sourceChanged, const LG_RendererFormat format, const uint8_t * data);
-bool egl_desktop_perform_update(EGL_Desktop * desktop, const bool sourceChanged);
+// called by the frameThread, never waits on the render thread
+bool egl_desktop_prepare_update(EGL_Desktop * desktop, const LG_RendererFormat format, const LG_RendererFrame frame);
+// called by the render thread, uploads the newest frame if there is one
+bool egl_desktop_perform_update(EGL_Desktop * desktop);
 void egl_desktop_render(EGL_Desktop * desktop, const float x, const float y, const float scaleX, const float scaleY);
\ No newline at end of file
@@ -23,7 +23,6 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "debug.h"
 #include "utils.h"
-#include "ll.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -32,12 +31,22 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <SDL2/SDL_egl.h>
 
+struct FloatList
+{
+  GLfloat * v;
+  GLfloat * u;
+  size_t    count;
+
+  struct FloatList * next;
+};
+
 struct EGL_Model
 {
-  bool        rebuild;
-  struct ll * verticies;
-  size_t      vertexCount;
-  bool        finish;
+  bool               rebuild;
+  struct FloatList * verticies;
+  struct FloatList * verticiesTail;
+  size_t             vertexCount;
+  bool               finish;
 
   bool    hasBuffer;
   GLuint  buffer;
@@ -46,13 +55,6 @@ struct EGL_Model
   EGL_Texture * texture;
 };
 
-struct FloatList
-{
-  GLfloat * v;
-  GLfloat * u;
-  size_t    count;
-};
-
 void update_uniform_bindings(EGL_Model * model);
 
 bool egl_model_init(EGL_Model ** model)
@@ -65,9 +67,6 @@ bool egl_model_init(EGL_Model ** model)
   }
 
   memset(*model, 0, sizeof(EGL_Model));
-
-  (*model)->verticies = ll_new();
-
   return true;
 }
 
@@ -76,14 +75,15 @@ void egl_model_free(EGL_Model ** model)
   if (!*model)
     return;
 
-  struct FloatList * fl;
-  while(ll_shift((*model)->verticies, (void **)&fl))
+  struct FloatList * fl = (*model)->verticies;
+  while(fl)
   {
+    struct FloatList * next = fl->next;
     free(fl->u);
     free(fl->v);
     free(fl);
+    fl = next;
   }
-  ll_free((*model)->verticies);
 
   if ((*model)->hasBuffer)
     glDeleteBuffers(1, &(*model)->buffer);
@@ -118,6 +118,7 @@ void egl_model_add_verticies(EGL_Model * model, const GLfloat * verticies, const
   struct FloatList * fl = (struct FloatList *)malloc(sizeof(struct FloatList));
 
   fl->count = count;
+  fl->next  = NULL;
   fl->v     = (GLfloat *)malloc(sizeof(GLfloat) * count * 3);
   fl->u     = (GLfloat *)malloc(sizeof(GLfloat) * count * 2);
   memcpy(fl->v, verticies, sizeof(GLfloat) * count * 3);
@@ -127,7 +128,12 @@ void egl_model_add_verticies(EGL_Model * model, const GLfloat * verticies, const
   else
     memset(fl->u, 0  , sizeof(GLfloat) * count * 2);
 
-  ll_push(model->verticies, fl);
+  if (model->verticiesTail)
+    model->verticiesTail->next = fl;
+  else
+    model->verticies = fl;
+  model->verticiesTail = fl;
+
   model->rebuild      = true;
   model->vertexCount += count;
 }
@@ -150,15 +156,14 @@ void egl_model_render(EGL_Model * model)
     GLintptr offset = 0;
 
     /* buffer the verticies */
-    struct FloatList * fl;
-    for(ll_reset(model->verticies); ll_walk(model->verticies, (void **)&fl);)
+    for(struct FloatList * fl = model->verticies; fl; fl = fl->next)
     {
       glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(GLfloat) * fl->count * 3, fl->v);
       offset += sizeof(GLfloat) * fl->count * 3;
     }
 
     /* buffer the uvs */
-    for(ll_reset(model->verticies); ll_walk(model->verticies, (void **)&fl);)
+    for(struct FloatList * fl = model->verticies; fl; fl = fl->next)
     {
       glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(GLfloat) * fl->count * 2, fl->u);
       offset += sizeof(GLfloat) * fl->count * 2;
@@ -183,8 +188,7 @@ void egl_model_render(EGL_Model * model)
 
   /* draw the arrays */
   GLint offset = 0;
-  struct FloatList * fl;
-  for(ll_reset(model->verticies); ll_walk(model->verticies, (void **)&fl);)
+  for(struct FloatList * fl = model->verticies; fl; fl = fl->next)
   {
     glDrawArrays(GL_TRIANGLE_STRIP, offset, fl->count);
     offset += fl->count;
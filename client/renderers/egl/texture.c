@@ -47,6 +47,10 @@ struct EGL_Texture
   int    pboIndex;
   bool   needsUpdate;
   size_t pboBufferSize;
+
+  bool         updateFull;
+  unsigned int rectCount;
+  KVMFRRect    rects[KVMFR_MAX_DAMAGE];
 };
 
 bool egl_texture_init(EGL_Texture ** texture)
@@ -203,6 +207,11 @@ bool egl_texture_setup(EGL_Texture * texture, enum EGL_PixelFormat pixFmt, size_
 }
 
 bool egl_texture_update(EGL_Texture * texture, const uint8_t * buffer)
+{
+  return egl_texture_update_rects(texture, buffer, NULL, 0);
+}
+
+bool egl_texture_update_rects(EGL_Texture * texture, const uint8_t * buffer, const KVMFRRect * rects, unsigned int count)
 {
   if (texture->streaming)
   {
@@ -212,12 +221,34 @@ bool egl_texture_update(EGL_Texture * texture, const uint8_t * buffer)
       return false;
     }
 
+    if (count > KVMFR_MAX_DAMAGE)
+      rects = NULL;
+
     if (++texture->pboIndex == 2)
       texture->pboIndex = 0;
 
     /* initiate the data upload */
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->pbo[texture->pboIndex]);
-    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, texture->pboBufferSize, buffer);
+
+    // planar formats are always updated in full
+    texture->updateFull = !rects || texture->textureCount > 1;
+    if (texture->updateFull)
+      glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, texture->pboBufferSize, buffer);
+    else
+    {
+      /* only the rows that changed need to be in the buffer as bind will only
+       * upload the changed regions to the texture */
+      const size_t pitch = texture->planes[0][2] * 4;
+      for(unsigned int i = 0; i < count; ++i)
+      {
+        const GLintptr offset = rects[i].y * pitch;
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, rects[i].height * pitch, buffer + offset);
+      }
+
+      memcpy(texture->rects, rects, count * sizeof(KVMFRRect));
+      texture->rectCount = count;
+    }
+
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     texture->needsUpdate = true;
   }
@@ -240,12 +271,27 @@ void egl_texture_bind(EGL_Texture * texture)
   if (texture->streaming && texture->needsUpdate)
   {
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->pbo[texture->pboIndex]);
-    for(int i = 0; i < texture->textureCount; ++i)
+    if (texture->updateFull)
     {
-      glBindTexture(GL_TEXTURE_2D, texture->textures[i]);
-      glPixelStorei(GL_UNPACK_ROW_LENGTH, texture->planes[i][2]);
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture->planes[i][0], texture->planes[i][1],
-          texture->format, texture->dataType, (const void *)texture->offsets[i]);
+      for(int i = 0; i < texture->textureCount; ++i)
+      {
+        glBindTexture(GL_TEXTURE_2D, texture->textures[i]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, texture->planes[i][2]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture->planes[i][0], texture->planes[i][1],
+            texture->format, texture->dataType, (const void *)texture->offsets[i]);
+      }
+    }
+    else
+    {
+      const size_t pitch = texture->planes[0][2] * 4;
+      glBindTexture(GL_TEXTURE_2D, texture->textures[0]);
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, texture->planes[0][2]);
+      for(unsigned int i = 0; i < texture->rectCount; ++i)
+      {
+        const KVMFRRect * r = &texture->rects[i];
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->width, r->height,
+            texture->format, texture->dataType, (const void *)(r->y * pitch + r->x * 4));
+      }
     }
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -21,6 +21,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdbool.h>
 #include "shader.h"
+#include "KVMFR.h"
 
 #include <GL/gl.h>
 
@@ -39,5 +40,6 @@ void egl_texture_free(EGL_Texture ** tex);
 
 bool egl_texture_setup (EGL_Texture * texture, enum EGL_PixelFormat pixfmt, size_t width, size_t height, size_t stride, bool streaming);
 bool egl_texture_update(EGL_Texture * texture, const uint8_t * buffer);
+bool egl_texture_update_rects(EGL_Texture * texture, const uint8_t * buffer, const KVMFRRect * rects, unsigned int count);
 void egl_texture_bind          (EGL_Texture * texture);
 int  egl_texture_count         (EGL_Texture * texture);
\ No newline at end of file
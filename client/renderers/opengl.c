@@ -34,7 +34,9 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "utils.h"
 #include "lg-decoders.h"
 #include "lg-fonts.h"
-#include "ll.h"
+#include "queue.h"
+#include "triplebuffer.h"
+#include "MultiMemcpy.h"
 
 #define BUFFER_COUNT       2
 
@@ -47,12 +49,16 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #define FADE_TIME 1000000
 
+// alerts are rare, more than this pending at once are dropped
+#define ALERT_QUEUE_SIZE 16
+
 struct Options
 {
   bool mipmap;
   bool vsync;
   bool preventBuffer;
   bool amdPinnedMem;
+  bool yuvShader;
 };
 
 static struct Options defaultOptions =
@@ -61,6 +67,7 @@ static struct Options defaultOptions =
   .vsync         = true,
   .preventBuffer = true,
   .amdPinnedMem  = true,
+  .yuvShader     = true,
 };
 
 struct Alert
@@ -86,12 +93,12 @@ struct Inst
   SDL_GLContext     glContext;
 
   SDL_Point         window;
-  bool              frameUpdate;
+  TripleBuffer    * frameBuffer;
+  LG_RendererDamage frameDamage; // damage the renderer may not have seen yet
 
   const LG_Font   * font;
   LG_FontObj        fontObj, alertFontObj;
 
-  LG_Lock           formatLock;
   LG_RendererFormat format;
   GLuint            intFormat;
   GLuint            vboFormat;
@@ -104,7 +111,6 @@ struct Inst
   bool              hasBuffers;
   GLuint            vboID[BUFFER_COUNT];
   uint8_t         * texPixels[BUFFER_COUNT];
-  LG_Lock           syncLock;
   bool              texReady;
   int               texIndex;
   int               texList;
@@ -116,8 +122,9 @@ struct Inst
   GLuint            frames[BUFFER_COUNT];
   GLsync            fences[BUFFER_COUNT];
   void            * decoderFrames[BUFFER_COUNT];
+  LG_RendererDamage texDamage[BUFFER_COUNT]; // damage since each texture was updated
   GLuint            textures[TEXTURE_COUNT];
-  struct ll       * alerts;
+  Queue           * alerts;
   int               alertList;
 
   bool              waiting;
@@ -148,7 +155,7 @@ static bool _check_gl_error(unsigned int line, const char * name);
 static void deconfigure(struct Inst * this);
 static bool configure(struct Inst * this, SDL_Window *window);
 static void update_mouse_shape(struct Inst * this, bool * newShape);
-static bool draw_frame(struct Inst * this);
+static bool draw_frame(struct Inst * this, const LG_RendererFrameUpdate * update);
 static void draw_mouse(struct Inst * this);
 static void render_wait(struct Inst * this);
 
@@ -172,9 +179,11 @@ bool opengl_create(void ** opaque, const LG_RendererParams params)
   memcpy(&this->params, &params        , sizeof(LG_RendererParams));
   memcpy(&this->opt   , &defaultOptions, sizeof(struct Options   ));
 
-  LG_LOCK_INIT(this->formatLock);
-  LG_LOCK_INIT(this->syncLock  );
-  LG_LOCK_INIT(this->mouseLock );
+  LG_LOCK_INIT(this->mouseLock);
+
+  if (!triplebuffer_new(&this->frameBuffer, sizeof(LG_RendererFrameUpdate)))
+    return false;
+  LG_RendererDamageReset(&this->frameDamage, true);
 
   this->font = LG_Fonts[0];
   if (!this->font->create(&this->fontObj, NULL, 14))
@@ -189,7 +198,8 @@ bool opengl_create(void ** opaque, const LG_RendererParams params)
     return false;
   }
 
-  this->alerts = ll_new();
+  if (!queue_new(&this->alerts, ALERT_QUEUE_SIZE))
+    return false;
 
   return true;
 }
@@ -240,18 +250,23 @@ void opengl_deinitialize(void * opaque)
     this->glContext = NULL;
   }
 
-  LG_LOCK_FREE(this->formatLock);
-  LG_LOCK_FREE(this->syncLock  );
-  LG_LOCK_FREE(this->mouseLock );
+  LG_LOCK_FREE(this->mouseLock);
+
+  if (this->frameBuffer)
+  {
+    LG_RendererFrameDrain(this->frameBuffer);
+    DEBUG_INFO("Frames dropped  : %lu", triplebuffer_dropped(this->frameBuffer));
+    triplebuffer_free(&this->frameBuffer);
+  }
 
   struct Alert * alert;
-  while(ll_shift(this->alerts, (void **)&alert))
+  while(this->alerts && queue_pop(this->alerts, (void **)&alert))
   {
     if (alert->text)
       this->font->release(this->alertFontObj, alert->text);
     free(alert);
   }
-  ll_free(this->alerts);
+  queue_free(&this->alerts);
 
   if (this->font && this->fontObj)
     this->font->destroy(this->fontObj);
@@ -333,7 +348,7 @@ bool opengl_on_mouse_event(void * opaque, const bool visible, const int x, const
   return false;
 }
 
-bool opengl_on_frame_event(void * opaque, const LG_RendererFormat format, const uint8_t * data)
+bool opengl_on_frame_event(void * opaque, const LG_RendererFormat format, const LG_RendererFrame frame)
 {
   struct Inst * this = (struct Inst *)opaque;
   if (!this)
@@ -342,37 +357,7 @@ bool opengl_on_frame_event(void * opaque, const LG_RendererFormat format, const
     return false;
   }
 
-  LG_LOCK(this->formatLock);
-  if (this->reconfigure)
-  {
-    LG_UNLOCK(this->formatLock);
-    return true;
-  }
-
-  if (!this->configured ||
-    this->format.type   != format.type   ||
-    this->format.width  != format.width  ||
-    this->format.height != format.height ||
-    this->format.stride != format.stride ||
-    this->format.bpp    != format.bpp
-  )
-  {
-    memcpy(&this->format, &format, sizeof(LG_RendererFormat));
-    this->reconfigure = true;
-    LG_UNLOCK(this->formatLock);
-    return true;
-  }
-  LG_UNLOCK(this->formatLock);
-
-  LG_LOCK(this->syncLock);
-  if (!this->decoder->decode(this->decoderData, data, format.pitch))
-  {
-    DEBUG_ERROR("decode returned failure");
-    LG_UNLOCK(this->syncLock);
-    return false;
-  }
-  this->frameUpdate = true;
-  LG_UNLOCK(this->syncLock);
+  LG_RendererFramePublish(this->frameBuffer, &this->frameDamage, &format, &frame);
 
   if (this->waiting)
   {
@@ -427,13 +412,18 @@ void opengl_on_alert(void * opaque, const LG_RendererAlert alert, const char * m
     return;
   }
 
-  if (closeFlag)
+  // the caller must only get the close flag if the alert was actually queued
+  a->useCloseFlag = closeFlag != NULL;
+  if (!queue_push(this->alerts, a))
   {
-    a->useCloseFlag = true;
-    *closeFlag = &a->closeFlag;
+    DEBUG_WARN("Too many alerts are queued, dropping: %s", message);
+    this->font->release(this->alertFontObj, a->text);
+    free(a);
+    return;
   }
 
-  ll_push(this->alerts, a);
+  if (closeFlag)
+    *closeFlag = &a->closeFlag;
 }
 
 void bitmap_to_texture(LG_FontBitmap * bitmap, GLuint texture)
@@ -509,10 +499,7 @@ bool opengl_render_startup(void * opaque, SDL_Window * window)
   // create the overlay textures
   glGenTextures(TEXTURE_COUNT, this->textures);
   if (check_gl_error("glGenTextures"))
-  {
-    LG_UNLOCK(this->formatLock);
     return false;
-  }
   this->hasTextures = true;
 
   SDL_GL_SetSwapInterval(this->opt.vsync ? 1 : 0);
@@ -520,15 +507,49 @@ bool opengl_render_startup(void * opaque, SDL_Window * window)
   return true;
 }
 
+bool opengl_animating(void * opaque)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  if (!this)
+    return false;
+
+  // the splash fading out and alerts timing out are the only animations
+  void * alert;
+  return
+    (!this->waiting && !this->waitDone) ||
+    queue_peek(this->alerts, &alert);
+}
+
 bool opengl_render(void * opaque, SDL_Window * window)
 {
   struct Inst * this = (struct Inst *)opaque;
   if (!this)
     return false;
 
-  if (configure(this, window))
-    if (!draw_frame(this))
-      return false;
+  // only the newest frame is drawn, any published since the last render are dropped
+  LG_RendererFrameUpdate * update = triplebuffer_take(this->frameBuffer);
+  if (update && (
+    !this->configured ||
+    this->format.type   != update->format.type   ||
+    this->format.width  != update->format.width  ||
+    this->format.height != update->format.height ||
+    this->format.stride != update->format.stride ||
+    this->format.bpp    != update->format.bpp))
+  {
+    memcpy(&this->format, &update->format, sizeof(LG_RendererFormat));
+    this->reconfigure = true;
+  }
+
+  bool drawn = true;
+  if (configure(this, window) && update)
+    drawn = draw_frame(this, update);
+
+  // the frame has been uploaded so the host can have its slot back
+  if (update)
+    LG_RendererFrameRelease(&update->frame);
+
+  if (!drawn)
+    return false;
 
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT);
@@ -550,7 +571,7 @@ bool opengl_render(void * opaque, SDL_Window * window)
     glCallList(this->fpsList);
 
   struct Alert * alert;
-  while(ll_peek_head(this->alerts, (void **)&alert))
+  while(queue_peek(this->alerts, (void **)&alert))
   {
     if (!alert->ready)
     {
@@ -603,7 +624,7 @@ bool opengl_render(void * opaque, SDL_Window * window)
       if (close)
       {
         free(alert);
-        ll_shift(this->alerts, NULL);
+        queue_pop(this->alerts, NULL);
         continue;
       }
     }
@@ -812,6 +833,15 @@ static void handle_opt_amd_pinned_mem(void * opaque, const char *value)
   this->opt.amdPinnedMem = LG_RendererValueToBool(value);
 }
 
+static void handle_opt_yuv_shader(void * opaque, const char *value)
+{
+  struct Inst * this = (struct Inst *)opaque;
+  if (!this)
+    return;
+
+  this->opt.yuvShader = LG_RendererValueToBool(value);
+}
+
 
 static LG_RendererOpt opengl_options[] =
 {
@@ -838,6 +868,12 @@ static LG_RendererOpt opengl_options[] =
     .desc      = "Use GL_AMD_pinned_memory if it is available [default: enabled]",
     .validator = LG_RendererValidatorBool,
     .handler   = handle_opt_amd_pinned_mem
+  },
+  {
+    .name      = "yuvShader",
+    .desc      = "Convert YUV420 frames on the GPU [default: enabled]",
+    .validator = LG_RendererValidatorBool,
+    .handler   = handle_opt_yuv_shader
   }
 };
 
@@ -856,6 +892,7 @@ const LG_Renderer LGR_OpenGL =
   .on_alert       = opengl_on_alert,
   .render_startup = opengl_render_startup,
   .render         = opengl_render,
+  .animating      = opengl_animating,
   .update_fps     = opengl_update_fps
 };
 
@@ -872,12 +909,8 @@ static bool _check_gl_error(unsigned int line, const char * name)
 
 static bool configure(struct Inst * this, SDL_Window *window)
 {
-  LG_LOCK(this->formatLock);
   if (!this->reconfigure)
-  {
-    LG_UNLOCK(this->formatLock);
     return this->configured;
-  }
 
   if (this->configured)
     deconfigure(this);
@@ -891,7 +924,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
       break;
 
     case FRAME_TYPE_YUV420:
-      this->decoder = &LGD_YUV420;
+      this->decoder = this->opt.yuvShader ? &LGD_YUV420 : &LGD_YUV420_CPU;
       break;
 
     default:
@@ -945,7 +978,6 @@ static bool configure(struct Inst * this, SDL_Window *window)
 
     default:
       DEBUG_ERROR("Format not supported");
-      LG_UNLOCK(this->formatLock);
       return false;
   }
 
@@ -959,10 +991,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
   {
     glGenBuffers(BUFFER_COUNT, this->vboID);
     if (check_gl_error("glGenBuffers"))
-    {
-      LG_UNLOCK(this->formatLock);
       return false;
-    }
     this->hasBuffers = true;
 
     if (this->amdPinnedMemSupport)
@@ -978,10 +1007,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
         glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, this->vboID[i]);
 
         if (check_gl_error("glBindBuffer"))
-        {
-          LG_UNLOCK(this->formatLock);
           return false;
-        }
         glBufferData(
           GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD,
           this->texSize,
@@ -989,10 +1015,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
           GL_STREAM_DRAW);
 
         if (check_gl_error("glBufferData"))
-        {
-          LG_UNLOCK(this->formatLock);
           return false;
-        }
       }
       glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0);
     }
@@ -1002,10 +1025,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
       {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->vboID[i]);
         if (check_gl_error("glBindBuffer"))
-        {
-          LG_UNLOCK(this->formatLock);
           return false;
-        }
 
         glBufferData(
           GL_PIXEL_UNPACK_BUFFER,
@@ -1014,10 +1034,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
           GL_STREAM_DRAW
         );
         if (check_gl_error("glBufferData"))
-        {
-          LG_UNLOCK(this->formatLock);
           return false;
-        }
       }
       glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
@@ -1026,10 +1043,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
   // create the frame textures
   glGenTextures(BUFFER_COUNT, this->frames);
   if (check_gl_error("glGenTextures"))
-  {
-    LG_UNLOCK(this->formatLock);
     return false;
-  }
   this->hasFrames = true;
 
   for(int i = 0; i < BUFFER_COUNT; ++i)
@@ -1037,10 +1051,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
     // bind and create the new texture
     glBindTexture(GL_TEXTURE_2D, this->frames[i]);
     if (check_gl_error("glBindTexture"))
-    {
-      LG_UNLOCK(this->formatLock);
       return false;
-    }
 
     glTexImage2D(
       GL_TEXTURE_2D,
@@ -1054,10 +1065,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
       (void*)0
     );
     if (check_gl_error("glTexImage2D"))
-    {
-      LG_UNLOCK(this->formatLock);
       return false;
-    }
 
     if (this->decoder->has_gl)
     {
@@ -1066,10 +1074,7 @@ static bool configure(struct Inst * this, SDL_Window *window)
         GL_TEXTURE_2D,
         this->frames[i],
         &this->decoderFrames[i]))
-      {
-        LG_UNLOCK(this->formatLock);
         return false;
-      }
     }
     else
     {
@@ -1097,11 +1102,13 @@ static bool configure(struct Inst * this, SDL_Window *window)
   glBindTexture(GL_TEXTURE_2D, 0);
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
+  // the new textures have no content yet
+  for(int i = 0; i < BUFFER_COUNT; ++i)
+    LG_RendererDamageReset(&this->texDamage[i], true);
+
   this->drawStart   = nanotime();
   this->configured  = true;
   this->reconfigure = false;
-
-  LG_UNLOCK(this->formatLock);
   return true;
 }
 
@@ -1313,22 +1320,24 @@ static void update_mouse_shape(struct Inst * this, bool * newShape)
   LG_UNLOCK(this->mouseLock);
 }
 
-static bool draw_frame(struct Inst * this)
+static bool draw_frame(struct Inst * this, const LG_RendererFrameUpdate * update)
 {
-  LG_LOCK(this->syncLock);
-  if (!this->frameUpdate)
+  if (!this->decoder->decode(this->decoderData, update->frame.data, update->frame.size))
   {
-    LG_UNLOCK(this->syncLock);
-    return true;
+    DEBUG_ERROR("decode returned failure");
+    return false;
   }
 
+  for(int i = 0; i < BUFFER_COUNT; ++i)
+    LG_RendererDamageMerge(&this->texDamage[i], &update->format.damage);
+
   if (++this->texIndex == BUFFER_COUNT)
     this->texIndex = 0;
 
-  this->frameUpdate = false;
-  LG_UNLOCK(this->syncLock);
+  LG_RendererDamage damage;
+  memcpy(&damage, &this->texDamage[this->texIndex], sizeof(LG_RendererDamage));
+  LG_RendererDamageReset(&this->texDamage[this->texIndex], false);
 
-  LG_LOCK(this->formatLock);
   if (this->decoder->has_gl)
   {
     if (!this->decoder->update_gl_texture(
@@ -1336,7 +1345,6 @@ static bool draw_frame(struct Inst * this)
       this->decoderFrames[this->texIndex]
     ))
     {
-      LG_UNLOCK(this->formatLock);
       DEBUG_ERROR("Failed to update the texture from the decoder");
       return false;
     }
@@ -1370,7 +1378,6 @@ static bool draw_frame(struct Inst * this)
     const uint8_t * data = this->decoder->get_buffer(this->decoderData);
     if (!data)
     {
-      LG_UNLOCK(this->formatLock);
       DEBUG_ERROR("Failed to get the buffer from the decoder");
       return false;
     }
@@ -1378,37 +1385,87 @@ static bool draw_frame(struct Inst * this)
     glBindTexture(GL_TEXTURE_2D, this->frames[this->texIndex]);
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->vboID[this->texIndex]);
 
+    const unsigned int stride = this->decoder->get_frame_stride(this->decoderData);
     glPixelStorei(GL_UNPACK_ALIGNMENT  , 4);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH ,
-      this->decoder->get_frame_stride(this->decoderData)
-    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH , stride);
 
-    // update the buffer, this performs a DMA transfer if possible
-    glBufferSubData(
-      GL_PIXEL_UNPACK_BUFFER,
-      0,
-      this->texSize,
-      data
-    );
-    check_gl_error("glBufferSubData");
-
-    // update the texture
-    glTexSubImage2D(
-      GL_TEXTURE_2D,
-      0,
-      0,
-      0,
-      this->format.width ,
-      this->format.height,
-      this->vboFormat,
-      this->dataFormat,
-      (void*)0
-    );
-    if (check_gl_error("glTexSubImage2D"))
+    if (damage.full)
     {
-      DEBUG_ERROR("texIndex: %u, width: %u, height: %u, vboFormat: %x, texSize: %lu",
-        this->texIndex, this->format.width, this->format.height, this->vboFormat, this->texSize
+      /* the fence above means the GPU is done with this buffer, so it can be
+       * mapped without a sync and filled by the copy threads */
+      void * map = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER,
+        0,
+        this->texSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT
       );
+
+      if (map)
+      {
+        multimemcpy(map, data, this->texSize);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+      else
+      {
+        // update the buffer, this performs a DMA transfer if possible
+        glBufferSubData(
+          GL_PIXEL_UNPACK_BUFFER,
+          0,
+          this->texSize,
+          data
+        );
+      }
+      check_gl_error("glBufferSubData");
+
+      // update the texture
+      glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        this->format.width ,
+        this->format.height,
+        this->vboFormat,
+        this->dataFormat,
+        (void*)0
+      );
+      if (check_gl_error("glTexSubImage2D"))
+      {
+        DEBUG_ERROR("texIndex: %u, width: %u, height: %u, vboFormat: %x, texSize: %lu",
+          this->texIndex, this->format.width, this->format.height, this->vboFormat, this->texSize
+        );
+      }
+    }
+    else
+    {
+      /* only transfer the rows that changed and upload just the changed
+       * regions from them, the rest of the texture is still valid */
+      const size_t pitch = this->decoder->get_frame_pitch(this->decoderData);
+      const size_t bpp   = pitch / stride;
+      for(unsigned int i = 0; i < damage.count; ++i)
+      {
+        const KVMFRRect * r      = &damage.rects[i];
+        const GLintptr    offset = r->y * pitch;
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, r->height * pitch, data + offset);
+      }
+      check_gl_error("glBufferSubData");
+
+      for(unsigned int i = 0; i < damage.count; ++i)
+      {
+        const KVMFRRect * r = &damage.rects[i];
+        glTexSubImage2D(
+          GL_TEXTURE_2D,
+          0,
+          r->x,
+          r->y,
+          r->width,
+          r->height,
+          this->vboFormat,
+          this->dataFormat,
+          (void*)(r->y * pitch + r->x * bpp)
+        );
+      }
+      check_gl_error("glTexSubImage2D");
     }
 
     // set a fence so we don't overwrite a buffer in use
@@ -1419,6 +1476,8 @@ static bool draw_frame(struct Inst * this)
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   }
 
+  LG_RendererFrameUploaded(&update->frame);
+
   const bool mipmap = this->opt.mipmap && (
     (this->format.width  > this->destRect.w) ||
     (this->format.height > this->destRect.h));
@@ -1437,7 +1496,6 @@ static bool draw_frame(struct Inst * this)
   }
   glBindTexture(GL_TEXTURE_2D, 0);
 
-  LG_UNLOCK(this->formatLock);
   this->texReady = true;
   return true;
 }
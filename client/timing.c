@@ -0,0 +1,167 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "timing.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+  #include <cpuid.h>
+#endif
+
+// how often the anchor is moved back onto CLOCK_MONOTONIC
+#define ANCHOR_INTERVAL 1000000000ULL
+
+// the most the rate is steered away from the calibrated one, NTP slews at 500ppm
+#define MAX_SLEW_PPM 1000
+
+// further than this behind CLOCK_MONOTONIC and the clock steps forward instead
+#define MAX_STEER_NS 1000000ULL
+
+#define CALIBRATE_NS 20000000ULL
+
+TimingClock timing_clock;
+
+#if defined(__x86_64__)
+static uint64_t timing_nominal;
+
+// the TSC is only usable if it runs at a constant rate through every power
+// state and the kernel found it synchronised across the cores
+static bool timing_tsc_usable()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+  {
+    DEBUG_INFO("The CPU does not have an invariant TSC");
+    return false;
+  }
+
+  FILE * fp = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+  if (!fp)
+    return false;
+
+  char source[32] = { 0 };
+  const bool tsc = fgets(source, sizeof(source), fp) && strcmp(source, "tsc\n") == 0;
+  fclose(fp);
+
+  if (!tsc)
+    DEBUG_INFO("The kernel is not using the TSC as its clocksource");
+
+  return tsc;
+}
+
+// read CLOCK_MONOTONIC and the TSC as close together as we can
+static void timing_sample(uint64_t * tsc, uint64_t * ns)
+{
+  *tsc = 0;
+  *ns  = 0;
+
+  uint64_t best = UINT64_MAX;
+  for(int i = 0; i < 5; ++i)
+  {
+    const uint64_t start = __rdtsc();
+    const uint64_t now   = timing_monotonic();
+    const uint64_t end   = __rdtsc();
+    if (end - start < best)
+    {
+      best = end - start;
+      *tsc = start + (end - start) / 2;
+      *ns  = now;
+    }
+  }
+}
+
+void timing_anchor(const uint32_t seq)
+{
+  uint32_t expected = seq;
+  if (!__atomic_compare_exchange_n(&timing_clock.seq, &expected, seq + 1, false,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+
+  uint64_t tsc, now;
+  timing_sample(&tsc, &now);
+
+  // carry on from where the clock is so it stays continuous
+  const int64_t delta = tsc - timing_clock.tscBase;
+  uint64_t current = timing_clock.nsBase + (delta < 0 ? 0 :
+    (uint64_t)(((unsigned __int128)delta * timing_clock.mult) >> 32));
+
+  if (now > current + MAX_STEER_NS)
+    current = now;
+
+  // aim to meet CLOCK_MONOTONIC at the next anchor
+  const uint64_t slew   = timing_nominal * MAX_SLEW_PPM / 1000000;
+  const uint64_t target = now + ANCHOR_INTERVAL;
+  uint64_t mult = timing_nominal - slew;
+  if (target > current)
+  {
+    mult = (uint64_t)(((unsigned __int128)(target - current) << 32) / timing_clock.limit);
+    if (mult < timing_nominal - slew)
+      mult = timing_nominal - slew;
+    else if (mult > timing_nominal + slew)
+      mult = timing_nominal + slew;
+  }
+
+  timing_clock.tscBase = tsc;
+  timing_clock.nsBase  = current;
+  timing_clock.mult    = mult;
+  __atomic_store_n(&timing_clock.seq, seq + 2, __ATOMIC_RELEASE);
+}
+#else
+void timing_anchor(const uint32_t seq)
+{
+}
+#endif
+
+void timing_init()
+{
+#if defined(__x86_64__)
+  if (timing_clock.tsc || !timing_tsc_usable())
+  {
+    DEBUG_INFO("Clock source    : CLOCK_MONOTONIC");
+    return;
+  }
+
+  uint64_t tsc0, ns0, tsc1, ns1;
+  timing_sample(&tsc0, &ns0);
+  const struct timespec ts = { .tv_nsec = CALIBRATE_NS };
+  nanosleep(&ts, NULL);
+  timing_sample(&tsc1, &ns1);
+
+  if (tsc1 <= tsc0 || ns1 <= ns0)
+  {
+    DEBUG_WARN("The TSC did not advance while calibrating, using CLOCK_MONOTONIC");
+    return;
+  }
+
+  const uint64_t ticks = tsc1 - tsc0;
+  timing_nominal       = (uint64_t)(((unsigned __int128)(ns1 - ns0) << 32) / ticks);
+  timing_clock.mult    = timing_nominal;
+  timing_clock.tscBase = tsc1;
+  timing_clock.nsBase  = ns1;
+  timing_clock.limit   = (uint64_t)((unsigned __int128)ticks * ANCHOR_INTERVAL / (ns1 - ns0));
+  __atomic_store_n(&timing_clock.tsc, true, __ATOMIC_RELEASE);
+
+  DEBUG_INFO("Clock source    : TSC (%.3f MHz)", ticks * 1e3 / (ns1 - ns0));
+#else
+  DEBUG_INFO("Clock source    : CLOCK_MONOTONIC");
+#endif
+}
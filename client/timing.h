@@ -0,0 +1,93 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__)
+  #include <x86intrin.h>
+#endif
+
+/*
+The clock behind nanotime and microtime. Where the CPU has an invariant TSC
+that the kernel also trusts as its clocksource, a timestamp is a TSC read and a
+multiply with no syscall. The TSC is anchored to CLOCK_MONOTONIC so the times
+can be compared with the host's and used for absolute sleeps, and the anchor is
+moved once a second, steering the rate so the clock follows any NTP slewing of
+CLOCK_MONOTONIC without ever going backwards. Everywhere else, and until
+timing_init is called, CLOCK_MONOTONIC is read directly.
+
+The anchor is published with a sequence count that is odd while it is being
+moved, so readers never take a lock.
+*/
+
+typedef struct TimingClock
+{
+  volatile uint32_t seq;
+  volatile bool     tsc;     // set once the TSC has been calibrated
+  uint64_t          tscBase;
+  uint64_t          nsBase;
+  uint64_t          mult;    // nanoseconds per tick, 32.32 fixed point
+  uint64_t          limit;   // ticks past the base before the anchor is moved
+}
+TimingClock;
+
+extern TimingClock timing_clock;
+
+// calibrate the TSC, must be called before any threads are started
+void timing_init();
+
+// the slow path of timing_ns, moves the anchor if no other thread is
+void timing_anchor(const uint32_t seq);
+
+static inline uint64_t timing_monotonic()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return ((uint64_t)time.tv_sec * 1000000000ULL) + time.tv_nsec;
+}
+
+static inline uint64_t timing_ns()
+{
+#if defined(__x86_64__)
+  if (timing_clock.tsc)
+    for(;;)
+    {
+      const uint32_t seq   = __atomic_load_n(&timing_clock.seq, __ATOMIC_ACQUIRE);
+      const int64_t  delta = __rdtsc() - timing_clock.tscBase;
+      const uint64_t ns    = timing_clock.nsBase + (delta < 0 ? 0 :
+        (uint64_t)(((unsigned __int128)delta * timing_clock.mult) >> 32));
+      const bool     stale = delta > 0 && (uint64_t)delta > timing_clock.limit;
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if ((seq & 1) || __atomic_load_n(&timing_clock.seq, __ATOMIC_RELAXED) != seq)
+        continue;
+
+      if (!stale)
+        return ns;
+
+      timing_anchor(seq);
+    }
+#endif
+
+  return timing_monotonic();
+}
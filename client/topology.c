@@ -0,0 +1,296 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+
+#include "topology.h"
+#include "debug.h"
+
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+struct ThreadConfig
+{
+  bool      hasCPUs;
+  cpu_set_t cpus;
+  bool      hasPolicy;
+  int       policy;
+  int       priority;
+};
+
+struct Topology
+{
+  bool                hasExclude;
+  cpu_set_t           exclude;
+  struct ThreadConfig threads[TOPOLOGY_THREAD_COUNT];
+};
+
+static struct Topology topology;
+
+const char * topology_keys[TOPOLOGY_THREAD_COUNT] =
+{
+  "frameThread",
+  "renderThread",
+  "cursorThread",
+  "spiceThread"
+};
+
+static const char * topology_names[TOPOLOGY_THREAD_COUNT] =
+{
+  "frame",
+  "render",
+  "cursor",
+  "spice"
+};
+
+static const struct
+{
+  const char * name;
+  int          policy;
+}
+topology_policies[] =
+{
+  { "other", SCHED_OTHER },
+  { "batch", SCHED_BATCH },
+  { "fifo" , SCHED_FIFO  },
+  { "rr"   , SCHED_RR    }
+};
+
+// parse a list of CPUs like "0,2-3" up to the end or the first ':'
+static bool parse_cpus(const char * str, cpu_set_t * set)
+{
+  CPU_ZERO(set);
+  const char * p = str;
+  while(*p && *p != ':')
+  {
+    char * end;
+    const long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p)
+      return false;
+
+    if (*end == '-')
+    {
+      p    = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p)
+        return false;
+    }
+
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+
+    for(long i = first; i <= last; ++i)
+      CPU_SET(i, set);
+
+    p = end;
+    if (*p == ',')
+      ++p;
+    else if (*p && *p != ':')
+      return false;
+  }
+
+  return CPU_COUNT(set) > 0;
+}
+
+static void format_cpus(const cpu_set_t * set, char * buffer, const size_t size)
+{
+  size_t len = 0;
+  buffer[0] = '\0';
+  for(int i = 0; i < CPU_SETSIZE && len < size; ++i)
+  {
+    if (!CPU_ISSET(i, set))
+      continue;
+
+    int last = i;
+    while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+      ++last;
+
+    if (last == i)
+      len += snprintf(buffer + len, size - len, "%s%d", len ? "," : "", i);
+    else
+      len += snprintf(buffer + len, size - len, "%s%d-%d", len ? "," : "", i, last);
+    i = last;
+  }
+}
+
+bool topology_set_thread(const TopologyThread thread, const char * spec)
+{
+  struct ThreadConfig * c = &topology.threads[thread];
+  memset(c, 0, sizeof(*c));
+
+  if (!parse_cpus(spec, &c->cpus))
+  {
+    DEBUG_ERROR("Invalid CPU list for the %s thread: %s", topology_names[thread], spec);
+    return false;
+  }
+  c->hasCPUs = true;
+
+  const char * policy = strchr(spec, ':');
+  if (!policy)
+    return true;
+  ++policy;
+
+  const char * priority = strchr(policy, ':');
+  const size_t len      = priority ? (size_t)(priority - policy) : strlen(policy);
+  for(unsigned int i = 0; i < sizeof(topology_policies) / sizeof(*topology_policies); ++i)
+    if (strlen(topology_policies[i].name) == len &&
+        strncasecmp(policy, topology_policies[i].name, len) == 0)
+    {
+      c->policy    = topology_policies[i].policy;
+      c->hasPolicy = true;
+      break;
+    }
+
+  if (!c->hasPolicy)
+  {
+    DEBUG_ERROR("Invalid scheduling policy for the %s thread: %s", topology_names[thread], policy);
+    return false;
+  }
+
+  if (c->policy == SCHED_FIFO || c->policy == SCHED_RR)
+  {
+    const int min = sched_get_priority_min(c->policy);
+    const int max = sched_get_priority_max(c->policy);
+    c->priority = priority ? atoi(priority + 1) : min;
+    if (c->priority < min || c->priority > max)
+    {
+      DEBUG_ERROR("The %s thread priority must be between %d and %d", topology_names[thread], min, max);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool topology_set_exclude(const char * cpus)
+{
+  if (!parse_cpus(cpus, &topology.exclude))
+  {
+    DEBUG_ERROR("Invalid CPU list to exclude: %s", cpus);
+    return false;
+  }
+
+  topology.hasExclude = true;
+  return true;
+}
+
+bool topology_parse(const char * arg)
+{
+  const char * spec = strchr(arg, '=');
+  if (spec)
+    for(int i = 0; i < TOPOLOGY_THREAD_COUNT; ++i)
+      if (strlen(topology_names[i]) == (size_t)(spec - arg) &&
+          strncasecmp(arg, topology_names[i], spec - arg) == 0)
+        return topology_set_thread(i, spec + 1);
+
+  DEBUG_ERROR("Invalid thread configuration, expected NAME=CPUS[:POLICY[:PRIORITY]]: %s", arg);
+  return false;
+}
+
+bool topology_init()
+{
+  if (!topology.hasExclude)
+    return true;
+
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+  {
+    DEBUG_ERROR("Failed to get the CPU affinity");
+    return false;
+  }
+
+  cpu_set_t allowed;
+  CPU_XOR(&allowed, &set, &topology.exclude);
+  CPU_AND(&allowed, &allowed, &set);
+  if (CPU_COUNT(&allowed) == 0)
+  {
+    DEBUG_ERROR("Excluding the CPUs leaves none to run on");
+    return false;
+  }
+
+  if (sched_setaffinity(0, sizeof(allowed), &allowed) != 0)
+  {
+    DEBUG_ERROR("Failed to set the CPU affinity: %s", strerror(errno));
+    return false;
+  }
+
+  char cpus[256];
+  format_cpus(&allowed, cpus, sizeof(cpus));
+  DEBUG_INFO("Process CPUs    : %s", cpus);
+  return true;
+}
+
+bool topology_apply(const TopologyThread thread)
+{
+  const struct ThreadConfig * c = &topology.threads[thread];
+  const pthread_t self = pthread_self();
+
+  if (c->hasCPUs)
+  {
+    if (topology.hasExclude)
+    {
+      cpu_set_t overlap;
+      CPU_AND(&overlap, &c->cpus, &topology.exclude);
+      if (CPU_COUNT(&overlap))
+        DEBUG_WARN("The %s thread was given excluded CPUs", topology_names[thread]);
+    }
+
+    if (pthread_setaffinity_np(self, sizeof(c->cpus), &c->cpus) != 0)
+      DEBUG_WARN("Failed to set the %s thread CPU affinity", topology_names[thread]);
+  }
+
+  bool applied = false;
+  if (c->hasPolicy)
+  {
+    const struct sched_param param = { .sched_priority = c->priority };
+    const int err = pthread_setschedparam(self, c->policy, &param);
+    if (err == 0)
+      applied = true;
+    else if (err == EPERM)
+      DEBUG_WARN("Not permitted to set the %s thread policy, see RLIMIT_RTPRIO or CAP_SYS_NICE",
+        topology_names[thread]);
+    else
+      DEBUG_WARN("Failed to set the %s thread policy: %s", topology_names[thread], strerror(err));
+  }
+
+  // report what the thread actually ended up with
+  cpu_set_t set;
+  char cpus[256] = "unknown";
+  if (pthread_getaffinity_np(self, sizeof(set), &set) == 0)
+    format_cpus(&set, cpus, sizeof(cpus));
+
+  int policy;
+  struct sched_param param = { 0 };
+  const char * policyName = "unknown";
+  if (pthread_getschedparam(self, &policy, &param) == 0)
+    for(unsigned int i = 0; i < sizeof(topology_policies) / sizeof(*topology_policies); ++i)
+      if (topology_policies[i].policy == policy)
+        policyName = topology_policies[i].name;
+
+  DEBUG_INFO("%-6s thread   : CPUs %s, %s %d", topology_names[thread], cpus, policyName, param.sched_priority);
+  return applied;
+}
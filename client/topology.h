@@ -0,0 +1,61 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+/*
+Where the client's threads run and how they are scheduled. When the guest runs
+on the same machine its vCPU threads compete with ours, so the vCPU cores can
+be excluded from the whole process and each thread can be given its own cores
+and a real time policy.
+
+A thread is configured with "CPUS[:POLICY[:PRIORITY]]" where CPUS is a list
+such as "2,4-5", POLICY is one of other, batch, fifo or rr and the priority is
+only used by fifo and rr.
+*/
+
+typedef enum TopologyThread
+{
+  TOPOLOGY_FRAME,
+  TOPOLOGY_RENDER,
+  TOPOLOGY_CURSOR,
+  TOPOLOGY_SPICE,
+
+  TOPOLOGY_THREAD_COUNT
+}
+TopologyThread;
+
+// the config key for each thread, ie: frameThread
+extern const char * topology_keys[TOPOLOGY_THREAD_COUNT];
+
+bool topology_set_thread (const TopologyThread thread, const char * spec);
+bool topology_set_exclude(const char * cpus);
+
+// parse "NAME=SPEC" where NAME is frame, render, cursor or spice
+bool topology_parse(const char * arg);
+
+// restrict the process to the CPUs that are not excluded, this must be called
+// before any threads are started so they inherit it
+bool topology_init();
+
+// apply the configuration to the calling thread and report it, returns true if
+// the thread was given an explicit scheduling policy
+bool topology_apply(const TopologyThread thread);
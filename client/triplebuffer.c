@@ -0,0 +1,120 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "triplebuffer.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the shared state is the index of the middle slot and if it is unread
+#define TB_INDEX 0x3
+#define TB_FRESH 0x4
+
+#define TB_ALIGN 64
+
+struct TripleBuffer
+{
+  uint8_t * slots;
+  size_t    stride;
+  bool      taken;
+
+  // each side's state is on its own cache line so they don't contend
+  unsigned int      write   __attribute__((aligned(TB_ALIGN)));
+  uint64_t          dropped;
+  volatile uint32_t middle  __attribute__((aligned(TB_ALIGN)));
+  unsigned int      read    __attribute__((aligned(TB_ALIGN)));
+};
+
+bool triplebuffer_new(TripleBuffer ** tb, const size_t size)
+{
+  TripleBuffer * this;
+  if (posix_memalign((void **)&this, TB_ALIGN, sizeof(TripleBuffer)) != 0)
+  {
+    DEBUG_ERROR("Failed to allocate the triple buffer");
+    return false;
+  }
+  memset(this, 0, sizeof(TripleBuffer));
+
+  this->stride = (size + TB_ALIGN - 1) & ~(size_t)(TB_ALIGN - 1);
+  if (posix_memalign((void **)&this->slots, TB_ALIGN, this->stride * 3) != 0)
+  {
+    DEBUG_ERROR("Failed to allocate the triple buffer slots");
+    free(this);
+    return false;
+  }
+  memset(this->slots, 0, this->stride * 3);
+
+  this->write  = 0;
+  this->middle = 1;
+  this->read   = 2;
+
+  *tb = this;
+  return true;
+}
+
+void triplebuffer_free(TripleBuffer ** tb)
+{
+  if (!*tb)
+    return;
+
+  free((*tb)->slots);
+  free(*tb);
+  *tb = NULL;
+}
+
+void * triplebuffer_write_ptr(TripleBuffer * tb)
+{
+  return tb->slots + tb->stride * tb->write;
+}
+
+bool triplebuffer_publish(TripleBuffer * tb)
+{
+  // the release makes the slot contents visible before the consumer can see it
+  const uint32_t old = __atomic_exchange_n(&tb->middle, tb->write | TB_FRESH, __ATOMIC_ACQ_REL);
+  tb->write = old & TB_INDEX;
+
+  if (!(old & TB_FRESH))
+    return false;
+
+  __atomic_store_n(&tb->dropped, tb->dropped + 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+void * triplebuffer_take(TripleBuffer * tb)
+{
+  // only the producer can change the middle and it always leaves it fresh
+  if (!(__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & TB_FRESH))
+    return NULL;
+
+  const uint32_t old = __atomic_exchange_n(&tb->middle, tb->read, __ATOMIC_ACQ_REL);
+  tb->read  = old & TB_INDEX;
+  tb->taken = true;
+  return tb->slots + tb->stride * tb->read;
+}
+
+void * triplebuffer_current(TripleBuffer * tb)
+{
+  return tb->taken ? tb->slots + tb->stride * tb->read : NULL;
+}
+
+uint64_t triplebuffer_dropped(TripleBuffer * tb)
+{
+  return __atomic_load_n(&tb->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,50 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Client
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Lock-free latest-wins mailbox between one producer and one consumer thread.
+There are three slots: the one the producer is filling, the one the consumer
+is reading and the most recently published one in between. Publishing never
+waits. If the consumer hasn't taken the last frame it is dropped and counted.
+*/
+typedef struct TripleBuffer TripleBuffer;
+
+bool triplebuffer_new (TripleBuffer ** tb, const size_t size);
+void triplebuffer_free(TripleBuffer ** tb);
+
+// producer: the slot to fill, it is private to the producer until published
+void * triplebuffer_write_ptr(TripleBuffer * tb);
+
+// producer: returns true if the previously published slot was never taken
+bool triplebuffer_publish(TripleBuffer * tb);
+
+// consumer: the newest published slot, or NULL if nothing new since the last take
+void * triplebuffer_take(TripleBuffer * tb);
+
+// consumer: the slot returned by the last take, NULL before the first
+void * triplebuffer_current(TripleBuffer * tb);
+
+// the number of published slots that were replaced before they were taken
+uint64_t triplebuffer_dropped(TripleBuffer * tb);
@@ -23,37 +23,36 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "timing.h"
+
+// both are on CLOCK_MONOTONIC, see timing.h
 static inline uint64_t microtime()
 {
-  struct timespec time;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &time);
-  return ((uint64_t)time.tv_sec * 1000000) + (time.tv_nsec / 1000);
+  return timing_ns() / 1000;
 }
 
 static inline uint64_t nanotime()
 {
-  struct timespec time;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &time);
-  return ((uint64_t)time.tv_sec * 1e9) + time.tv_nsec;
+  return timing_ns();
 }
 
 static inline void nsleep(uint64_t ns)
 {
   const struct timespec ts =
   {
-    .tv_sec  = ns / 1e9,
-    .tv_nsec = ns - ((ns / 1e9) * 1e9)
+    .tv_sec  = ns / 1000000000ULL,
+    .tv_nsec = ns % 1000000000ULL
   };
   nanosleep(&ts, NULL);
 }
 
 #ifdef ATOMIC_LOCKING
-  #define LG_LOCK_MODE    "Atomic"
-  typedef volatile int LG_Lock;
-  #define LG_LOCK_INIT(x) (x) = 0
-  #define LG_LOCK(x)      while(__sync_lock_test_and_set(&(x), 1)) {nsleep(100);}
-  #define LG_UNLOCK(x)    __sync_lock_release(&x)
-  #define LG_LOCK_FREE(x)
+  #include "lock.h"
+  #define LG_LOCK_MODE    "Adaptive"
+  #define LG_LOCK_INIT(x) lg_lock_init(&(x), #x)
+  #define LG_LOCK(x)      lg_lock(&(x))
+  #define LG_UNLOCK(x)    lg_unlock(&(x))
+  #define LG_LOCK_FREE(x) lg_lock_free(&(x))
 #else
   #include <SDL2/SDL.h>
   #define LG_LOCK_MODE    "Mutex"
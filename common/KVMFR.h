@@ -19,9 +19,32 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define KVMFR_HEADER_MAGIC   "[[KVMFR]]"
-#define KVMFR_HEADER_VERSION 8
+#define KVMFR_HEADER_VERSION 17
+#define KVMFR_MAX_FRAMES     8  // maximum number of frame slots in the ring
+#define KVMFR_MAX_DAMAGE     16 // maximum number of damage rects per frame
+#define KVMFR_MAX_READERS    4  // maximum number of concurrent clients
+#define KVMFR_MAX_STREAMS    4  // maximum number of displays
+
+/*
+Data written by different parties, or at different rates, is kept on separate
+cache lines so that one does not keep invalidating the line another is reading.
+*/
+#define KVMFR_CACHELINE 64
+
+#if defined(_MSC_VER)
+  #define KVMFR_ALIGNED __declspec(align(KVMFR_CACHELINE))
+#else
+  #define KVMFR_ALIGNED __attribute__((aligned(KVMFR_CACHELINE)))
+#endif
+
+#if defined(__cplusplus)
+  #define KVMFR_STATIC_ASSERT(x, msg) static_assert(x, msg)
+#else
+  #define KVMFR_STATIC_ASSERT(x, msg) _Static_assert(x, msg)
+#endif
 
 typedef enum FrameType
 {
@@ -42,16 +65,39 @@ typedef enum CursorType
 }
 CursorType;
 
-#define KVMFR_CURSOR_FLAG_UPDATE  1 // cursor update available
-#define KVMFR_CURSOR_FLAG_VISIBLE 2 // cursor is visible
-#define KVMFR_CURSOR_FLAG_SHAPE   4 // shape updated
-#define KVMFR_CURSOR_FLAG_POS     8 // position updated
+#define KVMFR_CURSOR_FLAG_VISIBLE 1 // cursor is visible
+#define KVMFR_CURSOR_FLAG_SHAPE   2 // the shape data is valid
+
+/*
+The host publishes a shape or visibility change by incrementing `serial` after
+writing the rest of the cursor, `version` is only incremented when the shape
+changed. Each reader acknowledges the update by storing the serial it has read
+into `cursorAck`, the host doesn't change the cursor again until every active
+reader has done so.
+*/
 
-typedef struct KVMFRCursor
+/*
+The cursor position is published separately to the shape as a single 64-bit
+word holding x, y and an update counter, so the host can replace it with one
+atomic store and the client can read it at any time without a handshake. The
+client knows the cursor moved when the counter changes, a counter of zero means
+no position has been sent yet.
+*/
+#define KVMFR_CURSOR_POS(x, y, seq) ( \
+  ((uint64_t)(uint32_t)(seq) << 32) | \
+  ((uint64_t)(uint16_t)(y  ) << 16) | \
+  ((uint64_t)(uint16_t)(x  )      ))
+
+#define KVMFR_CURSOR_POS_X(pos)   ((int16_t )((pos)       & 0xFFFF))
+#define KVMFR_CURSOR_POS_Y(pos)   ((int16_t )((pos) >> 16 & 0xFFFF))
+#define KVMFR_CURSOR_POS_SEQ(pos) ((uint32_t)((pos) >> 32))
+
+typedef struct KVMFR_ALIGNED KVMFRCursor
 {
   uint8_t    flags;       // KVMFR_CURSOR_FLAGS
-  int16_t    x, y;        // cursor x & y position
+  uint64_t   pos;         // KVMFR_CURSOR_POS packed position
 
+  uint32_t   serial;      // update counter
   uint32_t   version;     // shape version
   CursorType type;        // shape buffer data type
   uint32_t   width;       // width of the shape
@@ -61,30 +107,191 @@ typedef struct KVMFRCursor
 }
 KVMFRCursor;
 
-#define KVMFR_FRAME_FLAG_UPDATE 1 // frame update available
+/*
+The frames are published through a ring of `frameCount` slots. The host writes
+each new frame into the oldest slot no reader is holding and then publishes it
+by storing the next sequence number into `seq`, a `seq` of zero marks the slot
+as invalid or in the process of being written.
+
+A reader picks the slot with the highest sequence number it has not yet seen
+and claims it by setting the slot's bit in it's `holding` mask before
+re-checking `seq`. The host invalidates a slot before checking the masks of
+the active readers, so either the host skips the slot or the reader sees the
+invalidated sequence and picks again. The reader clears the bit once it no
+longer needs the slot data.
+*/
+
+/*
+Each frame carries a list of the regions that changed since the frame with the
+previous sequence number. A `damageCount` of zero means the entire frame must
+be treated as changed, as does any gap in the sequence numbers seen by the
+client. The slot data itself is always a complete frame.
+*/
+
+/*
+`captureTime` and `publishTime` are in nanoseconds from the same host clock,
+zero if unknown. If KVMFR_NOTIFY_CAP_TIME is set that clock is the client's
+CLOCK_MONOTONIC and the client can also measure the time to pick the frame up.
+*/
 
-typedef struct KVMFRFrame
+typedef struct KVMFRRect
 {
-  uint8_t     flags;       // KVMFR_FRAME_FLAGS
+  uint32_t x, y;
+  uint32_t width, height;
+}
+KVMFRRect;
+
+typedef struct KVMFR_ALIGNED KVMFRFrame
+{
+  uint32_t    seq;         // frame sequence number, zero if invalid
   FrameType   type;        // the frame data type
   uint32_t    width;       // the width
   uint32_t    height;      // the height
   uint32_t    stride;      // the row stride (zero if compressed data)
   uint32_t    pitch;       // the row pitch  (stride in bytes or the compressed frame size)
   uint64_t    dataPos;     // offset to the frame
+  uint64_t    captureTime; // when the frame was captured
+  uint64_t    publishTime; // when the frame was published
+  uint32_t    damageCount; // number of damage rects, zero if the whole frame changed
+  KVMFRRect   damage[KVMFR_MAX_DAMAGE]; // the regions that changed
 }
 KVMFRFrame;
 
+/*
+The layout of the shared memory after the header is described by `directory`,
+which the host computes from the size of the shared memory. Each region has an
+offset from the start of the shared memory, a usable size and the alignment of
+the offset. `serial` is odd while the host changes the layout and is
+incremented again once it is complete, so the client can take a consistent
+copy and knows when to validate it again. Frame data is always within the
+region of the slot it was published in and cursor shape data within the cursor
+region. Regions of an unknown type must be ignored.
+*/
+
+#define KVMFR_DIRECTORY_VERSION 2
+#define KVMFR_MAX_REGIONS       (KVMFR_MAX_STREAMS * (KVMFR_MAX_FRAMES + 1))
+
+#define KVMFR_REGION_CURSOR 1 // cursor shape data, index is the stream
+#define KVMFR_REGION_FRAME  2 // frame slot data, index is KVMFR_SLOT_INDEX
+
+// the index of a frame slot across all streams
+#define KVMFR_SLOT_INDEX(stream, slot) ((stream) * KVMFR_MAX_FRAMES + (slot))
+
+typedef struct KVMFRRegion
+{
+  uint32_t type;   // KVMFR_REGION_TYPE
+  uint32_t index;  // index of the region within it's type
+  uint64_t offset; // offset from the start of the shared memory
+  uint64_t size;   // usable size of the region
+  uint64_t align;  // alignment of offset, a power of two
+}
+KVMFRRegion;
+
+typedef struct KVMFR_ALIGNED KVMFRDirectory
+{
+  uint32_t    version; // KVMFR_DIRECTORY_VERSION
+  uint32_t    serial;  // odd while the layout is being changed
+  uint32_t    count;   // number of regions
+  uint64_t    shmSize; // the size of the shared memory that was laid out
+  KVMFRRegion regions[KVMFR_MAX_REGIONS];
+}
+KVMFRDirectory;
+
+/*
+Each client registers as a reader by swapping it's `id` into a free slot of
+`readers`. A reader must increment `heartbeat` at least every
+KVMFR_READER_TIMEOUT / 4 ms, a reader that misses KVMFR_READER_TIMEOUT ms is
+assumed dead and the host releases it's slot. `streams` has a bit set for each
+stream the reader consumes, the host only waits for cursor acknowledgements of
+those streams. `holding` has bit KVMFR_SLOT_INDEX(stream, slot) set for each
+frame slot in use. `consumed` is the sequence of the last frame the reader
+finished with, for monitoring.
+*/
+
+#define KVMFR_READER_TIMEOUT 2000
+
+typedef struct KVMFR_ALIGNED KVMFRReader
+{
+  uint32_t id;        // non zero if the slot is in use
+  uint32_t streams;   // bit mask of the streams the reader consumes
+  uint32_t holding;   // bit mask of the frame slots the reader is using
+  uint32_t consumed;  // the last frame sequence consumed
+  uint32_t heartbeat; // incremented while the reader is alive
+  uint32_t cursorAck[KVMFR_MAX_STREAMS]; // the last cursor serial read, per stream
+}
+KVMFRReader;
+
 #define KVMFR_HEADER_FLAG_RESTART 1 // restart signal from client
 #define KVMFR_HEADER_FLAG_READY   2 // ready signal from client
 #define KVMFR_HEADER_FLAG_PAUSED  4 // capture has been paused by the host
 
-typedef struct KVMFRHeader
+/*
+The host increments `notify[n].count` after each event has been published so
+the client can block instead of polling. If the client has set
+KVMFR_CLIENT_CAP_DOORBELL the host also rings ivshmem doorbell vector `n` of
+`clientPeer`, provided it has that many vectors. A producer running on the
+same machine as the client can instead wake futex waiters on `count`. Each
+stream has it's own events so the first stream uses the first vectors.
+*/
+
+#define KVMFR_NOTIFY_FRAME(stream)  ((stream) * 2 + 0) // a new frame was published
+#define KVMFR_NOTIFY_CURSOR(stream) ((stream) * 2 + 1) // the cursor was updated
+#define KVMFR_NOTIFY_COUNT          (KVMFR_MAX_STREAMS * 2)
+
+#define KVMFR_NOTIFY_CAP_FUTEX 1 // the host wakes futex waiters on notify
+#define KVMFR_NOTIFY_CAP_TIME  2 // times are valid on the client's CLOCK_MONOTONIC
+
+#define KVMFR_CLIENT_CAP_DOORBELL 1 // clientPeer is valid
+
+typedef struct KVMFR_ALIGNED KVMFRNotify
 {
+  uint32_t count; // event counter
+  uint64_t time;  // time of the last event in nanoseconds
+}
+KVMFRNotify;
+
+/*
+Each display is published as a separate stream with it's own frame ring and
+cursor, `streamCount` streams are in use. The cursor position of each stream
+is relative to that display.
+*/
+
+typedef struct KVMFR_ALIGNED KVMFRStream
+{
+  uint32_t    frameCount;               // number of frame slots in use
+  KVMFRFrame  frames[KVMFR_MAX_FRAMES]; // the frame ring
+  KVMFRCursor cursor;                   // the cursor information
+}
+KVMFRStream;
+
+typedef struct KVMFR_ALIGNED KVMFRHeader
+{
+  // control, rarely written
   char        magic[sizeof(KVMFR_HEADER_MAGIC)];
   uint32_t    version;     // version of this structure
   uint8_t     flags;       // KVMFR_HEADER_FLAGS
-  KVMFRFrame  frame;       // the frame information
-  KVMFRCursor cursor;      // the cursor information
+  uint8_t     notifyCaps;  // KVMFR_NOTIFY_CAPS, set by the host
+  uint8_t     clientCaps;  // KVMFR_CLIENT_CAPS, set by the client
+  uint16_t    clientPeer;  // ivshmem peer ID of the client
+  uint32_t    streamCount; // number of streams in use
+
+  KVMFRDirectory directory;                  // the shared memory layout
+  KVMFRNotify    notify[KVMFR_NOTIFY_COUNT]; // the event counters
+  KVMFRReader    readers[KVMFR_MAX_READERS]; // the registered clients
+  KVMFRStream    streams[KVMFR_MAX_STREAMS]; // the displays
 }
-KVMFRHeader;
\ No newline at end of file
+KVMFRHeader;
+
+KVMFR_STATIC_ASSERT(offsetof(KVMFRHeader, streamCount) + sizeof(uint32_t) <= KVMFR_CACHELINE,
+  "KVMFRHeader control fields must fit in one cache line");
+KVMFR_STATIC_ASSERT(sizeof(KVMFRNotify) % KVMFR_CACHELINE == 0, "KVMFRNotify must be padded to a cache line");
+KVMFR_STATIC_ASSERT(sizeof(KVMFRReader) % KVMFR_CACHELINE == 0, "KVMFRReader must be padded to a cache line");
+KVMFR_STATIC_ASSERT(sizeof(KVMFRFrame ) % KVMFR_CACHELINE == 0, "KVMFRFrame must be padded to a cache line" );
+KVMFR_STATIC_ASSERT(KVMFR_MAX_STREAMS * KVMFR_MAX_FRAMES <= 32, "KVMFRReader.holding can't hold every frame slot");
+KVMFR_STATIC_ASSERT(sizeof(KVMFRCursor) % KVMFR_CACHELINE == 0, "KVMFRCursor must be padded to a cache line");
+KVMFR_STATIC_ASSERT(offsetof(KVMFRHeader, directory) % KVMFR_CACHELINE == 0, "KVMFRHeader.directory is misaligned");
+KVMFR_STATIC_ASSERT(offsetof(KVMFRHeader, notify) % KVMFR_CACHELINE == 0, "KVMFRHeader.notify is misaligned");
+KVMFR_STATIC_ASSERT(offsetof(KVMFRHeader, readers) % KVMFR_CACHELINE == 0, "KVMFRHeader.readers is misaligned");
+KVMFR_STATIC_ASSERT(offsetof(KVMFRHeader, streams) % KVMFR_CACHELINE == 0, "KVMFRHeader.streams is misaligned");
+KVMFR_STATIC_ASSERT(offsetof(KVMFRStream, frames) % KVMFR_CACHELINE == 0, "KVMFRStream.frames is misaligned");
+KVMFR_STATIC_ASSERT(offsetof(KVMFRStream, cursor) % KVMFR_CACHELINE == 0, "KVMFRStream.cursor is misaligned");
\ No newline at end of file
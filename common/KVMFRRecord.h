@@ -0,0 +1,96 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR)
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#pragma once
+
+#include "KVMFR.h"
+
+/*
+A recording of a KVMFR stream as the client consumed it, written by the client
+and replayed into a shared memory file by the producer. The file starts with a
+KVMFRRecordHeader and is followed by records, each a KVMFRRecord and `size`
+bytes of payload. Everything is little endian and tightly packed.
+
+A frame record is a KVMFRRecordFrame, `damageCount` rects and then the pixel
+data. A full frame carries the whole frame exactly as it was in the shared
+memory. Otherwise only the damaged rects of a 32bpp frame are stored, row by row
+in the order of the rects, and replay must apply them to the previous frame. A
+damage record is only written when the previous frame record is in the file.
+
+A cursor record is a KVMFRRecordCursor followed by `dataSize` bytes of shape
+data when the shape changed. A cursor position record is a KVMFRRecordCursorPos.
+*/
+
+#define KVMFR_RECORD_MAGIC   "[[LGREC]]"
+#define KVMFR_RECORD_VERSION 1
+
+#pragma pack(push, 1)
+
+typedef struct KVMFRRecordHeader
+{
+  char     magic[sizeof(KVMFR_RECORD_MAGIC)];
+  uint32_t version;      // KVMFR_RECORD_VERSION
+  uint32_t kvmfrVersion; // the KVMFR_HEADER_VERSION of the recorded stream
+}
+KVMFRRecordHeader;
+
+typedef enum KVMFRRecordType
+{
+  KVMFR_RECORD_FRAME = 1,
+  KVMFR_RECORD_CURSOR,
+  KVMFR_RECORD_CURSOR_POS
+}
+KVMFRRecordType;
+
+typedef struct KVMFRRecord
+{
+  uint32_t type; // KVMFRRecordType
+  uint32_t size; // bytes of payload that follow
+  uint64_t time; // nanoseconds since the recording started
+}
+KVMFRRecord;
+
+typedef struct KVMFRRecordFrame
+{
+  uint32_t type;        // FrameType
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t pitch;
+  uint32_t damageCount; // zero for a full frame
+}
+KVMFRRecordFrame;
+
+typedef struct KVMFRRecordCursor
+{
+  uint8_t  flags;       // KVMFR_CURSOR_FLAGS
+  uint8_t  type;        // CursorType
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch;
+  uint32_t dataSize;    // zero if the shape didn't change
+}
+KVMFRRecordCursor;
+
+typedef struct KVMFRRecordCursorPos
+{
+  int16_t x, y;
+}
+KVMFRRecordCursorPos;
+
+#pragma pack(pop)
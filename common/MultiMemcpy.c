@@ -0,0 +1,309 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR)
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+Built as C by the client and as C++ by the host, so it sticks to the subset of
+both and keeps the platform specifics to the few helpers below.
+*/
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+// the host's debug.h needs windows.h first
+#ifdef _WIN32
+  #include <windows.h>
+#endif
+
+#include "MultiMemcpy.h"
+#include "memcpySSE.h"
+#include "debug.h"
+
+#ifdef _WIN32
+  typedef HANDLE        MMThread;
+  typedef HANDLE        MMSignal;
+  typedef volatile LONG MMAtomic;
+
+  #define MM_PAUSE()            YieldProcessor()
+  #define MM_DEC(x)             InterlockedDecrement(x)
+  #define MM_SET(x, v)          InterlockedExchange(x, v)
+  #define MM_TRY_LOCK(x)        (InterlockedCompareExchange(x, 1, 0) == 0)
+  #define MM_UNLOCK(x)          InterlockedExchange(x, 0)
+  #define MM_LOAD(x)            InterlockedCompareExchange(x, 0, 0)
+#else
+  #include <pthread.h>
+  #include <semaphore.h>
+  #include <sched.h>
+  #include <immintrin.h>
+
+  typedef pthread_t        MMThread;
+  typedef sem_t            MMSignal;
+  typedef volatile int32_t MMAtomic;
+
+  #define MM_PAUSE()            _mm_pause()
+  #define MM_DEC(x)             __atomic_sub_fetch(x, 1, __ATOMIC_ACQ_REL)
+  #define MM_SET(x, v)          __atomic_store_n(x, v, __ATOMIC_RELEASE)
+  #define MM_TRY_LOCK(x)        (__sync_bool_compare_and_swap(x, 0, 1))
+  #define MM_UNLOCK(x)          __atomic_store_n(x, 0, __ATOMIC_RELEASE)
+  #define MM_LOAD(x)            __atomic_load_n(x, __ATOMIC_ACQUIRE)
+#endif
+
+struct MMJob
+{
+  uint8_t       * dst;
+  const uint8_t * src;
+  size_t          length;
+};
+
+struct MMWorker
+{
+  unsigned int index;
+  int          cpu;
+  MMThread     thread;
+  MMSignal     start;
+  struct MMJob job;
+};
+
+struct MultiMemcpy
+{
+  bool            running;
+  unsigned int    threads;
+  MMAtomic        busy;
+  MMAtomic        pending;
+  struct MMWorker workers[MULTIMEMCPY_MAX_THREADS - 1];
+};
+
+static struct MultiMemcpy mm;
+
+// the CPUs the process may run on, lowest first
+static unsigned int mm_get_cpus(int * cpus, const unsigned int max)
+{
+  unsigned int count = 0;
+#ifdef _WIN32
+  DWORD_PTR process, system;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+    return 0;
+
+  for(unsigned int i = 0; i < sizeof(DWORD_PTR) * 8 && count < max; ++i)
+    if (process & ((DWORD_PTR)1 << i))
+      cpus[count++] = i;
+#else
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return 0;
+
+  for(unsigned int i = 0; i < CPU_SETSIZE && count < max; ++i)
+    if (CPU_ISSET(i, &set))
+      cpus[count++] = i;
+#endif
+  return count;
+}
+
+static void mm_run(struct MMWorker * w)
+{
+  memcpySSE(w->job.dst, w->job.src, w->job.length);
+  MM_DEC(&mm.pending);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI mm_thread(LPVOID opaque)
+{
+  struct MMWorker * w = (struct MMWorker *)opaque;
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+  for(;;)
+  {
+    WaitForSingleObject(w->start, INFINITE);
+    if (!mm.running)
+      break;
+    mm_run(w);
+  }
+  return 0;
+}
+
+static bool mm_start(struct MMWorker * w)
+{
+  w->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!w->start)
+    return false;
+
+  w->thread = CreateThread(NULL, 0, mm_thread, w, 0, NULL);
+  if (!w->thread)
+  {
+    CloseHandle(w->start);
+    return false;
+  }
+
+  if (w->cpu >= 0 && !SetThreadAffinityMask(w->thread, (DWORD_PTR)1 << w->cpu))
+    DEBUG_WARN("Failed to pin copy thread %u to CPU %d", w->index, w->cpu);
+
+  return true;
+}
+
+static void mm_signal(struct MMWorker * w)
+{
+  SetEvent(w->start);
+}
+
+static void mm_stop(struct MMWorker * w)
+{
+  SetEvent(w->start);
+  WaitForSingleObject(w->thread, INFINITE);
+  CloseHandle(w->thread);
+  CloseHandle(w->start);
+}
+#else
+static void * mm_thread(void * opaque)
+{
+  struct MMWorker * w = (struct MMWorker *)opaque;
+  for(;;)
+  {
+    while(sem_wait(&w->start) != 0) {}
+    if (!mm.running)
+      break;
+    mm_run(w);
+  }
+  return NULL;
+}
+
+static bool mm_start(struct MMWorker * w)
+{
+  if (sem_init(&w->start, 0, 0) != 0)
+    return false;
+
+  if (pthread_create(&w->thread, NULL, mm_thread, w) != 0)
+  {
+    sem_destroy(&w->start);
+    return false;
+  }
+
+  if (w->cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if (pthread_setaffinity_np(w->thread, sizeof(set), &set) != 0)
+      DEBUG_WARN("Failed to pin copy thread %u to CPU %d", w->index, w->cpu);
+  }
+
+  return true;
+}
+
+static void mm_signal(struct MMWorker * w)
+{
+  sem_post(&w->start);
+}
+
+static void mm_stop(struct MMWorker * w)
+{
+  sem_post(&w->start);
+  pthread_join(w->thread, NULL);
+  sem_destroy(&w->start);
+}
+#endif
+
+bool multimemcpy_init(unsigned int threads)
+{
+  int cpus[64];
+  const unsigned int cpuCount = mm_get_cpus(cpus, 64);
+
+  if (threads == 0)
+    threads = cpuCount < 4 ? cpuCount : 4;
+
+  if (threads < 1)
+    threads = 1;
+
+  if (threads > MULTIMEMCPY_MAX_THREADS)
+    threads = MULTIMEMCPY_MAX_THREADS;
+
+  memset(&mm, 0, sizeof(mm));
+  mm.running = true;
+  mm.threads = 1;
+
+  /* the caller does the first part of each copy so it is left unpinned, the
+   * workers take the remaining CPUs in order so they don't compete */
+  for(unsigned int i = 0; i < threads - 1; ++i)
+  {
+    struct MMWorker * w = &mm.workers[i];
+    w->index = i;
+    w->cpu   = cpuCount > 1 ? cpus[(i + 1) % cpuCount] : -1;
+    if (!mm_start(w))
+    {
+      DEBUG_ERROR("Failed to start copy thread %u", i);
+      multimemcpy_free();
+      return false;
+    }
+    ++mm.threads;
+  }
+
+  DEBUG_INFO("Copy Threads    : %u", mm.threads);
+  return true;
+}
+
+void multimemcpy_free()
+{
+  mm.running = false;
+  for(unsigned int i = 0; i + 1 < mm.threads; ++i)
+    mm_stop(&mm.workers[i]);
+  mm.threads = 0;
+}
+
+unsigned int multimemcpy_threads()
+{
+  return mm.threads ? mm.threads : 1;
+}
+
+void multimemcpy(void * dst, const void * src, size_t length)
+{
+  unsigned int parts = (unsigned int)(length / MULTIMEMCPY_MIN_CHUNK);
+  if (parts > mm.threads)
+    parts = mm.threads;
+
+  if (parts < 2 || !MM_TRY_LOCK(&mm.busy))
+  {
+    memcpySSE(dst, src, length);
+    return;
+  }
+
+  // keep the parts on cache line boundaries so no line is written by two threads
+  const size_t chunk = (length / parts + 63) & ~(size_t)63;
+  uint8_t       * d = (uint8_t *)dst;
+  const uint8_t * s = (const uint8_t *)src;
+
+  MM_SET(&mm.pending, (int32_t)(parts - 1));
+  for(unsigned int i = 0; i < parts - 1; ++i)
+  {
+    struct MMWorker * w = &mm.workers[i];
+    const size_t offset = chunk * (i + 1);
+    w->job.dst    = d + offset;
+    w->job.src    = s + offset;
+    w->job.length = i == parts - 2 ? length - offset : chunk;
+    mm_signal(w);
+  }
+
+  memcpySSE(d, s, chunk);
+
+  // the workers fence their streaming stores before they count down
+  while(MM_LOAD(&mm.pending) != 0)
+    MM_PAUSE();
+
+  MM_UNLOCK(&mm.busy);
+}
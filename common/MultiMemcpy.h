@@ -0,0 +1,53 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR)
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+Splits large copies across a pool of worker threads, each pinned to its own CPU
+and using the memcpySSE streaming stores for its part. One core can't saturate
+the memory bandwidth on a frame sized copy, a few of them can.
+
+The pool is shared by the whole process. Only one copy runs on it at a time, a
+copy started while another is in flight is done on the calling thread instead.
+*/
+
+// copies smaller than this per thread are not worth splitting
+#define MULTIMEMCPY_MIN_CHUNK (1024 * 1024)
+#define MULTIMEMCPY_MAX_THREADS 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* start the pool, threads counts the calling thread and 0 picks up to four
+ * based on the CPUs available to the process */
+bool multimemcpy_init(unsigned int threads);
+void multimemcpy_free();
+
+// the number of threads a copy is spread over, including the caller
+unsigned int multimemcpy_threads();
+
+void multimemcpy(void * dst, const void * src, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
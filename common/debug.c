@@ -0,0 +1,347 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR)
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+Only built by the client, with DEBUG_ASYNC defined. Each thread gets a single
+producer ring the first time it logs, the rings are linked into a list that is
+only ever pushed onto and live for the life of the process, so the background
+thread can walk them without a lock. When a thread exits it's ring is marked
+free and taken over by the next thread that needs one. A full ring drops the
+message rather than waiting for the writer. Every line is numbered so the
+background thread can merge the rings back into the order they were logged.
+*/
+
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+
+#include "debug.h"
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RING_SLOTS  64
+#define LINE_SIZE   512
+#define OUTPUT_SIZE (64 * 1024)
+
+struct DebugSlot
+{
+  uint64_t     seq;
+  unsigned int len;
+  char         text[LINE_SIZE];
+};
+
+struct DebugRing
+{
+  struct DebugRing * next;
+  bool               inUse; // cleared when the owning thread exits
+
+  unsigned int head;    // only written by the background thread
+  unsigned int tail;    // only written by the owning thread
+  unsigned int drain;   // the tail the background thread is draining up to
+  unsigned int dropped; // messages lost since the last drain
+
+  struct DebugSlot slots[RING_SLOTS];
+};
+
+struct Debug
+{
+  volatile bool      running;
+  volatile int       sleeping;
+  pthread_t          thread;
+  pthread_once_t     keyOnce;
+  pthread_key_t      key;
+  uint64_t           seq;
+  struct DebugRing * rings;
+  char               output[OUTPUT_SIZE];
+};
+
+static struct Debug debug = { .keyOnce = PTHREAD_ONCE_INIT };
+static __thread struct DebugRing * debug_ring;
+
+// returns false if the site has used up its messages for this second
+static bool debug_rate(DebugSite * site, unsigned int * suppressed)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+  uint64_t window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+  if (window != (uint64_t)ts.tv_sec && __atomic_compare_exchange_n(&site->window, &window,
+        (uint64_t)ts.tv_sec, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+    *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+  }
+  else
+    *suppressed = 0;
+
+  if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) <= DEBUG_RATE_BURST)
+    return true;
+
+  __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+  return false;
+}
+
+// format the message, noting how many from the same site were suppressed before it
+static unsigned int debug_format(char * buffer, const size_t size, const unsigned int suppressed,
+  const char * fmt, va_list args)
+{
+  int len = vsnprintf(buffer, size, fmt, args);
+  if (len < 0)
+    len = 0;
+  else if ((size_t)len >= size)
+  {
+    // keep the line terminated if it was truncated
+    len = size - 1;
+    buffer[len - 1] = '\n';
+  }
+
+  if (suppressed)
+  {
+    // replace the newline, cutting the message short to make room if needed
+    char note[32];
+    const int noteLen = snprintf(note, sizeof(note), " (%u suppressed)\n", suppressed);
+    if (len)
+      --len;
+    if ((size_t)(len + noteLen) > size - 1)
+      len = size - 1 - noteLen;
+    memcpy(buffer + len, note, noteLen + 1);
+    len += noteLen;
+  }
+
+  return len;
+}
+
+// called as the owning thread exits, what is left in the ring is still drained
+static void debug_ring_release(void * opaque)
+{
+  struct DebugRing * ring = (struct DebugRing *)opaque;
+  debug_ring = NULL;
+  __atomic_store_n(&ring->inUse, false, __ATOMIC_RELEASE);
+}
+
+static void debug_key_init()
+{
+  pthread_key_create(&debug.key, debug_ring_release);
+}
+
+static struct DebugRing * debug_ring_get()
+{
+  if (debug_ring)
+    return debug_ring;
+
+  // take over the ring of a thread that has exited before making a new one
+  struct DebugRing * ring = __atomic_load_n(&debug.rings, __ATOMIC_ACQUIRE);
+  for(; ring; ring = ring->next)
+  {
+    bool inUse = false;
+    if (!__atomic_load_n(&ring->inUse, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&ring->inUse, &inUse, true, false,
+          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if (!ring)
+  {
+    ring = calloc(1, sizeof(struct DebugRing));
+    if (!ring)
+      return NULL;
+
+    ring->inUse = true;
+    ring->next  = __atomic_load_n(&debug.rings, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&debug.rings, &ring->next, ring, true,
+          __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+  }
+
+  // give the ring back when this thread exits
+  pthread_setspecific(debug.key, ring);
+  debug_ring = ring;
+  return ring;
+}
+
+void debug_print(DebugSite * site, const char * fmt, ...)
+{
+  unsigned int suppressed;
+  if (!debug_rate(site, &suppressed))
+    return;
+
+  va_list args;
+  va_start(args, fmt);
+
+  struct DebugRing * ring;
+  if (!__atomic_load_n(&debug.running, __ATOMIC_ACQUIRE) || !(ring = debug_ring_get()))
+  {
+    char buffer[LINE_SIZE];
+    const unsigned int len = debug_format(buffer, sizeof(buffer), suppressed, fmt, args);
+    va_end(args);
+    fwrite(buffer, 1, len, stderr);
+    return;
+  }
+
+  const unsigned int tail = ring->tail;
+  if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SLOTS)
+  {
+    va_end(args);
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  struct DebugSlot * slot = &ring->slots[tail % RING_SLOTS];
+  slot->len = debug_format(slot->text, sizeof(slot->text), suppressed, fmt, args);
+  va_end(args);
+
+  // numbered as late as possible so the order is close to the publish order
+  slot->seq = __atomic_fetch_add(&debug.seq, 1, __ATOMIC_RELAXED);
+
+  // publish, then only make the syscall if the writer went to sleep
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&debug.sleeping, __ATOMIC_SEQ_CST) &&
+      __atomic_exchange_n(&debug.sleeping, 0, __ATOMIC_SEQ_CST))
+    syscall(SYS_futex, &debug.sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void debug_output(const char * text, const size_t len, size_t * pos)
+{
+  if (*pos + len > OUTPUT_SIZE)
+  {
+    fwrite(debug.output, 1, *pos, stderr);
+    *pos = 0;
+  }
+
+  memcpy(debug.output + *pos, text, len);
+  *pos += len;
+}
+
+// write out everything queued so far, returns false if there was nothing
+static bool debug_drain()
+{
+  bool   any = false;
+  size_t pos = 0;
+
+  // only drain what has been published so far so a busy thread can't keep us here
+  struct DebugRing * rings = __atomic_load_n(&debug.rings, __ATOMIC_ACQUIRE);
+  for(struct DebugRing * ring = rings; ring; ring = ring->next)
+    ring->drain = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  // merge the rings by taking the lowest numbered line each time
+  for(;;)
+  {
+    struct DebugRing * next    = NULL;
+    uint64_t           nextSeq = 0;
+    for(struct DebugRing * ring = rings; ring; ring = ring->next)
+    {
+      if (ring->head == ring->drain)
+        continue;
+
+      const uint64_t seq = ring->slots[ring->head % RING_SLOTS].seq;
+      if (!next || seq < nextSeq)
+      {
+        next    = ring;
+        nextSeq = seq;
+      }
+    }
+
+    if (!next)
+      break;
+
+    const struct DebugSlot * slot = &next->slots[next->head % RING_SLOTS];
+    debug_output(slot->text, slot->len, &pos);
+    __atomic_store_n(&next->head, next->head + 1, __ATOMIC_RELEASE);
+    any = true;
+  }
+
+  for(struct DebugRing * ring = rings; ring; ring = ring->next)
+  {
+    const unsigned int dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped)
+    {
+      char buffer[LINE_SIZE];
+      const int len = snprintf(buffer, sizeof(buffer), "[W] %20s:%-4u | %-30s | "
+        "%u messages dropped, the log ring was full\n",
+        STRIPPATH(__FILE__), __LINE__, __FUNCTION__, dropped);
+      debug_output(buffer, len, &pos);
+      any = true;
+    }
+  }
+
+  if (pos)
+    fwrite(debug.output, 1, pos, stderr);
+
+  return any;
+}
+
+static void * debug_thread(void * unused)
+{
+  while(__atomic_load_n(&debug.running, __ATOMIC_ACQUIRE))
+  {
+    if (debug_drain())
+      continue;
+
+    // flag that we are going to sleep then check again so a message
+    // published in between is never left waiting for the timeout
+    __atomic_store_n(&debug.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!debug_drain() && __atomic_load_n(&debug.running, __ATOMIC_ACQUIRE))
+    {
+      const struct timespec timeout = { .tv_sec = 1 };
+      syscall(SYS_futex, &debug.sleeping, FUTEX_WAIT_PRIVATE, 1, &timeout, NULL, 0);
+    }
+    __atomic_store_n(&debug.sleeping, 0, __ATOMIC_SEQ_CST);
+  }
+
+  debug_drain();
+  return NULL;
+}
+
+void debug_init()
+{
+  if (debug.running)
+    return;
+
+  pthread_once(&debug.keyOnce, debug_key_init);
+  debug.running = true;
+  if (pthread_create(&debug.thread, NULL, debug_thread, NULL) != 0)
+  {
+    debug.running = false;
+    DEBUG_ERROR("Failed to create the debug thread, logging synchronously");
+    return;
+  }
+
+  pthread_setname_np(debug.thread, "debugThread");
+}
+
+void debug_free()
+{
+  if (!debug.running)
+    return;
+
+  __atomic_store_n(&debug.running, false, __ATOMIC_RELEASE);
+  __atomic_store_n(&debug.sleeping, 0, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, &debug.sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  pthread_join(debug.thread, NULL);
+
+  // anything published while the thread was exiting
+  debug_drain();
+}
@@ -17,6 +17,7 @@ this program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#pragma once
 #include <stdio.h>
 
 #if _WIN32
@@ -47,12 +48,64 @@ Place, Suite 330, Boston, MA 02111-1307 USA
   sizeof(s) > 20 && (s)[sizeof(s)-21] == DIRECTORY_SEPARATOR ? (s) + sizeof(s) - 20 : \
   sizeof(s) > 21 && (s)[sizeof(s)-22] == DIRECTORY_SEPARATOR ? (s) + sizeof(s) - 21 : (s))
 
-#define DEBUG_PRINT(type, fmt, ...) do {fprintf(stderr, type " %20s:%-4u | %-30s | " fmt "\n", STRIPPATH(__FILE__), __LINE__, __FUNCTION__, ##__VA_ARGS__);} while (0)
+#ifdef DEBUG_ASYNC
+  /*
+  Messages are formatted into a ring owned by the calling thread and written
+  out by a background thread, so logging never blocks on stderr. Each call site
+  may log DEBUG_RATE_BURST messages a second, the rest are counted and reported
+  as suppressed. Before debug_init and after debug_free messages are written
+  directly.
+  */
+  #include <stdint.h>
+
+  #define DEBUG_RATE_BURST 10
+
+  typedef struct DebugSite
+  {
+    uint64_t     window;     // the second the count belongs to
+    unsigned int count;      // messages logged in the window
+    unsigned int suppressed; // messages dropped in the window
+  }
+  DebugSite;
+
+  void debug_init();
+  void debug_free();
+  void debug_print(DebugSite * site, const char * fmt, ...) __attribute__((format (printf, 2, 3)));
+
+  #define DEBUG_PRINT(type, fmt, ...) do { \
+    static DebugSite _debugSite; \
+    debug_print(&_debugSite, type " %20s:%-4u | %-30s | " fmt "\n", STRIPPATH(__FILE__), __LINE__, __FUNCTION__, ##__VA_ARGS__); \
+  } while (0)
+#else
+  #define DEBUG_PRINT(type, fmt, ...) do {fprintf(stderr, type " %20s:%-4u | %-30s | " fmt "\n", STRIPPATH(__FILE__), __LINE__, __FUNCTION__, ##__VA_ARGS__);} while (0)
+#endif
+
+// messages below DEBUG_LEVEL are compiled out, the arguments are still type checked
+#define DEBUG_LEVEL_INFO  0
+#define DEBUG_LEVEL_WARN  1
+#define DEBUG_LEVEL_ERROR 2
+
+#ifndef DEBUG_LEVEL
+  #define DEBUG_LEVEL DEBUG_LEVEL_INFO
+#endif
+
+#define DEBUG_DISCARD(fmt, ...) do {if (0) fprintf(stderr, fmt, ##__VA_ARGS__);} while (0)
+
+#if DEBUG_LEVEL <= DEBUG_LEVEL_INFO
+  #define DEBUG_INFO(fmt, ...) DEBUG_PRINT("[I]", fmt, ##__VA_ARGS__)
+#else
+  #define DEBUG_INFO(fmt, ...) DEBUG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if DEBUG_LEVEL <= DEBUG_LEVEL_WARN
+  #define DEBUG_WARN(fmt, ...) DEBUG_PRINT("[W]", fmt, ##__VA_ARGS__)
+  #define DEBUG_FIXME(fmt, ...) DEBUG_PRINT("[F]", fmt, ##__VA_ARGS__)
+#else
+  #define DEBUG_WARN(fmt, ...) DEBUG_DISCARD(fmt, ##__VA_ARGS__)
+  #define DEBUG_FIXME(fmt, ...) DEBUG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
-#define DEBUG_INFO(fmt, ...) DEBUG_PRINT("[I]", fmt, ##__VA_ARGS__)
-#define DEBUG_WARN(fmt, ...) DEBUG_PRINT("[W]", fmt, ##__VA_ARGS__)
 #define DEBUG_ERROR(fmt, ...) DEBUG_PRINT("[E]", fmt, ##__VA_ARGS__)
-#define DEBUG_FIXME(fmt, ...) DEBUG_PRINT("[F]", fmt, ##__VA_ARGS__)
 
 #if defined(DEBUG_SPICE) | defined(DEBUG_IVSHMEM)
   #define DEBUG_PROTO(fmt, args...) DEBUG_PRINT("[P]", fmt, ##args)
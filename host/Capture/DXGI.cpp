@@ -22,6 +22,8 @@ using namespace Capture;
 
 #include "common/debug.h"
 #include "common/memcpySSE.h"
+#include "common/MultiMemcpy.h"
+#include "Util.h"
 
 static const char * DXGI_FORMAT_STR[] = {
   "DXGI_FORMAT_UNKNOWN",
@@ -155,18 +157,26 @@ const char * GetDXGIFormatStr(DXGI_FORMAT format)
   return DXGI_FORMAT_STR[format];
 }
 
-DXGI::DXGI() :
+DXGI::DXGI(unsigned int display) :
   m_options(NULL),
+  m_display(display),
   m_initialized(false),
   m_dxgiFactory(),
   m_device(),
   m_deviceContext(),
-  m_dup()
+  m_dup(),
+  m_metaBuffer(NULL),
+  m_metaBufferSize(0),
+  m_fullDamage(true),
+  m_damageCount(0)
 {
+  m_presentTime.QuadPart = 0;
+  SetRectEmpty(&m_desktop);
 }
 
 DXGI::~DXGI()
 {
+  delete[] m_metaBuffer;
 }
 
 bool DXGI::CanInitialize()
@@ -205,6 +215,7 @@ bool DXGI::Initialize(CaptureOptions * options)
   }
 
   bool done = false;
+  unsigned int display = 0;
   IDXGIAdapter1Ptr adapter;
   for (int i = 0; m_dxgiFactory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND; i++)
   {
@@ -219,6 +230,13 @@ bool DXGI::Initialize(CaptureOptions * options)
         continue;
       }
 
+      // skip the displays other instances capture
+      if (display++ != m_display)
+      {
+        output = NULL;
+        continue;
+      }
+
       m_output = output;
       if (!m_output)
       {
@@ -236,8 +254,10 @@ bool DXGI::Initialize(CaptureOptions * options)
       DEBUG_INFO("Device Sys Mem   : %lld MB", adapterDesc.DedicatedSystemMemory / 1048576);
       DEBUG_INFO("Shared Sys Mem   : %lld MB", adapterDesc.SharedSystemMemory    / 1048576);
 
-      m_width  = outputDesc.DesktopCoordinates.right  - outputDesc.DesktopCoordinates.left;
-      m_height = outputDesc.DesktopCoordinates.bottom - outputDesc.DesktopCoordinates.top;
+      m_desktop = outputDesc.DesktopCoordinates;
+      m_width   = m_desktop.right  - m_desktop.left;
+      m_height  = m_desktop.bottom - m_desktop.top;
+      DEBUG_INFO("Capture Display  : %u", m_display);
       DEBUG_INFO("Capture Size     : %u x %u", m_width, m_height);
 
       done = true;
@@ -335,6 +355,7 @@ bool DXGI::Initialize(CaptureOptions * options)
   DEBUG_INFO("Source Format    : %s", GetDXGIFormatStr(dupDesc.ModeDesc.Format));
 
   m_started     = false;
+  m_fullDamage  = true;
   m_initialized = true;
   return true;
 }
@@ -593,6 +614,9 @@ unsigned int Capture::DXGI::Capture()
     return GRAB_STATUS_ERROR;
   }
 
+  UpdateDamage(frameInfo);
+  m_presentTime = frameInfo.LastPresentTime;
+
   // get the texture
   res.QueryInterface(IID_PPV_ARGS(&m_ftexture));
   res = NULL;
@@ -696,11 +720,126 @@ GrabStatus Capture::DXGI::ReleaseFrame()
   return GRAB_STATUS_OK;
 }
 
+void Capture::DXGI::UpdateDamage(const DXGI_OUTDUPL_FRAME_INFO & frameInfo)
+{
+  m_damageCount = 0;
+
+  // the first frame after initialization is always a full update
+  if (m_fullDamage || frameInfo.TotalMetadataBufferSize == 0)
+  {
+    m_fullDamage = false;
+    return;
+  }
+
+  if (m_metaBufferSize < frameInfo.TotalMetadataBufferSize)
+  {
+    delete[] m_metaBuffer;
+    m_metaBuffer     = new BYTE[frameInfo.TotalMetadataBufferSize];
+    m_metaBufferSize = frameInfo.TotalMetadataBufferSize;
+  }
+
+  HRESULT status;
+  UINT    moveSize;
+  status = m_dup->GetFrameMoveRects(m_metaBufferSize, (DXGI_OUTDUPL_MOVE_RECT *)m_metaBuffer, &moveSize);
+  if (FAILED(status))
+  {
+    DEBUG_WINERROR("GetFrameMoveRects failed", status);
+    return;
+  }
+
+  // only the destination of a move has changed
+  DXGI_OUTDUPL_MOVE_RECT * moves = (DXGI_OUTDUPL_MOVE_RECT *)m_metaBuffer;
+  for(UINT i = 0; i < moveSize / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i)
+    AddDamage(moves[i].DestinationRect);
+
+  UINT dirtySize;
+  status = m_dup->GetFrameDirtyRects(m_metaBufferSize, (RECT *)m_metaBuffer, &dirtySize);
+  if (FAILED(status))
+  {
+    DEBUG_WINERROR("GetFrameDirtyRects failed", status);
+    m_damageCount = 0;
+    return;
+  }
+
+  RECT * dirty = (RECT *)m_metaBuffer;
+  for(UINT i = 0; i < dirtySize / sizeof(RECT); ++i)
+    AddDamage(dirty[i]);
+
+  // if the list overflowed we have to send the full frame
+  if (m_damageCount > KVMFR_MAX_DAMAGE)
+    m_damageCount = 0;
+}
+
+void Capture::DXGI::AddDamage(const RECT & rect)
+{
+  if (m_damageCount > KVMFR_MAX_DAMAGE)
+    return;
+
+  if (m_damageCount == KVMFR_MAX_DAMAGE)
+  {
+    // flag the overflow, UpdateDamage will turn this into a full update
+    ++m_damageCount;
+    return;
+  }
+
+  const LONG left   = max(rect.left  , 0);
+  const LONG top    = max(rect.top   , 0);
+  const LONG right  = min(rect.right , (LONG)m_width );
+  const LONG bottom = min(rect.bottom, (LONG)m_height);
+  if (right <= left || bottom <= top)
+    return;
+
+  KVMFRRect & r = m_damage[m_damageCount++];
+  r.x      = left;
+  r.y      = top;
+  r.width  = right  - left;
+  r.height = bottom - top;
+}
+
 GrabStatus Capture::DXGI::DiscardFrame()
 {
   return ReleaseFrame();
 }
 
+unsigned int DXGI::GetDisplayCount()
+{
+  IDXGIFactory1Ptr factory;
+  if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void **)(&factory))))
+    return 1;
+
+  // the same outputs in the same order Initialize walks them
+  unsigned int count = 0;
+  IDXGIAdapter1Ptr adapter;
+  for (int i = 0; factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND; i++)
+  {
+    IDXGIOutputPtr output;
+    for (int i = 0; adapter->EnumOutputs(i, &output) != DXGI_ERROR_NOT_FOUND; i++)
+    {
+      DXGI_OUTPUT_DESC outputDesc;
+      output->GetDesc(&outputDesc);
+      if (outputDesc.AttachedToDesktop)
+        ++count;
+      output = NULL;
+    }
+    adapter = NULL;
+  }
+
+  return count ? count : 1;
+}
+
+ICapture * DXGI::CreateForDisplay(unsigned int display)
+{
+  DXGI * capture = new DXGI(display);
+  if (!capture->Initialize(m_options))
+  {
+    capture->DeInitialize();
+    delete capture;
+    return NULL;
+  }
+
+  return capture;
+}
+
 GrabStatus Capture::DXGI::GrabFrameRaw(FrameInfo & frame)
 {
   GrabStatus               result;
@@ -718,7 +857,7 @@ GrabStatus Capture::DXGI::GrabFrameRaw(FrameInfo & frame)
   frame.pitch  = mapping.RowPitch;
   frame.stride = mapping.RowPitch / 4;
 
-  memcpySSE(frame.buffer, mapping.pData, frame.pitch * m_height);
+  multimemcpy(frame.buffer, mapping.pData, frame.pitch * m_height);
   m_deviceContext->Unmap(m_texture[0], 0);
 
   return GRAB_STATUS_OK;
@@ -780,6 +919,10 @@ GrabStatus DXGI::GetFrame(struct FrameInfo & frame)
   frame.width  = m_width;
   frame.height = m_height;
 
+  frame.damageCount = m_damageCount;
+  memcpy(frame.damage, m_damage, m_damageCount * sizeof(KVMFRRect));
+  frame.captureTime = Util::QPCToNS(m_presentTime);
+
   if (m_frameType == FRAME_TYPE_YUV420)
     return GrabFrameYUV420(frame);
 
@@ -38,7 +38,7 @@ namespace Capture
   class DXGI : public ICapture
   {
   public:
-    DXGI();
+    DXGI(unsigned int display = 0);
     virtual ~DXGI();
 
     const char * GetName() { return "DXGI"; }
@@ -66,6 +66,10 @@ namespace Capture
     void FreeCursor();
     GrabStatus DiscardFrame();
 
+    unsigned int GetDisplayCount();
+    ICapture * CreateForDisplay(unsigned int display);
+    RECT GetDesktopRect() { return m_desktop; }
+
   private:
 
     bool InitRawCapture();
@@ -77,10 +81,14 @@ namespace Capture
     ID3D11Texture2DPtr m_ftexture;
 
     GrabStatus ReleaseFrame();
+    void       UpdateDamage(const DXGI_OUTDUPL_FRAME_INFO & frameInfo);
+    void       AddDamage   (const RECT & rect);
     GrabStatus GrabFrameRaw    (struct FrameInfo & frame);
     GrabStatus GrabFrameYUV420 (struct FrameInfo & frame);
 
     CaptureOptions * m_options;
+    unsigned int     m_display;
+    RECT             m_desktop;
 
     bool           m_initialized;
     bool           m_started;
@@ -102,5 +110,12 @@ namespace Capture
 
     int                             m_lastCursorX, m_lastCursorY;
     BOOL                            m_lastMouseVis;
+
+    BYTE                          * m_metaBuffer;
+    UINT                            m_metaBufferSize;
+    bool                            m_fullDamage;
+    unsigned int                    m_damageCount;
+    KVMFRRect                       m_damage[KVMFR_MAX_DAMAGE];
+    LARGE_INTEGER                   m_presentTime;
   };
 };
\ No newline at end of file
@@ -51,6 +51,11 @@ struct FrameInfo
   unsigned int pitch;
   void * buffer;
   size_t bufferSize;
+
+  unsigned int damageCount; // zero if the whole frame changed
+  KVMFRRect    damage[KVMFR_MAX_DAMAGE];
+
+  uint64_t     captureTime; // Util::GetTimeNS() of the capture, zero if unknown
 };
 
 enum GrabStatus
@@ -68,6 +73,8 @@ typedef std::vector<const char *> CaptureOptions;
 class ICapture
 {
 public:
+  virtual ~ICapture() {}
+
   virtual const char * GetName() = 0;
 
   virtual bool CanInitialize() = 0;
@@ -81,4 +88,13 @@ public:
   virtual bool GetCursor(CursorInfo & cursor) = 0;
   virtual void FreeCursor() = 0;
   virtual enum GrabStatus DiscardFrame() = 0;
+
+  // the number of displays the device can capture, each needs it's own instance
+  virtual unsigned int GetDisplayCount() { return 1; }
+
+  // an initialized instance that captures another display, NULL if unsupported
+  virtual ICapture * CreateForDisplay(unsigned int display) { return NULL; }
+
+  // where the captured display is on the desktop, empty if unknown
+  virtual RECT GetDesktopRect() { RECT rect = { 0, 0, 0, 0 }; return rect; }
 };
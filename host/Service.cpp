@@ -27,16 +27,21 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "Util.h"
 #include "CaptureFactory.h"
 
+#include <avrt.h>
+
 Service::Service() :
   m_initialized(false),
+  m_running(false),
   m_memory(NULL),
+  m_vectors(0),
   m_timer(NULL),
-  m_capture(NULL),
   m_shmHeader(NULL),
-  m_frameIndex(0),
-  m_cursorDataSize(0),
-  m_cursorData(NULL)
+  m_streamCount(0),
+  m_cursorDataSize(0)
 {
+  ZeroMemory(m_streams, sizeof(m_streams));
+  InitializeCriticalSection(&m_sharedCS);
+
   m_consoleSessionID = WTSGetActiveConsoleSessionId();
   m_ivshmem = IVSHMEM::Get();
 
@@ -57,120 +62,465 @@ Service::Service() :
 Service::~Service()
 {
   DeInitialize();
+  DeleteCriticalSection(&m_sharedCS);
 }
 
 LRESULT Service::LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam)
 {
-  if (nCode == HC_ACTION && wParam == WM_MOUSEMOVE)
+  if (nCode == HC_ACTION && wParam == WM_MOUSEMOVE && m_initialized)
   {
     MSLLHOOKSTRUCT *msg = (MSLLHOOKSTRUCT *)lParam;
-    volatile KVMFRCursor * cursor = &(m_shmHeader->cursor);
-    volatile char * flags = (volatile char *)&(cursor->flags);
+    if (m_streamCount == 1)
+      PublishCursorPos(m_streams[0], msg->pt.x, msg->pt.y);
+    else
+    {
+      // only the display under the cursor gets the position, relative to it
+      for (unsigned int i = 0; i < m_streamCount; ++i)
+      {
+        Stream & stream = m_streams[i];
+        if (!PtInRect(&stream.desktop, msg->pt))
+          continue;
 
-    cursor->x = msg->pt.x;
-    cursor->y = msg->pt.y;
-    INTERLOCKED_OR8(flags, KVMFR_CURSOR_FLAG_POS);
+        PublishCursorPos(stream, msg->pt.x - stream.desktop.left, msg->pt.y - stream.desktop.top);
+        break;
+      }
+    }
   }
   return CallNextHookEx(m_mouseHook, nCode, wParam, lParam);
 }
 
-bool Service::Initialize(ICapture * captureDevice)
+bool Service::Initialize(ICapture * captureDevice, unsigned int maxDisplays)
 {
   if (m_initialized)
     DeInitialize();
 
   m_tryTarget = 0;
-  m_capture   = captureDevice;
 
-  if (m_capture->GetMaxFrameSize() > m_frameSize)
+  // capture as many of the displays as we were asked to and the protocol allows
+  unsigned int displays = captureDevice->GetDisplayCount();
+  if (displays > maxDisplays)
+    displays = maxDisplays;
+  if (displays > KVMFR_MAX_STREAMS)
+    displays = KVMFR_MAX_STREAMS;
+
+  ZeroMemory(m_streams, sizeof(m_streams));
+  m_streams[0].capture = captureDevice;
+  m_streamCount        = 1;
+  while (m_streamCount < displays)
   {
-    DEBUG_ERROR("Maximum frame size of %zu bytes excceds maximum space available", m_capture->GetMaxFrameSize());
-    DeInitialize();
-    return false;
+    ICapture * capture = captureDevice->CreateForDisplay(m_streamCount);
+    if (!capture)
+    {
+      DEBUG_WARN("Failed to initialize display %u, only capturing %u", m_streamCount, m_streamCount);
+      break;
+    }
+    m_streams[m_streamCount++].capture = capture;
   }
 
-  // Create the cursor thread
-  m_cursorThread = CreateThread(NULL, 0, _CursorThread, NULL, 0, NULL);
-  m_cursorEvent  = CreateEvent (NULL, FALSE, FALSE, L"CursorEvent");
-  InitializeCriticalSection(&m_cursorCS);
+  // zero the frame rings before they are laid out
+  ZeroMemory(m_shmHeader->streams, sizeof(m_shmHeader->streams));
+
+  // attached readers keep their registration, any that are dead will time out
+  ZeroMemory(m_readerID, sizeof(m_readerID));
+
+  // drop displays until every stream has room for it's frames
+  while (!InitStreams())
+  {
+    if (m_streamCount == 1)
+    {
+      DeInitialize();
+      return false;
+    }
+
+    Stream & stream = m_streams[--m_streamCount];
+    DEBUG_WARN("Not enough shared memory for %u displays, only capturing %u", m_streamCount + 1, m_streamCount);
+    FreeStream(stream);
+    ZeroMemory(&(m_shmHeader->streams[m_streamCount]), sizeof(KVMFRStream));
+  }
 
   // update everything except for the hostID
   memcpy(m_shmHeader->magic, KVMFR_HEADER_MAGIC, sizeof(KVMFR_HEADER_MAGIC));
-  m_shmHeader->version = KVMFR_HEADER_VERSION;
+  m_shmHeader->version     = KVMFR_HEADER_VERSION;
+  m_shmHeader->streamCount = m_streamCount;
+  DEBUG_INFO("Displays        : %3u", m_streamCount);
+
+  // we can't wake futex waiters on the client, only ring the doorbell
+  m_shmHeader->notifyCaps = 0;
+  m_vectors = m_ivshmem->GetVectors();
+  DEBUG_INFO("Doorbell Vectors: %u", (unsigned int)m_vectors);
 
   // zero and tell the client we have restarted
-  ZeroMemory(&(m_shmHeader->frame ), sizeof(KVMFRFrame ));
-  ZeroMemory(&(m_shmHeader->cursor), sizeof(KVMFRCursor));
+  for (unsigned int i = 0; i < m_streamCount; ++i)
+    ZeroMemory(&(m_streams[i].shm->cursor), sizeof(KVMFRCursor));
   m_shmHeader->flags &= ~KVMFR_HEADER_FLAG_RESTART;
 
-  m_haveFrame   = false;
   m_initialized = true;
   m_running     = true;
+
+  // create the cursor threads, and the capture threads of the other displays
+  for (unsigned int i = 0; i < m_streamCount; ++i)
+  {
+    Stream & stream = m_streams[i];
+    stream.cursorEvent  = CreateEvent (NULL, FALSE, FALSE, NULL);
+    stream.cursorThread = CreateThread(NULL, 0, _CursorThread, &stream, 0, NULL);
+    if (i > 0)
+      stream.thread = CreateThread(NULL, 0, _CaptureThread, &stream, 0, NULL);
+  }
+
   return true;
 }
 
-#define ALIGN_DN(x) ((uintptr_t)(x) & ~0x7F)
-#define ALIGN_UP(x) ALIGN_DN(x + 0x7F)
+#define ALIGN_TO(x, a) (((uintptr_t)(x) + ((a) - 1)) & ~(uintptr_t)((a) - 1))
+#define ALIGN_DN_TO(x, a) ((uintptr_t)(x) & ~(uintptr_t)((a) - 1))
+
+#define REGION_ALIGN       0x1000   // small page
+#define REGION_ALIGN_LARGE 0x200000 // large page
 
 bool Service::InitPointers()
 {
   m_shmHeader      = reinterpret_cast<KVMFRHeader *>(m_memory);
-  m_cursorData     = (uint8_t *)ALIGN_UP(m_memory + sizeof(KVMFRHeader));
   m_cursorDataSize = 1048576; // 1MB fixed for cursor size, should be more then enough
-  m_cursorOffset   = m_cursorData - m_memory;
-
-  uint8_t * m_frames = (uint8_t *)ALIGN_UP(m_cursorData + m_cursorDataSize);
-  m_frameSize = ALIGN_DN((m_ivshmem->GetSize() - (m_frames - m_memory)) / MAX_FRAMES);
 
   DEBUG_INFO("Total Available : %3u MB", (unsigned int)(m_ivshmem->GetSize() / 1024 / 1024));
   DEBUG_INFO("Max Cursor Size : %3u MB", (unsigned int)(m_cursorDataSize / 1024 / 1024));
-  DEBUG_INFO("Max Frame Size  : %3u MB", (unsigned int)(m_frameSize / 1024 / 1024));
-  DEBUG_INFO("Cursor          : %p (0x%08x)", m_cursorData, (int)m_cursorOffset);
 
-  for (int i = 0; i < MAX_FRAMES; ++i)
+  return true;
+}
+
+// a cursor region for each stream, the rest is split evenly between their frames
+bool Service::InitStreams()
+{
+  const size_t cursorBase = ALIGN_TO(sizeof(KVMFRHeader), REGION_ALIGN);
+  const size_t frameStart = ALIGN_TO(cursorBase + m_streamCount * m_cursorDataSize, REGION_ALIGN);
+  const size_t size       = m_ivshmem->GetSize();
+  if (frameStart >= size)
+  {
+    DEBUG_ERROR("Shared memory is not large enough for %u cursors", m_streamCount);
+    return false;
+  }
+
+  const size_t frameAvail = ALIGN_DN_TO((size - frameStart) / m_streamCount, REGION_ALIGN);
+  for (unsigned int i = 0; i < m_streamCount; ++i)
   {
-    m_frame[i] = m_frames + i * m_frameSize;
-    m_dataOffset[i] = m_frame[i] - m_memory;
-    DEBUG_INFO("Frame %d         : %p (0x%08x)", i, m_frame[i], (int)m_dataOffset[i]);
+    Stream & stream = m_streams[i];
+    stream.index        = i;
+    stream.shm          = &(m_shmHeader->streams[i]);
+    stream.desktop      = stream.capture->GetDesktopRect();
+    stream.cursorOffset = cursorBase + i * m_cursorDataSize;
+    stream.cursorData   = m_memory + stream.cursorOffset;
+    stream.frameBase    = m_memory + frameStart + i * frameAvail;
+    stream.frameAvail   = frameAvail;
+    stream.haveFrame    = false;
+
+    DEBUG_INFO("Stream          : %3u", i);
+    DEBUG_INFO("Cursor          : %p (0x%08x)", stream.cursorData, (int)stream.cursorOffset);
+    if (!InitFrames(stream, stream.capture->GetMaxFrameSize()))
+      return false;
   }
 
   return true;
 }
 
-void Service::DeInitialize()
+// the first frame if the frames are aligned to align, offsets are aligned not addresses
+uint8_t * Service::AlignFrameBase(Stream & stream, size_t align)
 {
-  m_running = false;
+  return m_memory + ALIGN_TO(stream.frameBase - m_memory, align);
+}
 
-  WaitForSingleObject(m_cursorThread, INFINITE);
-  CloseHandle(m_cursorThread);
-  CloseHandle(m_cursorEvent);
+// the number of frames that fit in the stream's memory if aligned to align
+size_t Service::FitFrames(Stream & stream, size_t maxFrameSize, size_t align)
+{
+  const size_t used = AlignFrameBase(stream, align) - stream.frameBase;
+  if (used >= stream.frameAvail)
+    return 0;
+
+  size_t count = (stream.frameAvail - used) / ALIGN_TO(maxFrameSize, align);
+  if (count > KVMFR_MAX_FRAMES)
+    count = KVMFR_MAX_FRAMES;
+  return count;
+}
 
-  m_shmHeader      = NULL;
-  m_cursorData     = NULL;
-  m_cursorDataSize = 0;
-  m_cursorOffset   = 0;
-  m_haveFrame      = false;
+bool Service::InitFrames(Stream & stream, size_t maxFrameSize)
+{
+  // fit as many frames into the ring as the shared memory will allow
+  size_t align = REGION_ALIGN;
+  size_t count = maxFrameSize ? FitFrames(stream, maxFrameSize, align) : 0;
 
-  for(int i = 0; i < MAX_FRAMES; ++i)
+  if (count < 2)
   {
-    m_frame     [i] = NULL;
-    m_dataOffset[i] = 0;
+    DEBUG_ERROR("Maximum frame size of %zu bytes exceeds maximum space available", maxFrameSize);
+    return false;
   }
-  m_frameSize = 0;
 
-  m_ivshmem->DeInitialize();
+  if (count < 3)
+    DEBUG_WARN("Only %u frames fit in the shared memory, increase it's size to avoid stalls", (unsigned int)count);
+
+  // align large frames to large pages if it doesn't cost a slot
+  if (maxFrameSize >= REGION_ALIGN_LARGE && FitFrames(stream, maxFrameSize, REGION_ALIGN_LARGE) == count)
+    align = REGION_ALIGN_LARGE;
+
+  // invalidate every slot before moving them so the client doesn't read junk
+  stream.shm->frameCount = 0;
+  for (int i = 0; i < KVMFR_MAX_FRAMES; ++i)
+    InterlockedExchange((volatile LONG *)&(stream.shm->frames[i].seq), 0);
+
+  uint8_t * base = AlignFrameBase(stream, align);
+  stream.frameCount = (unsigned int)count;
+  stream.frameSize  = ALIGN_DN_TO((stream.frameAvail - (base - stream.frameBase)) / stream.frameCount, align);
+  stream.frameAlign = align;
+  stream.frameIndex = 0;
+  stream.haveFrame  = false;
 
-  if (m_capture)
+  DEBUG_INFO("Frame Count     : %3u"   , stream.frameCount);
+  DEBUG_INFO("Max Frame Size  : %3u MB", (unsigned int)(stream.frameSize / 1024 / 1024));
+  DEBUG_INFO("Frame Alignment : %3u KB", (unsigned int)(align / 1024));
+
+  for (unsigned int i = 0; i < stream.frameCount; ++i)
   {
-    m_capture->DeInitialize();
-    m_capture = NULL;
+    stream.frame[i] = base + i * stream.frameSize;
+    stream.dataOffset[i] = stream.frame[i] - m_memory;
+    DEBUG_INFO("Frame %u         : %p (0x%08x)", i, stream.frame[i], (int)stream.dataOffset[i]);
   }
 
+  stream.shm->frameCount = stream.frameCount;
+  WriteDirectory();
+  return true;
+}
+
+void Service::WriteDirectory()
+{
+  EnterCriticalSection(&m_sharedCS);
+
+  volatile KVMFRDirectory * dir = &(m_shmHeader->directory);
+  unsigned int n = 0;
+
+  // an odd serial tells the client the layout is changing
+  if ((dir->serial & 1) == 0)
+    InterlockedIncrement((volatile LONG *)&(dir->serial));
+
+  dir->count   = 0;
+  dir->version = KVMFR_DIRECTORY_VERSION;
+  dir->shmSize = m_ivshmem->GetSize();
+
+  for (unsigned int s = 0; s < m_streamCount; ++s)
+  {
+    const Stream & stream = m_streams[s];
+
+    volatile KVMFRRegion * r = &dir->regions[n++];
+    r->type   = KVMFR_REGION_CURSOR;
+    r->index  = s;
+    r->offset = stream.cursorOffset;
+    r->size   = m_cursorDataSize;
+    r->align  = REGION_ALIGN;
+
+    for (unsigned int i = 0; i < stream.frameCount; ++i)
+    {
+      r = &dir->regions[n++];
+      r->type   = KVMFR_REGION_FRAME;
+      r->index  = KVMFR_SLOT_INDEX(s, i);
+      r->offset = stream.dataOffset[i];
+      r->size   = stream.frameSize;
+      r->align  = stream.frameAlign;
+    }
+  }
+
+  // the interlocked operation ensures the regions are visible first
+  dir->count = n;
+  InterlockedIncrement((volatile LONG *)&(dir->serial));
+
+  LeaveCriticalSection(&m_sharedCS);
+}
+
+void Service::Notify(unsigned int index)
+{
+  InterlockedIncrement((volatile LONG *)&(m_shmHeader->notify[index].count));
+
+  // the client only waits on the doorbell if it has the vector
+  if ((m_shmHeader->clientCaps & KVMFR_CLIENT_CAP_DOORBELL) && index < m_vectors)
+    m_ivshmem->RingDoorbell(m_shmHeader->clientPeer, index);
+}
+
+void Service::PublishCursorPos(Stream & stream, int x, int y)
+{
+  uint32_t seq = (uint32_t)InterlockedIncrement(&stream.cursorPosSeq);
+  if (seq == 0)
+    seq = (uint32_t)InterlockedIncrement(&stream.cursorPosSeq);
+
+  // the hook and the cursor thread can both get here, and either may be
+  // preempted between taking a seq and publishing, so only ever replace an
+  // older position or the client could be sent back to a stale one
+  volatile LONG64 * pos  = (volatile LONG64 *)&(stream.shm->cursor.pos);
+  const    LONG64   word = (LONG64)KVMFR_CURSOR_POS(x, y, seq);
+  LONG64 current = *pos;
+  for(;;)
+  {
+    const uint32_t currentSeq = KVMFR_CURSOR_POS_SEQ(current);
+    if (currentSeq && (int32_t)(seq - currentSeq) <= 0)
+      return;
+
+    const LONG64 prev = InterlockedCompareExchange64(pos, word, current);
+    if (prev == current)
+      break;
+    current = prev;
+  }
+
+  Notify(KVMFR_NOTIFY_CURSOR(stream.index));
+}
+
+bool Service::SlotHeld(Stream & stream, unsigned int slot)
+{
+  for (int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &(m_shmHeader->readers[i]);
+    if (reader->id && (reader->holding & (1U << KVMFR_SLOT_INDEX(stream.index, slot))))
+      return true;
+  }
+  return false;
+}
+
+bool Service::CursorAcked(Stream & stream)
+{
+  const uint32_t serial = stream.shm->cursor.serial;
+  for (int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &(m_shmHeader->readers[i]);
+    if (reader->id && (reader->streams & (1U << stream.index)) &&
+        reader->cursorAck[stream.index] != serial)
+      return false;
+  }
+  return true;
+}
+
+void Service::CheckReaders()
+{
+  EnterCriticalSection(&m_sharedCS);
+
+  const DWORD now = GetTickCount();
+  for (int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &(m_shmHeader->readers[i]);
+    const uint32_t id = reader->id;
+    if (!id)
+    {
+      m_readerID[i] = 0;
+      continue;
+    }
+
+    // a new reader or one that is still alive
+    if (id != m_readerID[i] || reader->heartbeat != m_readerBeat[i])
+    {
+      if (id != m_readerID[i])
+        DEBUG_INFO("Reader %d attached (0x%08x)", i, id);
+
+      m_readerID  [i] = id;
+      m_readerBeat[i] = reader->heartbeat;
+      m_readerSeen[i] = now;
+      continue;
+    }
+
+    if (now - m_readerSeen[i] < KVMFR_READER_TIMEOUT)
+      continue;
+
+    DEBUG_WARN("Reader %d (0x%08x) timed out after frame %u, releasing it", i, id, reader->consumed);
+    reader->holding = 0;
+    InterlockedCompareExchange((volatile LONG *)&(reader->id), 0, id);
+    m_readerID[i] = 0;
+  }
+
+  LeaveCriticalSection(&m_sharedCS);
+}
+
+uint32_t Service::NextFrameSeq(Stream & stream)
+{
+  // zero is reserved to mark a slot as invalid
+  if (++stream.frameSeq == 0)
+    ++stream.frameSeq;
+  return stream.frameSeq;
+}
+
+int Service::AcquireFrameSlot(Stream & stream, volatile char * flags)
+{
+  for(;;)
+  {
+    // find the oldest slot no reader is holding
+    int      slot = -1;
+    uint32_t age  = 0;
+    for(unsigned int i = 0; i < stream.frameCount; ++i)
+    {
+      volatile KVMFRFrame * fi = &(stream.shm->frames[i]);
+      if (SlotHeld(stream, i))
+        continue;
+
+      const uint32_t seq     = fi->seq;
+      const uint32_t slotAge = seq ? stream.frameSeq - seq : UINT32_MAX;
+      if (slot < 0 || slotAge > age)
+      {
+        slot = i;
+        age  = slotAge;
+      }
+    }
+
+    if (slot < 0)
+    {
+      /* every slot is held, wait for the slowest reader to let one go or be
+       * timed out */
+      Sleep(0);
+      if ((*flags & KVMFR_HEADER_FLAG_RESTART) || stream.restart || !m_running)
+        return -1;
+      CheckReaders();
+      continue;
+    }
+
+    // invalidate the slot and then make sure no reader claimed it first
+    volatile KVMFRFrame * fi = &(stream.shm->frames[slot]);
+    const LONG seq = InterlockedExchange((volatile LONG *)&(fi->seq), 0);
+    if (SlotHeld(stream, slot))
+    {
+      InterlockedExchange((volatile LONG *)&(fi->seq), seq);
+      continue;
+    }
+
+    return slot;
+  }
+}
+
+void Service::FreeStream(Stream & stream)
+{
+  WaitForSingleObject(stream.thread, INFINITE);
+  CloseHandle(stream.thread);
+  WaitForSingleObject(stream.cursorThread, INFINITE);
+  CloseHandle(stream.cursorThread);
+  CloseHandle(stream.cursorEvent);
+
+  // the first display's device belongs to the CaptureFactory, the others are ours
+  if (stream.capture)
+  {
+    stream.capture->DeInitialize();
+    if (&stream != &m_streams[0])
+      delete stream.capture;
+  }
+
+  ZeroMemory(&stream, sizeof(Stream));
+}
+
+void Service::DeInitialize()
+{
+  m_running = false;
+
+  for (unsigned int i = 0; i < m_streamCount; ++i)
+    FreeStream(m_streams[i]);
+  m_streamCount = 0;
+
+  m_shmHeader      = NULL;
+  m_cursorDataSize = 0;
+
+  m_ivshmem->DeInitialize();
+
   m_memory = NULL;
   m_initialized = false;
 }
 
-bool Service::ReInit(volatile char * flags)
+bool Service::ReInit(Stream & stream, volatile char * flags)
 {
   DEBUG_INFO("ReInitialize Requested");
 
@@ -182,20 +532,20 @@ bool Service::ReInit(volatile char * flags)
       Sleep(100);
   }
 
-  while (!m_capture->CanInitialize())
+  while (!stream.capture->CanInitialize())
     Sleep(100);
 
-  if (!m_capture->ReInitialize())
+  if (!stream.capture->ReInitialize())
   {
     DEBUG_ERROR("ReInitialize Failed");
     return false;
   }
 
-  if (m_capture->GetMaxFrameSize() > m_frameSize)
-  {
-    DEBUG_ERROR("Maximum frame size of %zd bytes excceds maximum space available", m_capture->GetMaxFrameSize());
+  // a mode change can move the display on the desktop
+  stream.desktop = stream.capture->GetDesktopRect();
+
+  if (stream.capture->GetMaxFrameSize() > stream.frameSize && !InitFrames(stream, stream.capture->GetMaxFrameSize()))
     return false;
-  }
 
   INTERLOCKED_AND8(flags, ~KVMFR_HEADER_FLAG_PAUSED);
   return true;
@@ -206,31 +556,53 @@ ProcessStatus Service::Process()
   if (!m_initialized)
     return PROCESS_STATUS_ERROR;
 
-  volatile char * flags = (volatile char *)&(m_shmHeader->flags);
+  // the other displays are captured on their own threads
+  for (unsigned int i = 1; i < m_streamCount; ++i)
+  {
+    if (m_streams[i].failed)
+    {
+      DEBUG_ERROR("The capture of display %u failed", i);
+      return PROCESS_STATUS_ERROR;
+    }
+  }
 
-  // check if the client has flagged a restart
+  // check if the client has flagged a restart, each stream restarts it's own capture
+  volatile char * flags = (volatile char *)&(m_shmHeader->flags);
   if (*flags & KVMFR_HEADER_FLAG_RESTART)
   {
     DEBUG_INFO("Restart Requested");
-    if (!m_capture->ReInitialize())
+    for (unsigned int i = 0; i < m_streamCount; ++i)
+      InterlockedExchange(&m_streams[i].restart, 1);
+    INTERLOCKED_AND8(flags, ~(KVMFR_HEADER_FLAG_RESTART));
+  }
+
+  return ProcessStream(m_streams[0]);
+}
+
+ProcessStatus Service::ProcessStream(Stream & stream)
+{
+  volatile char * flags = (volatile char *)&(m_shmHeader->flags);
+
+  if (InterlockedExchange(&stream.restart, 0))
+  {
+    if (!stream.capture->ReInitialize())
     {
       DEBUG_ERROR("ReInitialize Failed");
       return PROCESS_STATUS_ERROR;
     }
 
-    if (m_capture->GetMaxFrameSize() > m_frameSize)
-    {
-      DEBUG_ERROR("Maximum frame size of %zd bytes exceeds maximum space available", m_capture->GetMaxFrameSize());
+    stream.desktop = stream.capture->GetDesktopRect();
+    if (stream.capture->GetMaxFrameSize() > stream.frameSize && !InitFrames(stream, stream.capture->GetMaxFrameSize()))
       return PROCESS_STATUS_ERROR;
-    }
-
-    INTERLOCKED_AND8(flags, ~(KVMFR_HEADER_FLAG_RESTART));
   }
 
+  CheckReaders();
+
   unsigned int status;
   bool notify = false;
 
-  status = m_capture->Capture();
+  status = stream.capture->Capture();
+  const uint64_t captureTime = Util::GetTimeNS();
   if (status & GRAB_STATUS_ERROR)
   {
     DEBUG_WARN("Capture error, retrying");
@@ -240,7 +612,7 @@ ProcessStatus Service::Process()
   if (status & GRAB_STATUS_TIMEOUT)
   {
     // timeouts should not count towards a failure to capture
-    if (!m_haveFrame)
+    if (!stream.haveFrame)
       return PROCESS_STATUS_OK;
 
     notify = true;
@@ -248,7 +620,7 @@ ProcessStatus Service::Process()
 
   if (status & GRAB_STATUS_REINIT)
   {
-    if (!ReInit(flags))
+    if (!ReInit(stream, flags))
       return PROCESS_STATUS_ERROR;
 
     // re-init request should not count towards a failure to capture
@@ -262,21 +634,28 @@ ProcessStatus Service::Process()
   }
 
   if (status & GRAB_STATUS_CURSOR)
-    SetEvent(m_cursorEvent);
+    SetEvent(stream.cursorEvent);
 
-  volatile KVMFRFrame * fi = &(m_shmHeader->frame);
   if (status & GRAB_STATUS_FRAME)
   { 
+    const int slot = AcquireFrameSlot(stream, flags);
+    if (slot < 0)
+    {
+      // skip a sequence number so the client knows the damage was lost
+      NextFrameSeq(stream);
+      return PROCESS_STATUS_OK;
+    }
+
     FrameInfo frame  = { 0 };
-    frame.buffer     = m_frame[m_frameIndex];
-    frame.bufferSize = m_frameSize;
+    frame.buffer     = stream.frame[slot];
+    frame.bufferSize = stream.frameSize;
 
-    GrabStatus result = m_capture->GetFrame(frame);
+    GrabStatus result = stream.capture->GetFrame(frame);
     if (result != GRAB_STATUS_OK)
     {
       if (result == GRAB_STATUS_REINIT)
       {
-        if (!ReInit(flags))
+        if (!ReInit(stream, flags))
           return PROCESS_STATUS_ERROR;
 
         // re-init request should not count towards a failure to capture
@@ -287,40 +666,42 @@ ProcessStatus Service::Process()
       return PROCESS_STATUS_ERROR;
     }
 
-    /* don't touch the frame information until the client is done with it */
-    while (fi->flags & KVMFR_FRAME_FLAG_UPDATE)
-    {
-      /* this generally never occurs */
-      Sleep(1);
-      if (*flags & KVMFR_HEADER_FLAG_RESTART)
-        break;
-    }
-
-    fi->type    = m_capture->GetFrameType();
+    volatile KVMFRFrame * fi = &(stream.shm->frames[slot]);
+    fi->type    = stream.capture->GetFrameType();
     fi->width   = frame.width;
     fi->height  = frame.height;
     fi->stride  = frame.stride;
     fi->pitch   = frame.pitch;
-    fi->dataPos = m_dataOffset[m_frameIndex];
+    fi->dataPos = stream.dataOffset[slot];
 
-    if (++m_frameIndex == MAX_FRAMES)
-      m_frameIndex = 0;
+    // captures that don't know when the frame was presented get when we got it
+    fi->captureTime = frame.captureTime ? frame.captureTime : captureTime;
+    fi->publishTime = Util::GetTimeNS();
+
+    fi->damageCount = frame.damageCount;
+    memcpy((void *)fi->damage, frame.damage, frame.damageCount * sizeof(KVMFRRect));
+
+    // publish the frame, the interlocked operation ensures the above is visible first
+    InterlockedExchange((volatile LONG *)&(fi->seq), NextFrameSeq(stream));
+    stream.frameIndex = slot;
+    Notify(KVMFR_NOTIFY_FRAME(stream.index));
 
     // remember that we have a valid frame
-    m_haveFrame = true;
-    notify = true;
+    stream.haveFrame = true;
   }
-
-  if (notify)
+  else if (notify)
   {
-    /* don't touch the frame inforamtion until the client is done with it */
-    while (fi->flags & KVMFR_FRAME_FLAG_UPDATE)
+    /* nothing new was captured, re-publish the last frame so a client that has
+     * just started and dropped it's first frame (ie, to reconfigure) gets it */
+    volatile KVMFRFrame * fi = &(stream.shm->frames[stream.frameIndex]);
+    if (fi->seq)
     {
-      if (*flags & KVMFR_HEADER_FLAG_RESTART)
-        break;
+      // this is not a new capture, don't let it count towards the latency
+      fi->captureTime = 0;
+      fi->publishTime = Util::GetTimeNS();
+      InterlockedExchange((volatile LONG *)&(fi->seq), NextFrameSeq(stream));
+      Notify(KVMFR_NOTIFY_FRAME(stream.index));
     }
-    // signal a frame update
-    fi->flags |= KVMFR_FRAME_FLAG_UPDATE;
   }
 
   // update the flags
@@ -328,34 +709,77 @@ ProcessStatus Service::Process()
   return PROCESS_STATUS_OK;
 }
 
-DWORD Service::CursorThread()
+DWORD Service::CaptureThread(Stream & stream)
 {
+  // the same priority and retry policy as the first display gets from main
+  DWORD taskIndex = 0;
+  HANDLE task = AvSetMmThreadCharacteristics(L"Capture", &taskIndex);
+  if (!task || (AvSetMmThreadPriority(task, AVRT_PRIORITY_CRITICAL) == FALSE))
+    DEBUG_WARN("Failed to boosted priority using MMCSS");
+
+  int retry = 0;
+  while (m_running && !stream.failed)
+  {
+    switch (ProcessStream(stream))
+    {
+      case PROCESS_STATUS_OK:
+        retry = 0;
+        break;
+
+      case PROCESS_STATUS_RETRY:
+        if (retry++ == 3)
+        {
+          DEBUG_ERROR("Too many consecutive retries capturing display %u, aborting", stream.index);
+          InterlockedExchange(&stream.failed, 1);
+        }
+        break;
+
+      case PROCESS_STATUS_ERROR:
+        DEBUG_ERROR("Capture process of display %u returned error", stream.index);
+        InterlockedExchange(&stream.failed, 1);
+    }
+  }
+
+  if (task)
+    AvRevertMmThreadCharacteristics(task);
+
+  return 0;
+}
+
+DWORD Service::CursorThread(Stream & stream)
+{
+  bool visible = false;
   while(m_running)
   {
-    if (WaitForSingleObject(m_cursorEvent, 1000) != WAIT_OBJECT_0)
+    if (WaitForSingleObject(stream.cursorEvent, 1000) != WAIT_OBJECT_0)
       continue;
 
     CursorInfo ci;
-    while (m_capture->GetCursor(ci))
+    while (stream.capture->GetCursor(ci))
     {
-      volatile KVMFRCursor * cursor = &(m_shmHeader->cursor);
-      // wait until the client is ready
-      while ((cursor->flags & ~KVMFR_CURSOR_FLAG_POS) != 0)
+      // the position doesn't need the client to be ready
+      if (ci.hasPos)
+        PublishCursorPos(stream, ci.x, ci.y);
+
+      if (!ci.hasShape && ci.visible == visible)
       {
-        Sleep(1);
-        if (!m_capture)
-          return 0;
+        stream.capture->FreeCursor();
+        continue;
       }
+      visible = ci.visible;
 
-      uint8_t flags = cursor->flags;
-
-      if (ci.hasPos)
+      volatile KVMFRCursor * cursor = &(stream.shm->cursor);
+      // wait until every reader has the last update, dead readers are timed out by Process
+      while (!CursorAcked(stream))
       {
-        cursor->x = ci.x;
-        cursor->y = ci.y;
-        flags |= KVMFR_CURSOR_FLAG_POS;
+        Sleep(1);
+        if (!m_running)
+          return 0;
       }
 
+      // the shape data stays valid until it is replaced
+      uint8_t flags = cursor->flags & KVMFR_CURSOR_FLAG_SHAPE;
+
       if (ci.hasShape)
       {
         if (ci.shape.pointerSize > m_cursorDataSize)
@@ -370,20 +794,22 @@ DWORD Service::CursorThread()
           cursor->width   = ci.w;
           cursor->height  = ci.h;
           cursor->pitch   = ci.pitch;
-          cursor->dataPos = m_cursorOffset;
+          cursor->dataPos = stream.cursorOffset;
 
-          memcpy(m_cursorData, ci.shape.buffer, ci.shape.bufferSize);
+          memcpy(stream.cursorData, ci.shape.buffer, ci.shape.bufferSize);
         }
       }
 
       if (ci.visible)
         flags |= KVMFR_CURSOR_FLAG_VISIBLE;
 
-      flags |= KVMFR_CURSOR_FLAG_UPDATE;
+      // publish the update, the interlocked operation ensures the above is visible first
       cursor->flags = flags;
-      m_capture->FreeCursor();
+      InterlockedIncrement((volatile LONG *)&(cursor->serial));
+      Notify(KVMFR_NOTIFY_CURSOR(stream.index));
+      stream.capture->FreeCursor();
     }
   }
 
   return 0;
-}
\ No newline at end of file
+}
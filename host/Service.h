@@ -27,8 +27,6 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ICapture.h"
 #include "common/debug.h"
 
-#define MAX_FRAMES 2
-
 enum ProcessStatus
 {
   PROCESS_STATUS_OK,
@@ -61,12 +59,56 @@ public:
     }
   }
 
-  bool Initialize(ICapture * captureDevice);
+  bool Initialize(ICapture * captureDevice, unsigned int maxDisplays);
   void DeInitialize();
   ProcessStatus Process();
 
 private:
+  // each captured display is published as it's own stream
+  struct Stream
+  {
+    unsigned int  index;
+    ICapture    * capture;
+    KVMFRStream * shm;
+    RECT          desktop;
+
+    HANDLE        thread;  // the first stream is captured by the caller of Process
+    volatile LONG restart; // the client has asked for a restart
+    volatile LONG failed;  // the capture thread has given up
+
+    bool          haveFrame;
+    uint8_t     * frameBase;
+    size_t        frameAvail;
+    size_t        frameAlign;
+    unsigned int  frameCount;
+    uint8_t     * frame[KVMFR_MAX_FRAMES];
+    size_t        frameSize;
+    uint64_t      dataOffset[KVMFR_MAX_FRAMES];
+    int           frameIndex;
+    uint32_t      frameSeq;
+    volatile LONG cursorPosSeq;
+
+    HANDLE        cursorThread;
+    HANDLE        cursorEvent;
+    uint8_t     * cursorData;
+    uint64_t      cursorOffset;
+  };
+
   bool InitPointers();
+  bool InitStreams();
+  bool InitFrames(Stream & stream, size_t maxFrameSize);
+  uint8_t * AlignFrameBase(Stream & stream, size_t align);
+  size_t FitFrames(Stream & stream, size_t maxFrameSize, size_t align);
+  void WriteDirectory();
+  int  AcquireFrameSlot(Stream & stream, volatile char * flags);
+  uint32_t NextFrameSeq(Stream & stream);
+  void Notify(unsigned int index);
+  void PublishCursorPos(Stream & stream, int x, int y);
+  bool SlotHeld(Stream & stream, unsigned int slot);
+  bool CursorAcked(Stream & stream);
+  void CheckReaders();
+  void FreeStream(Stream & stream);
+  ProcessStatus ProcessStream(Stream & stream);
 
   int m_tryTarget;
   int m_lastTryCount;
@@ -78,31 +120,31 @@ private:
   LRESULT LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam);
   static LRESULT WINAPI _LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam) { return Service::Instance().LowLevelMouseProc(nCode, wParam, lParam); }
 
-  bool ReInit(volatile char * flags);
+  bool ReInit(Stream & stream, volatile char * flags);
 
   bool       m_initialized;
   bool       m_running;
   DWORD      m_consoleSessionID;
   uint8_t  * m_memory;
   IVSHMEM  * m_ivshmem;
+  UINT16     m_vectors;
   HANDLE     m_timer;
-  ICapture * m_capture;
 
   KVMFRHeader * m_shmHeader;
+  Stream        m_streams[KVMFR_MAX_STREAMS];
+  unsigned int  m_streamCount;
+
+  // the reader tracking and the directory are shared by the streams
+  CRITICAL_SECTION m_sharedCS;
+  uint32_t         m_readerID  [KVMFR_MAX_READERS];
+  uint32_t         m_readerBeat[KVMFR_MAX_READERS];
+  DWORD            m_readerSeen[KVMFR_MAX_READERS];
+
+  static DWORD WINAPI _CaptureThread(LPVOID lpParameter) { return Service::Instance().CaptureThread(*(Stream *)lpParameter); }
+  DWORD CaptureThread(Stream & stream);
+
+  static DWORD WINAPI _CursorThread(LPVOID lpParameter) { return Service::Instance().CursorThread(*(Stream *)lpParameter); }
+  DWORD CursorThread(Stream & stream);
 
-  bool          m_haveFrame;
-  uint8_t     * m_frame[MAX_FRAMES];
-  size_t        m_frameSize;
-  uint64_t      m_dataOffset[MAX_FRAMES];
-  int           m_frameIndex;
-
-  static DWORD WINAPI _CursorThread(LPVOID lpParameter) { return Service::Instance().CursorThread(); }
-  DWORD CursorThread();
-
-  HANDLE           m_cursorThread;
-  HANDLE           m_cursorEvent;
-  CRITICAL_SECTION m_cursorCS;
-  size_t           m_cursorDataSize;
-  uint8_t        * m_cursorData;
-  uint64_t         m_cursorOffset;
+  size_t m_cursorDataSize;
 };
\ No newline at end of file
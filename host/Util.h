@@ -63,6 +63,25 @@ public:
     LocalFree(buffer);
   }
 
+  // nanoseconds from the performance counter
+  static uint64_t QPCToNS(const LARGE_INTEGER & qpc)
+  {
+    static LARGE_INTEGER freq = { 0 };
+    if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+
+    const uint64_t sec = qpc.QuadPart / freq.QuadPart;
+    const uint64_t rem = qpc.QuadPart % freq.QuadPart;
+    return sec * 1000000000ULL + rem * 1000000000ULL / freq.QuadPart;
+  }
+
+  static uint64_t GetTimeNS()
+  {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return QPCToNS(now);
+  }
+
   static std::string GetSystemRoot()
   {
     std::string defaultPath;
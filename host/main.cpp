@@ -22,6 +22,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <avrt.h>
 
 #include "common/debug.h"
+#include "common/MultiMemcpy.h"
 #include "vendor/getopt/getopt.h"
 
 #include "CrashHandler.h"
@@ -51,6 +52,7 @@ struct StartupArgs
   bool foreground;
   const char * captureDevice;
   CaptureOptions captureOptions;
+  unsigned int displays;
 };
 struct StartupArgs args;
 
@@ -62,6 +64,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR szCmdParam
 
   args.foreground = false;
   args.captureDevice = NULL;
+  args.displays = KVMFR_MAX_STREAMS;
   int ret = parseArgs(args);
   if (ret != 0)
     fprintf(stderr, "Failed to parse command line arguments\n");
@@ -70,6 +73,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR szCmdParam
     if (args.foreground)
       setupConsole();
 
+    if (!multimemcpy_init(0))
+      DEBUG_WARN("Frame copies will be done on the capture thread");
+
     Service::InstallHook();
     HANDLE captureThread = CreateThread(NULL, 0, CaptureThread, NULL, 0, NULL);
     while (running)
@@ -87,6 +93,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR szCmdParam
     running = false;
     ret = WaitForSingleObject(captureThread, INFINITE);
     CloseHandle(captureThread);
+    multimemcpy_free();
   }
 
   if (ret != 0)
@@ -158,7 +165,7 @@ int run()
   }
 
   Service &svc = Service::Instance();
-  if (!svc.Initialize(captureDevice))
+  if (!svc.Initialize(captureDevice, args.displays))
     return -1;
 
   int retry = 0;
@@ -196,7 +203,7 @@ int run()
 int parseArgs(struct StartupArgs & args)
 {
   int c;
-  while((c = getopt(__argc, __argv, "hc:o:fl")) != -1)
+  while((c = getopt(__argc, __argv, "hc:o:d:fl")) != -1)
   {
     switch (c)
     {
@@ -246,6 +253,19 @@ int parseArgs(struct StartupArgs & args)
       break;
     }
 
+    case 'd':
+    {
+      const int displays = atoi(optarg);
+      if (displays < 1)
+      {
+        setupConsole();
+        fprintf(stderr, "Invalid display count: %s\n", optarg);
+        return -1;
+      }
+      args.displays = displays;
+      break;
+    }
+
     case 'f':
       args.foreground = true;
       break;
@@ -270,6 +290,7 @@ void doHelp()
     "  -h  Print out this help\n"
     "  -c  Specify the capture device to use or ? to list availble (device is probed if not specified)\n"
     "  -o  Option to pass to the capture device, may be specified multiple times for extra options\n"
+    "  -d  Maximum number of displays to capture, each is sent as it's own stream (default: all)\n"
     "  -f  Foreground mode\n"
     "  -l  License information\n",
     app,
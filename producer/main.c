@@ -0,0 +1,1472 @@
+/*
+Looking Glass - KVM FrameRelay (KVMFR) Producer
+Copyright (C) 2017 Geoffrey McRae <geoff@hostfission.com>
+https://looking-glass.hostfission.com
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 2 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+A local stand-in for the host application that publishes synthetic frames into
+a shared memory file so the client can be run and measured without a guest.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "debug.h"
+#include "KVMFR.h"
+#include "KVMFRRecord.h"
+
+#define ALIGN_TO(x, a)    (((uintptr_t)(x) + ((a) - 1)) & ~(uintptr_t)((a) - 1))
+#define ALIGN_DN_TO(x, a) ((uintptr_t)(x) & ~(uintptr_t)((a) - 1))
+
+#define REGION_ALIGN 0x1000
+
+#define CURSOR_DATA_SIZE (1024 * 1024)
+#define BLOCK_SIZE       64
+#define SCROLL_STEP      4
+#define CURSOR_SIZE      32
+#define CURSOR_SHAPE_SECS 2
+
+enum Pattern
+{
+  PATTERN_FULL  , // every pixel changes each frame
+  PATTERN_SCROLL, // a band scrolls like a text view
+  PATTERN_DAMAGE, // a small block moves around the screen
+  PATTERN_STATIC, // nothing changes after the first frame
+  PATTERN_MAX
+};
+
+struct AppParams
+{
+  const char * shmFile;
+  unsigned int shmSize;
+  unsigned int width, height;
+  unsigned int fps;
+  FrameType    format;
+  enum Pattern pattern;
+  bool         cursor;
+  bool         useFutex;
+  unsigned int stress;
+  unsigned int streams;
+  const char * replayFile;
+  double       speed;
+};
+
+struct StreamState
+{
+  unsigned int  index;
+  KVMFRStream * shm;
+
+  uint8_t    * frameBase;
+  unsigned int frameCount;
+  size_t       frameSize;
+  uint32_t     frameSeq;
+  uint64_t     frameNo;
+  uint32_t     cursorPosSeq;
+  uint8_t    * cursorData;
+  unsigned int cursorShape;
+};
+
+struct AppState
+{
+  volatile bool        running;
+  struct KVMFRHeader * shm;
+  struct StreamState   streams[KVMFR_MAX_STREAMS];
+
+  uint32_t     readerID  [KVMFR_MAX_READERS];
+  uint32_t     readerBeat[KVMFR_MAX_READERS];
+  uint64_t     readerSeen[KVMFR_MAX_READERS];
+};
+
+struct AppParams params =
+{
+  .shmFile  = "/dev/shm/looking-glass",
+  .shmSize  = 32,
+  .width    = 1920,
+  .height   = 1080,
+  .fps      = 60,
+  .format   = FRAME_TYPE_BGRA,
+  .pattern  = PATTERN_DAMAGE,
+  .cursor   = false,
+  .useFutex = true,
+  .stress   = 0,
+  .streams  = 1,
+  .replayFile = NULL,
+  .speed    = 1.0
+};
+
+struct AppState state;
+
+static uint64_t nanotime()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
+}
+
+static void notify(const unsigned int index)
+{
+  // the client measures the wakeup latency against this
+  state.shm->notify[index].time = nanotime();
+  __sync_fetch_and_add(&state.shm->notify[index].count, 1);
+
+  if (params.useFutex)
+    syscall(SYS_futex, &state.shm->notify[index].count, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static uint32_t nextCursorPosSeq(struct StreamState * s)
+{
+  // zero is reserved to mean no position has been sent
+  uint32_t seq = __atomic_add_fetch(&s->cursorPosSeq, 1, __ATOMIC_RELAXED);
+  if (seq == 0)
+    seq = __atomic_add_fetch(&s->cursorPosSeq, 1, __ATOMIC_RELAXED);
+  return seq;
+}
+
+static void publishCursorPos(struct StreamState * s, const int x, const int y, const uint32_t seq)
+{
+  /* as in the host, a writer preempted after taking its seq must not replace
+   * a newer position that another writer has published since */
+  const uint64_t pos     = KVMFR_CURSOR_POS(x, y, seq);
+  uint64_t       current = __atomic_load_n(&s->shm->cursor.pos, __ATOMIC_RELAXED);
+  do
+  {
+    const uint32_t currentSeq = KVMFR_CURSOR_POS_SEQ(current);
+    if (currentSeq && (int32_t)(seq - currentSeq) <= 0)
+      return;
+  }
+  while(!__atomic_compare_exchange_n(&s->shm->cursor.pos, &current, pos,
+    false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  notify(KVMFR_NOTIFY_CURSOR(s->index));
+}
+
+static void setCursorPos(struct StreamState * s, const int x, const int y)
+{
+  publishCursorPos(s, x, y, nextCursorPosSeq(s));
+}
+
+static uint32_t nextFrameSeq(struct StreamState * s)
+{
+  // zero is reserved to mark a slot as invalid
+  if (++s->frameSeq == 0)
+    ++s->frameSeq;
+  return s->frameSeq;
+}
+
+static bool slotHeld(struct StreamState * s, const unsigned int slot)
+{
+  for(int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &state.shm->readers[i];
+    if (reader->id && (reader->holding & (1U << KVMFR_SLOT_INDEX(s->index, slot))))
+      return true;
+  }
+  return false;
+}
+
+// release the slots of readers that stopped sending heartbeats
+static void checkReaders()
+{
+  const uint64_t now = nanotime();
+  for(int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &state.shm->readers[i];
+    const uint32_t id = reader->id;
+    if (!id)
+    {
+      state.readerID[i] = 0;
+      continue;
+    }
+
+    if (id != state.readerID[i] || reader->heartbeat != state.readerBeat[i])
+    {
+      if (id != state.readerID[i])
+        DEBUG_INFO("Reader %d attached (0x%08x)", i, id);
+
+      state.readerID  [i] = id;
+      state.readerBeat[i] = reader->heartbeat;
+      state.readerSeen[i] = now;
+      continue;
+    }
+
+    if (now - state.readerSeen[i] < KVMFR_READER_TIMEOUT * 1000000ULL)
+      continue;
+
+    DEBUG_WARN("Reader %d (0x%08x) timed out after frame %u, releasing it", i, id, reader->consumed);
+    reader->holding = 0;
+    __sync_bool_compare_and_swap(&reader->id, id, 0);
+    state.readerID[i] = 0;
+  }
+}
+
+// only the readers showing the stream have to acknowledge its cursor
+static bool cursorAcked(struct StreamState * s)
+{
+  const uint32_t serial = s->shm->cursor.serial;
+  for(int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &state.shm->readers[i];
+    if (reader->id && (reader->streams & (1U << s->index)) &&
+        reader->cursorAck[s->index] != serial)
+      return false;
+  }
+  return true;
+}
+
+// see KVMFR.h for the details of the frame ring protocol
+static int acquireFrameSlot(struct StreamState * s)
+{
+  while(state.running)
+  {
+    int      slot = -1;
+    uint32_t age  = 0;
+    for(unsigned int i = 0; i < s->frameCount; ++i)
+    {
+      volatile KVMFRFrame * fi = &s->shm->frames[i];
+      if (slotHeld(s, i))
+        continue;
+
+      const uint32_t seq     = fi->seq;
+      const uint32_t slotAge = seq ? s->frameSeq - seq : UINT32_MAX;
+      if (slot < 0 || slotAge > age)
+      {
+        slot = i;
+        age  = slotAge;
+      }
+    }
+
+    if (slot < 0)
+    {
+      usleep(100);
+      checkReaders();
+      continue;
+    }
+
+    volatile KVMFRFrame * fi = &s->shm->frames[slot];
+    const uint32_t seq = __atomic_exchange_n(&fi->seq, 0, __ATOMIC_SEQ_CST);
+    if (slotHeld(s, slot))
+    {
+      __atomic_store_n(&fi->seq, seq, __ATOMIC_SEQ_CST);
+      continue;
+    }
+
+    return slot;
+  }
+
+  return -1;
+}
+
+static const char * formatNames[FRAME_TYPE_MAX] =
+{
+  [FRAME_TYPE_BGRA  ] = "bgra"  ,
+  [FRAME_TYPE_RGBA  ] = "rgba"  ,
+  [FRAME_TYPE_RGBA10] = "rgba10",
+  [FRAME_TYPE_YUV420] = "yuv420"
+};
+
+static const char * patternNames[PATTERN_MAX] =
+{
+  [PATTERN_FULL  ] = "full"  ,
+  [PATTERN_SCROLL] = "scroll",
+  [PATTERN_DAMAGE] = "damage",
+  [PATTERN_STATIC] = "static"
+};
+
+static size_t frameBytes()
+{
+  const size_t pixels = (size_t)params.width * params.height;
+  if (params.format == FRAME_TYPE_YUV420)
+    return pixels + (pixels / 4) * 2;
+  return pixels * 4;
+}
+
+// convert a 0xAARRGGBB colour into the pixel value of the output format
+static uint32_t packColor(const uint32_t argb)
+{
+  const uint32_t a = (argb >> 24) & 0xFF;
+  const uint32_t r = (argb >> 16) & 0xFF;
+  const uint32_t g = (argb >>  8) & 0xFF;
+  const uint32_t b = (argb      ) & 0xFF;
+
+  switch(params.format)
+  {
+    case FRAME_TYPE_BGRA:
+      return argb;
+
+    case FRAME_TYPE_RGBA:
+      return (a << 24) | (b << 16) | (g << 8) | r;
+
+    case FRAME_TYPE_RGBA10:
+      return ((a >> 6) << 30) |
+        (((b << 2) | (b >> 6)) << 20) |
+        (((g << 2) | (g >> 6)) << 10) |
+        (((r << 2) | (r >> 6))      );
+
+    case FRAME_TYPE_YUV420:
+    {
+      // BT.601 limited range, Y in the low byte, then U and V
+      const uint32_t y = (( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16;
+      const uint32_t u = ((-38 * (int)r -  74 * (int)g + 112 * (int)b + 128) >> 8) + 128;
+      const uint32_t v = ((112 * (int)r -  94 * (int)g -  18 * (int)b + 128) >> 8) + 128;
+      return y | (u << 8) | (v << 16);
+    }
+
+    default:
+      return argb;
+  }
+}
+
+static void fillRect(uint8_t * frame, const unsigned int x, const unsigned int y,
+  const unsigned int w, const unsigned int h, const uint32_t argb)
+{
+  const uint32_t color = packColor(argb);
+  if (params.format != FRAME_TYPE_YUV420)
+  {
+    const unsigned int pitch = params.width * 4;
+    for(unsigned int ry = y; ry < y + h; ++ry)
+    {
+      uint32_t * row = (uint32_t *)(frame + ry * pitch) + x;
+      for(unsigned int rx = 0; rx < w; ++rx)
+        row[rx] = color;
+    }
+    return;
+  }
+
+  for(unsigned int ry = y; ry < y + h; ++ry)
+    memset(frame + ry * params.width + x, color & 0xFF, w);
+
+  // the chroma planes are subsampled, round the rect outwards
+  const unsigned int cw = params.width  / 2;
+  const unsigned int ch = params.height / 2;
+  uint8_t * u = frame + params.width * params.height;
+  uint8_t * v = u + cw * ch;
+  const unsigned int cx  = x / 2;
+  const unsigned int cy  = y / 2;
+  const unsigned int cx2 = (x + w + 1) / 2 > cw ? cw : (x + w + 1) / 2;
+  const unsigned int cy2 = (y + h + 1) / 2 > ch ? ch : (y + h + 1) / 2;
+  for(unsigned int ry = cy; ry < cy2; ++ry)
+  {
+    memset(u + ry * cw + cx, (color >>  8) & 0xFF, cx2 - cx);
+    memset(v + ry * cw + cx, (color >> 16) & 0xFF, cx2 - cx);
+  }
+}
+
+static void blockPos(const uint64_t frameNo, unsigned int * x, unsigned int * y)
+{
+  const unsigned int w = params.width  - BLOCK_SIZE;
+  const unsigned int h = params.height - BLOCK_SIZE;
+  *x = (frameNo * 8) % w;
+  *y = (frameNo / (w / 8) * BLOCK_SIZE) % h;
+}
+
+/*
+Draws the complete frame for the stream's current frame number and fills in the
+damage that changed since the previous frame, a damage count of zero is a full
+update.
+*/
+static void drawFrame(struct StreamState * s, uint8_t * frame, volatile KVMFRFrame * fi)
+{
+  // each stream gets its own colour so they can be told apart
+  static const uint32_t colors[KVMFR_MAX_STREAMS] =
+    { 0xFFFFFFFF, 0xFFFF0000, 0xFF00FF00, 0xFF0000FF };
+  const uint32_t background = 0xFF404040;
+
+  fi->damageCount = 0;
+  switch(params.pattern)
+  {
+    case PATTERN_FULL:
+    {
+      // sweep the brightness so every pixel changes each frame
+      const uint32_t level = (s->frameNo * 4) & 0xFF;
+      fillRect(frame, 0, 0, params.width, params.height,
+        0xFF000000 | (colors[s->index] & ((level << 16) | (level << 8) | level)));
+      break;
+    }
+
+    case PATTERN_SCROLL:
+    {
+      // a band of stripes in the middle third scrolls down like a text view
+      const unsigned int top    = params.height / 3;
+      const unsigned int bottom = top * 2;
+      fillRect(frame, 0, 0     , params.width, top                  , background);
+      fillRect(frame, 0, bottom, params.width, params.height - bottom, background);
+      for(unsigned int y = top; y < bottom; y += SCROLL_STEP)
+      {
+        const bool odd = ((y + s->frameNo * SCROLL_STEP) / (SCROLL_STEP * 4)) & 1;
+        const unsigned int h = bottom - y < SCROLL_STEP ? bottom - y : SCROLL_STEP;
+        fillRect(frame, 0, y, params.width, h, odd ? colors[s->index] : 0xFF000000);
+      }
+
+      if (s->frameNo > 0)
+      {
+        fi->damage[0]   = (KVMFRRect){ 0, top, params.width, bottom - top };
+        fi->damageCount = 1;
+      }
+      break;
+    }
+
+    case PATTERN_DAMAGE:
+    case PATTERN_STATIC:
+    {
+      unsigned int x, y, px, py;
+      blockPos(params.pattern == PATTERN_STATIC ? 0 : s->frameNo    , &x , &y );
+      blockPos(params.pattern == PATTERN_STATIC ? 0 : s->frameNo - 1, &px, &py);
+
+      fillRect(frame, 0, 0, params.width, params.height, background);
+      fillRect(frame, x, y, BLOCK_SIZE, BLOCK_SIZE, colors[s->index]);
+
+      // only the old and new block positions changed
+      if (s->frameNo > 0)
+      {
+        fi->damage[0]   = (KVMFRRect){ px, py, BLOCK_SIZE, BLOCK_SIZE };
+        fi->damage[1]   = (KVMFRRect){ x , y , BLOCK_SIZE, BLOCK_SIZE };
+        fi->damageCount = 2;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+// publish a slot that has been filled in, see acquireFrameSlot
+static void commitFrame(struct StreamState * s, volatile KVMFRFrame * fi)
+{
+  fi->publishTime = nanotime();
+  __atomic_store_n(&fi->seq, nextFrameSeq(s), __ATOMIC_SEQ_CST);
+  notify(KVMFR_NOTIFY_FRAME(s->index));
+  ++s->frameNo;
+}
+
+static bool publishFrame(struct StreamState * s)
+{
+  const uint64_t captureTime = nanotime();
+  const int slot = acquireFrameSlot(s);
+  if (slot < 0)
+    return false;
+
+  // the slot data must always be a complete frame
+  uint8_t * frame = s->frameBase + slot * s->frameSize;
+  volatile KVMFRFrame * fi = &s->shm->frames[slot];
+  drawFrame(s, frame, fi);
+
+  fi->type    = params.format;
+  fi->width   = params.width;
+  fi->height  = params.height;
+  fi->stride  = params.width;
+  fi->pitch   = params.format == FRAME_TYPE_YUV420 ? params.width : params.width * 4;
+  fi->dataPos = frame - (uint8_t *)state.shm;
+
+  fi->captureTime = captureTime;
+  commitFrame(s, fi);
+  return true;
+}
+
+/*
+The second half of the Service::CursorThread handshake, once every reader has
+acknowledged the last update and any new shape has been filled in this makes
+the update visible to them.
+*/
+static void commitCursor(struct StreamState * s, const bool hasShape, const bool visible)
+{
+  volatile KVMFRCursor * cursor = &s->shm->cursor;
+
+  // the shape data stays valid until it is replaced
+  uint8_t flags = cursor->flags & KVMFR_CURSOR_FLAG_SHAPE;
+  if (hasShape)
+    flags |= KVMFR_CURSOR_FLAG_SHAPE;
+  if (visible)
+    flags |= KVMFR_CURSOR_FLAG_VISIBLE;
+
+  // publish the update, the atomic operation ensures the above is visible first
+  cursor->flags = flags;
+  __atomic_add_fetch(&cursor->serial, 1, __ATOMIC_RELEASE);
+  notify(KVMFR_NOTIFY_CURSOR(s->index));
+}
+
+/*
+Fills in one of the synthetic cursor shapes, an arrow with a black outline in
+each of the formats the host can send.
+*/
+static void makeCursorShape(struct StreamState * s, const unsigned int shape, volatile KVMFRCursor * cursor)
+{
+  const unsigned int size = CURSOR_SIZE;
+  uint8_t * data = s->cursorData;
+
+  #define CURSOR_INSIDE(x, y) ((y) < size - 4 && (x) <= (y) * 2 / 3)
+  #define CURSOR_EDGE(x, y) ((x) == 0 || (x) == (y) * 2 / 3 || (y) == size - 5)
+
+  switch(shape)
+  {
+    case CURSOR_TYPE_COLOR:
+    case CURSOR_TYPE_MASKED_COLOR:
+    {
+      // colour cursors use the alpha channel, masked colour ones use it as a
+      // mask to pick between replacing and xoring the pixel
+      const bool masked = shape == CURSOR_TYPE_MASKED_COLOR;
+      uint32_t * pixels = (uint32_t *)data;
+      for(unsigned int y = 0; y < size; ++y)
+        for(unsigned int x = 0; x < size; ++x)
+        {
+          uint32_t p;
+          if (!CURSOR_INSIDE(x, y))
+            p = masked ? 0xFF000000 : 0x00000000;
+          else if (CURSOR_EDGE(x, y))
+            p = masked ? 0x00000000 : 0xFF000000;
+          else
+            p = masked ? 0x0000FFFF : 0xFFFFFFFF;
+          pixels[y * size + x] = p;
+        }
+
+      cursor->width  = size;
+      cursor->height = size;
+      cursor->pitch  = size * 4;
+      break;
+    }
+
+    case CURSOR_TYPE_MONOCHROME:
+    {
+      // the AND mask followed by the XOR mask, one bit per pixel
+      const unsigned int pitch = size / 8;
+      uint8_t * andMask = data;
+      uint8_t * xorMask = data + pitch * size;
+      memset(data, 0, pitch * size * 2);
+      for(unsigned int y = 0; y < size; ++y)
+        for(unsigned int x = 0; x < size; ++x)
+        {
+          const uint8_t bit = 0x80 >> (x % 8);
+          if (!CURSOR_INSIDE(x, y))
+            andMask[y * pitch + x / 8] |= bit;
+          else if (!CURSOR_EDGE(x, y))
+            xorMask[y * pitch + x / 8] |= bit;
+        }
+
+      cursor->width  = size;
+      cursor->height = size * 2;
+      cursor->pitch  = pitch;
+      break;
+    }
+  }
+
+  #undef CURSOR_INSIDE
+  #undef CURSOR_EDGE
+
+  cursor->type    = shape;
+  cursor->dataPos = data - (uint8_t *)state.shm;
+}
+
+/*
+Moves the cursor every frame and cycles through the shapes following the same
+handshake as Service::CursorThread. Rather than blocking the frames until every
+reader has acknowledged the last update the shape change is retried next frame.
+*/
+static void updateCursor(struct StreamState * s)
+{
+  const double t = (double)s->frameNo / params.fps;
+  const int    x = params.width  / 2 + (params.width  / 2 - CURSOR_SIZE) * sin(t * 1.3);
+  const int    y = params.height / 2 + (params.height / 2 - CURSOR_SIZE) * sin(t * 0.9 + s->index);
+  setCursorPos(s, x, y);
+
+  const unsigned int shape = (s->frameNo / (params.fps * CURSOR_SHAPE_SECS)) % 3;
+  if (shape == s->cursorShape)
+    return;
+
+  if (!cursorAcked(s))
+    return;
+
+  volatile KVMFRCursor * cursor = &s->shm->cursor;
+  ++cursor->version;
+  makeCursorShape(s, shape, cursor);
+  commitCursor(s, true, true);
+  s->cursorShape = shape;
+}
+
+static bool init(const size_t maxFrameBytes)
+{
+  const size_t size = (size_t)params.shmSize * 1024 * 1024;
+  int fd = open(params.shmFile, O_RDWR | O_CREAT, (mode_t)0600);
+  if (fd < 0)
+  {
+    DEBUG_ERROR("Failed to open the shared memory file: %s", params.shmFile);
+    return false;
+  }
+
+  if (ftruncate(fd, size) < 0)
+  {
+    DEBUG_ERROR("Failed to resize the shared memory file");
+    close(fd);
+    return false;
+  }
+
+  state.shm = (struct KVMFRHeader *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (state.shm == MAP_FAILED)
+  {
+    DEBUG_ERROR("Failed to map the shared memory file");
+    state.shm = NULL;
+    return false;
+  }
+
+  // the cursor regions of every stream come first, the frames share the rest
+  uint8_t * base          = (uint8_t *)state.shm;
+  const size_t cursorPos  = ALIGN_TO(sizeof(struct KVMFRHeader), REGION_ALIGN);
+  uint8_t    * frameBase  = base + ALIGN_TO(cursorPos + params.streams * CURSOR_DATA_SIZE, REGION_ALIGN);
+
+  const size_t avail      = ALIGN_DN_TO((size - (frameBase - base)) / params.streams, REGION_ALIGN);
+  const size_t frameSize  = ALIGN_TO(maxFrameBytes, REGION_ALIGN);
+  unsigned int frameCount = avail / frameSize;
+  if (frameCount > KVMFR_MAX_FRAMES)
+    frameCount = KVMFR_MAX_FRAMES;
+
+  if (frameCount < 2)
+  {
+    DEBUG_ERROR("The shared memory is too small for %u streams of %ux%u frames",
+      params.streams, params.width, params.height);
+    return false;
+  }
+
+  memset(state.shm, 0, sizeof(struct KVMFRHeader));
+
+  // see KVMFR.h for the details of the region directory
+  KVMFRDirectory * dir = &state.shm->directory;
+  dir->version = KVMFR_DIRECTORY_VERSION;
+  dir->shmSize = size;
+
+  for(unsigned int i = 0; i < params.streams; ++i)
+  {
+    struct StreamState * s = &state.streams[i];
+    s->index      = i;
+    s->shm        = &state.shm->streams[i];
+    s->frameBase  = frameBase + i * avail;
+    s->frameCount = frameCount;
+    s->cursorData = base + cursorPos + i * CURSOR_DATA_SIZE;
+    s->cursorShape = UINT_MAX;
+    s->frameSize  = ALIGN_DN_TO(avail / frameCount, REGION_ALIGN);
+    s->shm->frameCount = frameCount;
+
+    dir->regions[dir->count++] = (KVMFRRegion)
+    {
+      .type   = KVMFR_REGION_CURSOR,
+      .index  = i,
+      .offset = cursorPos + i * CURSOR_DATA_SIZE,
+      .size   = CURSOR_DATA_SIZE,
+      .align  = REGION_ALIGN
+    };
+
+    for(unsigned int j = 0; j < frameCount; ++j)
+      dir->regions[dir->count++] = (KVMFRRegion)
+      {
+        .type   = KVMFR_REGION_FRAME,
+        .index  = KVMFR_SLOT_INDEX(i, j),
+        .offset = s->frameBase + j * s->frameSize - base,
+        .size   = s->frameSize,
+        .align  = REGION_ALIGN
+      };
+  }
+
+  // an even serial marks the layout as complete
+  __atomic_store_n(&dir->serial, 2, __ATOMIC_RELEASE);
+  memcpy(state.shm->magic, KVMFR_HEADER_MAGIC, sizeof(KVMFR_HEADER_MAGIC));
+  state.shm->version    = KVMFR_HEADER_VERSION;
+  state.shm->notifyCaps = KVMFR_NOTIFY_CAP_TIME | (params.useFutex ? KVMFR_NOTIFY_CAP_FUTEX : 0);
+  state.shm->streamCount = params.streams;
+
+  DEBUG_INFO("Shared Memory   : %s (%u MB)", params.shmFile, params.shmSize);
+  DEBUG_INFO("Streams         : %u", params.streams);
+  DEBUG_INFO("Frame Count     : %u", frameCount);
+  DEBUG_INFO("Resolution      : %ux%u @ %u fps", params.width, params.height, params.fps);
+  DEBUG_INFO("Format          : %s", formatNames[params.format]);
+  DEBUG_INFO("Pattern         : %s", params.replayFile ? "replay" : patternNames[params.pattern]);
+  DEBUG_INFO("Cursor          : %s", params.cursor ? "yes" : "no");
+  DEBUG_INFO("Notification    : %s", params.useFutex ? "futex" : "none");
+  return true;
+}
+
+// returns true if the client asked for a restart
+static bool checkRestart()
+{
+  volatile uint8_t * flags = &state.shm->flags;
+  if (!(*flags & KVMFR_HEADER_FLAG_RESTART))
+    return false;
+
+  DEBUG_INFO("Restart Requested");
+
+  // the client can't have the previous frame, force a full update
+  for(unsigned int i = 0; i < params.streams; ++i)
+    nextFrameSeq(&state.streams[i]);
+  __sync_and_and_fetch(flags, ~KVMFR_HEADER_FLAG_RESTART);
+  return true;
+}
+
+static void run()
+{
+  const uint64_t interval = 1000000000ULL / params.fps;
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  while(state.running)
+  {
+    const bool restart = checkRestart();
+    checkReaders();
+
+    bool ok = true;
+    for(unsigned int i = 0; i < params.streams && ok; ++i)
+    {
+      struct StreamState * s = &state.streams[i];
+      if (params.cursor)
+        updateCursor(s);
+
+      // a static desktop only produces a frame when the client needs one
+      if (params.pattern != PATTERN_STATIC || s->frameNo == 0 || restart)
+        ok = publishFrame(s);
+      else
+        ++s->frameNo;
+    }
+
+    if (!ok)
+      break;
+
+    time.tv_nsec += interval;
+    while(time.tv_nsec >= 1000000000)
+    {
+      time.tv_nsec -= 1000000000;
+      ++time.tv_sec;
+    }
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL);
+  }
+}
+
+/*
+Replays a recording made by the client with -R, see KVMFRRecord.h. The file is
+scanned first to find the largest frame so the shared memory can be laid out
+for it, then the records are published at their recorded times divided by the
+speed, or if the speed is zero each frame as soon as every reader has taken the
+one before it.
+*/
+struct Replay
+{
+  FILE   * file;
+  uint8_t* buffer;
+  size_t   bufferSize;
+  uint8_t* frame;    // the last frame, damage records are applied to it
+  KVMFRRecordFrame frameInfo;
+  bool     haveFrame;
+  uint32_t lastSeq;  // the seq the last frame was published with
+  uint64_t frames;
+  uint64_t cursors;
+};
+
+static struct Replay replay;
+
+static size_t recordFrameBytes(const KVMFRRecordFrame * f)
+{
+  if (f->type == FRAME_TYPE_YUV420)
+  {
+    const size_t pixels = (size_t)f->width * f->height;
+    return pixels + (pixels / 4) * 2;
+  }
+  return (size_t)f->height * f->pitch;
+}
+
+// read the next record and its payload, returns false at the end of the file
+static bool readRecord(KVMFRRecord * r)
+{
+  if (fread(r, sizeof(*r), 1, replay.file) != 1)
+    return false;
+
+  if (r->size > replay.bufferSize)
+  {
+    uint8_t * buffer = realloc(replay.buffer, r->size);
+    if (!buffer)
+    {
+      DEBUG_ERROR("Failed to allocate %u bytes for a record", r->size);
+      return false;
+    }
+    replay.buffer     = buffer;
+    replay.bufferSize = r->size;
+  }
+
+  if (fread(replay.buffer, 1, r->size, replay.file) != r->size)
+  {
+    DEBUG_WARN("The recording is truncated");
+    return false;
+  }
+  return true;
+}
+
+static bool replayOpen(size_t * maxFrameBytes)
+{
+  replay.file = fopen(params.replayFile, "rb");
+  if (!replay.file)
+  {
+    DEBUG_ERROR("Failed to open the recording: %s", params.replayFile);
+    return false;
+  }
+
+  KVMFRRecordHeader header;
+  if (fread(&header, sizeof(header), 1, replay.file) != 1 ||
+      memcmp(header.magic, KVMFR_RECORD_MAGIC, sizeof(KVMFR_RECORD_MAGIC)) != 0 ||
+      header.version != KVMFR_RECORD_VERSION)
+  {
+    DEBUG_ERROR("%s is not a supported recording", params.replayFile);
+    return false;
+  }
+
+  // the frame size and format are taken from the recording
+  *maxFrameBytes = 0;
+  KVMFRRecord r;
+  unsigned int frames = 0;
+  uint64_t     length = 0;
+  while(fread(&r, sizeof(r), 1, replay.file) == 1)
+  {
+    // only the frame headers are needed, the payloads are skipped
+    KVMFRRecordFrame frame;
+    const KVMFRRecordFrame * f = &frame;
+    size_t skip = r.size;
+    length = r.time;
+    if (r.type == KVMFR_RECORD_FRAME)
+    {
+      if (r.size < sizeof(frame) || fread(&frame, sizeof(frame), 1, replay.file) != 1 ||
+          f->type == FRAME_TYPE_INVALID || f->type >= FRAME_TYPE_MAX)
+      {
+        DEBUG_ERROR("The recording contains an invalid frame");
+        return false;
+      }
+      skip -= sizeof(frame);
+    }
+
+    if (fseek(replay.file, skip, SEEK_CUR) != 0)
+      break;
+
+    if (r.type != KVMFR_RECORD_FRAME)
+      continue;
+
+    const size_t bytes = recordFrameBytes(f);
+    if (bytes > *maxFrameBytes)
+      *maxFrameBytes = bytes;
+
+    if (frames++ == 0)
+    {
+      params.width  = f->width;
+      params.height = f->height;
+      params.format = f->type;
+    }
+  }
+
+  if (!frames)
+  {
+    DEBUG_ERROR("The recording doesn't contain any frames");
+    return false;
+  }
+
+  DEBUG_INFO("Recording       : %s (%u frames, %.2f seconds)", params.replayFile, frames, length / 1e9);
+
+  if (!(replay.frame = malloc(*maxFrameBytes)))
+  {
+    DEBUG_ERROR("Failed to allocate the frame buffer");
+    return false;
+  }
+
+  fseek(replay.file, sizeof(header), SEEK_SET);
+  return true;
+}
+
+static void replayClose()
+{
+  if (replay.file)
+    fclose(replay.file);
+  free(replay.buffer);
+  free(replay.frame);
+  memset(&replay, 0, sizeof(replay));
+}
+
+// publish the last frame, with the damage of the record or as a full update
+static bool replayPublish(struct StreamState * s, const KVMFRRect * damage, const unsigned int damageCount)
+{
+  const KVMFRRecordFrame * f = &replay.frameInfo;
+  const size_t bytes = recordFrameBytes(f);
+
+  const uint64_t captureTime = nanotime();
+  const int slot = acquireFrameSlot(s);
+  if (slot < 0)
+    return false;
+
+  uint8_t * frame = s->frameBase + slot * s->frameSize;
+  memcpy(frame, replay.frame, bytes);
+
+  volatile KVMFRFrame * fi = &s->shm->frames[slot];
+  fi->type    = f->type;
+  fi->width   = f->width;
+  fi->height  = f->height;
+  fi->stride  = f->stride;
+  fi->pitch   = f->pitch;
+  fi->dataPos = frame - (uint8_t *)state.shm;
+
+  fi->damageCount = damageCount;
+  for(unsigned int i = 0; i < damageCount; ++i)
+    fi->damage[i] = damage[i];
+
+  fi->captureTime = captureTime;
+  commitFrame(s, fi);
+  replay.lastSeq = s->frameSeq;
+  return true;
+}
+
+// true once a reader is showing the stream and all that are have taken the last frame
+static bool replayConsumed(struct StreamState * s)
+{
+  bool attached = false;
+  for(int i = 0; i < KVMFR_MAX_READERS; ++i)
+  {
+    volatile KVMFRReader * reader = &state.shm->readers[i];
+    if (!reader->id || !(reader->streams & (1U << s->index)))
+      continue;
+
+    if ((int32_t)(reader->consumed - replay.lastSeq) < 0)
+      return false;
+    attached = true;
+  }
+  return attached;
+}
+
+static bool replayFrame(struct StreamState * s, const uint32_t size)
+{
+  const KVMFRRecordFrame * f = (const KVMFRRecordFrame *)replay.buffer;
+  const KVMFRRect * damage = (const KVMFRRect *)(f + 1);
+  const uint8_t   * data   = (const uint8_t *)(damage + f->damageCount);
+  const size_t      bytes  = recordFrameBytes(f);
+
+  if (f->damageCount > KVMFR_MAX_DAMAGE ||
+      size < sizeof(*f) + f->damageCount * sizeof(KVMFRRect))
+  {
+    DEBUG_ERROR("The recording contains an invalid frame");
+    return false;
+  }
+
+  size_t remain = size - sizeof(*f) - f->damageCount * sizeof(KVMFRRect);
+  if (f->damageCount == 0)
+  {
+    if (remain < bytes)
+    {
+      DEBUG_ERROR("The recording contains a short frame");
+      return false;
+    }
+    memcpy(replay.frame, data, bytes);
+  }
+  else
+  {
+    // the damage applies to the previous frame, which must be the same format
+    if (!replay.haveFrame || f->type != replay.frameInfo.type ||
+        f->width != replay.frameInfo.width || f->height != replay.frameInfo.height ||
+        f->pitch != replay.frameInfo.pitch)
+    {
+      DEBUG_ERROR("The recording has damage without the frame it applies to");
+      return false;
+    }
+
+    for(unsigned int i = 0; i < f->damageCount; ++i)
+    {
+      const KVMFRRect * r   = &damage[i];
+      const size_t      row = (size_t)r->width * 4;
+      if (r->x >= f->width  || r->width  > f->width  - r->x ||
+          r->y >= f->height || r->height > f->height - r->y ||
+          remain < row * r->height)
+      {
+        DEBUG_ERROR("The recording contains an invalid damage rect");
+        return false;
+      }
+
+      uint8_t * dst = replay.frame + (size_t)r->y * f->pitch + (size_t)r->x * 4;
+      for(unsigned int y = 0; y < r->height; ++y, dst += f->pitch, data += row)
+        memcpy(dst, data, row);
+      remain -= row * r->height;
+    }
+  }
+
+  replay.frameInfo = *f;
+  replay.haveFrame = true;
+  ++replay.frames;
+  return replayPublish(s, damage, f->damageCount);
+}
+
+static bool replayCursor(struct StreamState * s, const uint32_t size)
+{
+  const KVMFRRecordCursor * c = (const KVMFRRecordCursor *)replay.buffer;
+  if (size < sizeof(*c) || size - sizeof(*c) < c->dataSize)
+  {
+    DEBUG_ERROR("The recording contains an invalid cursor");
+    return false;
+  }
+
+  // wait until every reader has the last update like Service::CursorThread
+  while(!cursorAcked(s))
+  {
+    if (!state.running)
+      return false;
+    usleep(1000);
+    checkReaders();
+  }
+
+  if (c->dataSize > CURSOR_DATA_SIZE)
+    DEBUG_ERROR("Cursor size exceeds allocated space");
+  else if (c->dataSize)
+  {
+    volatile KVMFRCursor * cursor = &s->shm->cursor;
+    ++cursor->version;
+    cursor->type    = c->type;
+    cursor->width   = c->width;
+    cursor->height  = c->height;
+    cursor->pitch   = c->pitch;
+    cursor->dataPos = s->cursorData - (uint8_t *)state.shm;
+    memcpy(s->cursorData, c + 1, c->dataSize);
+  }
+
+  commitCursor(s, c->dataSize && c->dataSize <= CURSOR_DATA_SIZE, c->flags & KVMFR_CURSOR_FLAG_VISIBLE);
+  ++replay.cursors;
+  return true;
+}
+
+static bool replayRun()
+{
+  struct StreamState * s = &state.streams[0];
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  const uint64_t startTime = nanotime();
+
+  KVMFRRecord r;
+  bool ok = true;
+  while(state.running && ok && readRecord(&r))
+  {
+    if (params.speed > 0)
+    {
+      const uint64_t  due = r.time / params.speed;
+      struct timespec time = start;
+      time.tv_sec  += due / 1000000000ULL;
+      time.tv_nsec += due % 1000000000ULL;
+      if (time.tv_nsec >= 1000000000)
+      {
+        time.tv_nsec -= 1000000000;
+        ++time.tv_sec;
+      }
+
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL) == EINTR && state.running) {}
+    }
+    else if (r.type == KVMFR_RECORD_FRAME && replay.haveFrame)
+    {
+      // don't replace the last frame until the readers have taken it
+      while(ok && state.running && !replayConsumed(s))
+      {
+        if (checkRestart())
+          ok = replayPublish(s, NULL, 0);
+        checkReaders();
+        usleep(100);
+      }
+    }
+
+    // a restarted client needs the current frame again
+    if (checkRestart() && replay.haveFrame)
+      ok = replayPublish(s, NULL, 0);
+    checkReaders();
+
+    switch(r.type)
+    {
+      case KVMFR_RECORD_FRAME:
+        ok = ok && replayFrame(s, r.size);
+        break;
+
+      case KVMFR_RECORD_CURSOR:
+        ok = ok && replayCursor(s, r.size);
+        break;
+
+      case KVMFR_RECORD_CURSOR_POS:
+      {
+        const KVMFRRecordCursorPos * p = (const KVMFRRecordCursorPos *)replay.buffer;
+        if (r.size >= sizeof(*p))
+          setCursorPos(s, p->x, p->y);
+        break;
+      }
+
+      default:
+        // newer record types can be skipped
+        break;
+    }
+  }
+
+  const double secs = (nanotime() - startTime) / 1e9;
+  DEBUG_INFO("Frames Replayed : %lu", (unsigned long)replay.frames);
+  DEBUG_INFO("Cursor Updates  : %lu", (unsigned long)replay.cursors);
+  DEBUG_INFO("Duration        : %.2f s (%.2f fps)", secs, secs > 0 ? replay.frames / secs : 0.0);
+  return ok;
+}
+
+/*
+The stress test hammers the cursor position from two writer threads, like the
+host's mouse hook and cursor thread, while a reader thread consumes it the same
+way the client's cursor thread does. x and y are derived from the sequence so
+any torn or stale read is detected.
+*/
+#define STRESS_WRITERS 2
+#define STRESS_X(seq) ((int16_t)((seq) * 7))
+#define STRESS_Y(seq) ((int16_t)~((seq) * 13))
+
+struct StressStats
+{
+  uint64_t reads;
+  uint64_t moves;
+  uint64_t torn;
+  uint64_t backwards;
+  uint64_t updates;
+};
+
+static volatile bool stressDone;
+
+static void * stressWriter(void * opaque)
+{
+  const bool           shapes = (uintptr_t)opaque == 0;
+  struct StreamState * s      = &state.streams[0];
+  uint64_t writes = 0;
+  while(!stressDone)
+  {
+    const uint32_t seq = nextCursorPosSeq(s);
+    publishCursorPos(s, STRESS_X(seq), STRESS_Y(seq), seq);
+
+    // the first writer interleaves shape style updates that wait for the readers to acknowledge
+    if ((++writes & 0xFF) == 0 && shapes && cursorAcked(s))
+    {
+      s->shm->cursor.flags = KVMFR_CURSOR_FLAG_VISIBLE;
+      __atomic_add_fetch(&s->shm->cursor.serial, 1, __ATOMIC_RELEASE);
+      notify(KVMFR_NOTIFY_CURSOR(s->index));
+    }
+  }
+  return (void *)(uintptr_t)writes;
+}
+
+static void * stressReader(void * opaque)
+{
+  struct StressStats * stats = (struct StressStats *)opaque;
+  KVMFRStream        * s     = &state.shm->streams[0];
+  uint32_t posSeq = 0;
+
+  volatile KVMFRReader * reader = NULL;
+  for(int i = 0; i < KVMFR_MAX_READERS && !reader; ++i)
+    if (__sync_bool_compare_and_swap(&state.shm->readers[i].id, 0, 0x57E55))
+      reader = &state.shm->readers[i];
+
+  if (!reader)
+  {
+    DEBUG_ERROR("All reader slots are in use");
+    return NULL;
+  }
+  reader->streams = 1;
+
+  while(!stressDone)
+  {
+    const uint64_t pos = __atomic_load_n(&s->cursor.pos, __ATOMIC_ACQUIRE);
+    const uint32_t seq = KVMFR_CURSOR_POS_SEQ(pos);
+    ++stats->reads;
+
+    if (seq != 0 && seq != posSeq)
+    {
+      ++stats->moves;
+      if (KVMFR_CURSOR_POS_X(pos) != STRESS_X(seq) ||
+          KVMFR_CURSOR_POS_Y(pos) != STRESS_Y(seq))
+        ++stats->torn;
+
+      if ((int32_t)(seq - posSeq) < 0)
+        ++stats->backwards;
+
+      posSeq = seq;
+    }
+
+    const uint32_t serial = __atomic_load_n(&s->cursor.serial, __ATOMIC_ACQUIRE);
+    if (serial != reader->cursorAck[0])
+    {
+      reader->cursorAck[0] = serial;
+      ++stats->updates;
+    }
+  }
+
+  reader->streams = 0;
+  reader->id      = 0;
+  return NULL;
+}
+
+static bool stress()
+{
+  DEBUG_INFO("Cursor stress test for %u seconds", params.stress);
+
+  struct StressStats stats;
+  memset(&stats, 0, sizeof(stats));
+  stressDone = false;
+
+  pthread_t writers[STRESS_WRITERS], reader;
+  if (pthread_create(&reader, NULL, stressReader, &stats) != 0)
+  {
+    DEBUG_ERROR("Failed to create the reader thread");
+    return false;
+  }
+
+  unsigned int started = 0;
+  for(; started < STRESS_WRITERS; ++started)
+    if (pthread_create(&writers[started], NULL, stressWriter, (void *)(uintptr_t)started) != 0)
+    {
+      DEBUG_ERROR("Failed to create writer thread %u", started);
+      break;
+    }
+
+  if (started == STRESS_WRITERS)
+    for(unsigned int i = 0; i < params.stress && state.running; ++i)
+      sleep(1);
+
+  stressDone = true;
+  uint64_t writes = 0;
+  for(unsigned int i = 0; i < started; ++i)
+  {
+    void * count;
+    pthread_join(writers[i], &count);
+    writes += (uintptr_t)count;
+  }
+  pthread_join(reader, NULL);
+
+  if (started < STRESS_WRITERS)
+    return false;
+
+  DEBUG_INFO("Writes          : %lu", (unsigned long)writes);
+  DEBUG_INFO("Reads           : %lu", (unsigned long)stats.reads);
+  DEBUG_INFO("Moves Seen      : %lu", (unsigned long)stats.moves);
+  DEBUG_INFO("Shape Updates   : %lu", (unsigned long)stats.updates);
+  DEBUG_INFO("Torn Reads      : %lu", (unsigned long)stats.torn);
+  DEBUG_INFO("Out of Order    : %lu", (unsigned long)stats.backwards);
+
+  return stats.torn == 0 && stats.backwards == 0;
+}
+
+static void intHandler(int signal)
+{
+  state.running = false;
+}
+
+static void doHelp(char * app)
+{
+  fprintf(stderr,
+    "Looking Glass Producer\n"
+    "Usage: %s [OPTION]...\n"
+    "\n"
+    "  -h        Print out this help\n"
+    "\n"
+    "  -f PATH   Specify the path to the shared memory file [current: %s]\n"
+    "  -L SIZE   Specify the size in MB of the shared memory file [current: %u]\n"
+    "  -w WIDTH  Frame width [current: %u]\n"
+    "  -b HEIGHT Frame height [current: %u]\n"
+    "  -r RATE   Frames per second [current: %u]\n"
+    "  -n COUNT  Number of display streams to publish [current: %u]\n"
+    "  -t FORMAT Pixel format: bgra, rgba, rgba10 or yuv420 [current: %s]\n"
+    "  -p NAME   Change pattern [current: %s]\n"
+    "              full   - every pixel changes each frame\n"
+    "              scroll - a band in the middle of the screen scrolls\n"
+    "              damage - a small block moves around the screen\n"
+    "              static - only the first frame and restarts are sent\n"
+    "  -c        Move the cursor and cycle through the cursor shapes\n"
+    "  -R PATH   Replay a recording made by the client instead of generating frames\n"
+    "  -x SPEED  Replay speed multiplier, 0 for as fast as the client takes frames [current: %.2f]\n"
+    "  -P        Don't wake futex waiters, the client has to poll\n"
+    "  -S SECS   Stress test the cursor position for SECS seconds and exit\n"
+    "\n",
+    app,
+    params.shmFile,
+    params.shmSize,
+    params.width,
+    params.height,
+    params.fps,
+    params.streams,
+    formatNames[params.format],
+    patternNames[params.pattern],
+    params.speed
+  );
+}
+
+int main(int argc, char * argv[])
+{
+  for(;;)
+  {
+    switch(getopt(argc, argv, "hf:L:w:b:r:n:t:p:cR:x:PS:"))
+    {
+      case '?':
+      case 'h':
+      default :
+        doHelp(argv[0]);
+        return -1;
+
+      case -1:
+        break;
+
+      case 'f':
+        params.shmFile = optarg;
+        continue;
+
+      case 'L':
+        params.shmSize = atoi(optarg);
+        continue;
+
+      case 'w':
+        params.width = atoi(optarg);
+        continue;
+
+      case 'b':
+        params.height = atoi(optarg);
+        continue;
+
+      case 'r':
+        params.fps = atoi(optarg);
+        continue;
+
+      case 'n':
+        params.streams = atoi(optarg);
+        continue;
+
+      case 't':
+      {
+        int i;
+        for(i = FRAME_TYPE_BGRA; i < FRAME_TYPE_MAX; ++i)
+          if (strcmp(optarg, formatNames[i]) == 0)
+            break;
+
+        if (i == FRAME_TYPE_MAX)
+        {
+          DEBUG_ERROR("Unknown pixel format: %s", optarg);
+          return -1;
+        }
+        params.format = i;
+        continue;
+      }
+
+      case 'p':
+      {
+        int i;
+        for(i = 0; i < PATTERN_MAX; ++i)
+          if (strcmp(optarg, patternNames[i]) == 0)
+            break;
+
+        if (i == PATTERN_MAX)
+        {
+          DEBUG_ERROR("Unknown change pattern: %s", optarg);
+          return -1;
+        }
+        params.pattern = i;
+        continue;
+      }
+
+      case 'c':
+        params.cursor = true;
+        continue;
+
+      case 'R':
+        params.replayFile = optarg;
+        continue;
+
+      case 'x':
+        params.speed = atof(optarg);
+        continue;
+
+      case 'P':
+        params.useFutex = false;
+        continue;
+
+      case 'S':
+        params.stress = atoi(optarg);
+        continue;
+    }
+    break;
+  }
+
+  // the frame parameters come from the recording
+  size_t maxFrameBytes = 0;
+  if (params.replayFile)
+  {
+    params.streams = 1;
+    if (params.speed < 0)
+    {
+      DEBUG_ERROR("The replay speed can't be negative");
+      return -1;
+    }
+
+    if (!replayOpen(&maxFrameBytes))
+    {
+      replayClose();
+      return -1;
+    }
+  }
+  else if (params.width < BLOCK_SIZE * 2 || params.height < BLOCK_SIZE * 2 || params.fps == 0)
+  {
+    DEBUG_ERROR("Invalid frame parameters");
+    return -1;
+  }
+
+  if (params.format == FRAME_TYPE_YUV420 && ((params.width | params.height) & 1))
+  {
+    DEBUG_ERROR("YUV420 frames must have an even width and height");
+    return -1;
+  }
+
+  if (params.streams < 1 || params.streams > KVMFR_MAX_STREAMS)
+  {
+    DEBUG_ERROR("The stream count must be between 1 and %d", KVMFR_MAX_STREAMS);
+    return -1;
+  }
+
+  if (!init(params.replayFile ? maxFrameBytes : frameBytes()))
+  {
+    replayClose();
+    return -1;
+  }
+
+  signal(SIGINT , intHandler);
+  signal(SIGTERM, intHandler);
+
+  state.running = true;
+
+  int ret = 0;
+  if (params.stress)
+    ret = stress() ? 0 : -1;
+  else if (params.replayFile)
+  {
+    ret = replayRun() ? 0 : -1;
+    replayClose();
+  }
+  else
+    run();
+
+  munmap(state.shm, (size_t)params.shmSize * 1024 * 1024);
+  return ret;
+}